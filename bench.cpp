@@ -0,0 +1,130 @@
+/* bench.cpp
+ * Benchmarks story construction and playing on generated stories, without audio nor a human.
+ * Prints one JSON object per run, so results can be compared between versions.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * Usage: bench [scenes] [branching] [text length] [steps]
+ *
+ * The rendered run also hands every sound to SSound::MASTER, on the null
+ * backend. "revision" is the source the binary was built from, make bench
+ * passes it from git.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <sys/resource.h>
+
+#include "sbench.h"
+
+#ifndef SBENCH_REVISION
+#define SBENCH_REVISION "unknown"
+#endif
+
+static std::atomic<std::uint64_t> allocations(0);
+
+// Kept out of line: once inlined next to std::free, GCC warns about a mismatched delete.
+__attribute__((noinline)) void *operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+
+double seconds(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+long peakRssKb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    SStory::StoryShape shape;
+    std::uint64_t steps = 1000000;
+    if (argc > 1)
+        shape.scenes = static_cast<std::uint32_t>(std::atol(argv[1]));
+    if (argc > 2)
+        shape.branching = static_cast<std::uint32_t>(std::atol(argv[2]));
+    if (argc > 3)
+        shape.textLength = static_cast<std::uint32_t>(std::atol(argv[3]));
+    if (argc > 4)
+        steps = static_cast<std::uint64_t>(std::atoll(argv[4]));
+
+    auto clock = std::chrono::steady_clock::now();
+    SStory::Story story;
+    SStory::generate(story, shape);
+    const double build = seconds(clock);
+    const std::size_t storyBytes = story.memory().total();
+
+    clock = std::chrono::steady_clock::now();
+    const SStory::CompiledStory compiled = story.compile();
+    const double compile = seconds(clock);
+    const SStory::Graph graph = compiled.graph();
+
+    // Bare steps, the cost of the session engine alone.
+    std::vector<SStory::Event> events;
+    events.reserve(64);
+    SStory::ScriptedPlayer player(graph, 42);
+    player.begin(events);
+    std::uint64_t before = allocations.load();
+    clock = std::chrono::steady_clock::now();
+    for (std::uint64_t i = 0; i < steps; ++i)
+    {
+        player.step(events);
+    }
+    const double play = seconds(clock);
+    const double allocsPerStep = double(allocations.load() - before) / steps;
+
+    // Same walk, rendered into memory and with its sounds played like a front-end would.
+    SSound::NullBackend *sounds = new SSound::NullBackend(0);
+    SSound::MASTER.use(std::unique_ptr<SSound::Backend>(sounds));
+    SStory::MemorySink sink;
+    SStory::Renderer renderer(sink);
+    SStory::ScriptedPlayer reader(graph, 42);
+    reader.begin(events);
+    clock = std::chrono::steady_clock::now();
+    for (std::uint64_t i = 0; i < steps; ++i)
+    {
+        reader.step(events);
+        SStory::playSounds(graph, events);
+        renderer.render(graph, events);
+        sink.data.clear();
+    }
+    const double render = seconds(clock);
+
+    std::printf("{\"revision\": \"%s\", \"scenes\": %u, \"branching\": %u, \"text_length\": %u, \"steps\": %llu, "
+                "\"build_s\": %.6f, \"compile_s\": %.6f, "
+                "\"steps_per_s\": %.0f, \"scenes_per_s\": %.0f, \"rendered_steps_per_s\": %.0f, "
+                "\"sounds_per_step\": %.4f, \"allocs_per_step\": %.4f, \"story_kb\": %zu, \"peak_rss_kb\": %ld}\n",
+                SBENCH_REVISION, shape.scenes, shape.branching, shape.textLength, static_cast<unsigned long long>(steps),
+                build, compile,
+                steps / play, player.scenes / play, steps / render,
+                double(sounds->plays) / steps, allocsPerStep, storyBytes / 1024, peakRssKb());
+    return 0;
+}
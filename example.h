@@ -0,0 +1,66 @@
+/* example.h
+ * The sample adventure, shared by the game and the tools.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ */
+
+#ifndef Example_h
+#define Example_h
+
+#include "sstatic.h"
+
+// Test of the different feactures of SStory, declared at compile time.
+#define EXAMPLE_STORY(SCENE, TEXT, SOUND, CHOICE, REPLY) \
+    SCENE(START) \
+    SOUND("Es poco después de las 12 de la noche. Te encuentras manejando, en medio de la nada, camino a casa después de una reunión con tus viejos amigos en la ciudad vecina.", driving, center) \
+    TEXT("El camino se encuentra más vacío que de costumbre, y la monotonía de los árboles a cada lado da la sensación de que el camino no termina. Tal vez sea bueno parar un momento.") \
+    REPLY(LLEGADA, "Detenerme en el camino", "Un poco de aire fresco podría ayudar. Llevas manejando varias horas y decides detenerte un poco más adelante.") \
+    REPLY(LLEGADA, "Seguir manejando", "Tal vez después, el camino es muy largo aún. Un poco más adelante decides detenerte un momento, algo no está bién con el carro.") \
+    SCENE(LLEGADA) \
+    SOUND("Te detienes a un lado del camino. Al salir notas el silencio que cubre todo el bosque, un escenario perfecto para una caminata. Como siempre, nunca hay red en estas zonas.", engine_off, center) \
+    SOUND("Decides marcar donde parqueaste y tomar una corta caminata por el bosque. Después de un rato el camino que seguías se divide en tres. ", walking, center) \
+    TEXT(" El primero parece poco obstruido y aclarado por la luz de la luna llena.\n El segundo parece estar cubierto por más árboles.\n El tercero, parece descender y reflejos de luz se ven a lo lejos.") \
+    TEXT("¿Cuál tomar?") \
+    CHOICE(CAM1, "El primer camino") \
+    CHOICE(CAM2, "El segundo camino") \
+    CHOICE(CAM3, "El tercer camino") \
+    SCENE(CAM1) \
+    SOUND("Te adentras en el camino, la luna está especialmente brillante, cada detalle del suelo resalta.", wolf, background) \
+    SOUND("Después de caminar un rato escuchas el aullido de un animal, muy probablemente un lobo. Logras detectar el lugar del que parece provenir el ruido. ¿Qué deseas hacer?", howl, right) \
+    CHOICE(WOLF, "Investigar el ruido") \
+    REPLY(CAM2, "Alejarse del ruido", "Decides alejarte del ruido y retornar al camino, no mucho tiempo pasa hasta que llegas a un nuevo sendero en un denso bosque") \
+    SCENE(CAM2) \
+    SOUND("A pesar de lo frondoso del bosque, puedes escuchar la naturaleza que habita el ajeno lugar. Una calma se apodera de tu cuerpo mientras continuas haciendo camino.", forest, background) \
+    SOUND("La calma se siente cortada al escuchar un disparo a la distancia. ¿Quién más podría estar en este lugar?", gun, right) \
+    REPLY(CAM3, "Investigar el origen del disparo", "Te acercas al lugar donde crees que provino el primer disparo, en frente hay un joven cazador y a la distancia un ciervo. \n\nEl cazador voltea a verte e indica que hagas silencio, pero el ciervo se escapa. El cazador, triste de haber perdido a su presa, se acerca y te orienta a un claro donde dice que pasa un río. Insiste en que es más seguro ahí, ya que en el espeso bosque podría haberte confundido con un ciervo.") \
+    CHOICE(HUNT, "Seguir en el camino") \
+    SCENE(CAM3) \
+    SOUND("Descendiendo por el camino, llegas al claro de un rio.", river, left) \
+    TEXT("La vista es bastante tranquila, el ruido del río se combina con la luz de la luna, y el cielo está lleno de estrellas, unas más grandes que otras.") \
+    SOUND("Te recuestas y contemplas la calma del lugar y las distintas constelaciones que puedes armar con las distintas estrellas. Casi nunca tienes este tipo de oportunidad.", piano, background) \
+    CHOICE(FINAL, "Dormir un rato") \
+    CHOICE(INF, "Volver al carro") \
+    SCENE(FINAL) \
+    SOUND("Cierras los ojos y duermes.", piano, background) \
+    TEXT("Sientes que el frío de la noche se vuelve sólido. Al despertar notas que te encuentras de regreso en el asiento de pasajero del carro.") \
+    SOUND("Inicias el motor y retomas tu camino.", engine_on, center) \
+    SOUND("Poco después ves un letrero que indica el desvío a casa. Curiosamente notas que el bosque se acaba en el letrero, como si alguien separara los dos lugares con un regla imaginaria. La red del celular regresa y las notificaciones empiezan a llegar.", carby, center) \
+    TEXT("A pasado una semana.") \
+    SCENE(INF) \
+    SOUND("Te levantas y retomas tu camino de regreso al carro.", walking, center) \
+    TEXT("El camino de regreso se ve distinto del que habías recorrido, pero no le das mucha importancia.") \
+    SOUND("Enciendes el carro y retomas tu camino a casa.", engine_on, center) \
+    SOUND("Las horas pasan y sientes que ya has pasado por los mismos lugares y los mismos árboles, hasta que detallas que más adelante están las marcas de la vez que te detuviste a caminar.", driving, center) \
+    SCENE(WOLF) \
+    SOUND("Al acercarte, un nuevo aullido se escucha aun más cerca que antes, pero del lado opuesto, casi como si la criatura supiera que la estas buscando.", howl, left) \
+    SOUND("Un nuevo ruido, esta vez más agersivo se escucha muy cerca, tal vez ésta no era una muy buena idea después de todo.", growl, center) \
+    SOUND("Un lobo salta y ataca desde los arbustos, no hay mucho que puedas hacer, un ataque por sorpresa.", attack, center) \
+    SCENE(HUNT) \
+    TEXT("Continuas normal con tu camino.") \
+    SOUND("Otro disparo, pero esta vez te deja sin alientos. Al revisarte, ves como la sangre empieza a fluir del pecho a travez de la ropa.", gun, right) \
+    TEXT("Te sientes frío, y la oscuridad lo cubre todo.")
+
+SSTORY_STATIC(Example, EXAMPLE_STORY)
+
+#endif // Example_h
@@ -0,0 +1,618 @@
+/* sanalysis.h
+ * Static checks over a compiled story graph.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ */
+
+#ifndef SAnalysis_h
+#define SAnalysis_h
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sstory.h"
+
+namespace SStory
+{
+
+//! Distance of the scenes BFS never reached.
+constexpr std::uint32_t UNREACHED = 0xFFFFFFFF;
+
+struct Adjacency
+{
+    //! Compressed rows of scene to scene edges, END left out.
+    std::vector<std::uint32_t> offsets; // nScenes + 1
+    std::vector<SceneId> targets;
+
+    std::uint32_t size() const
+    {
+        return static_cast<std::uint32_t>(offsets.size() - 1);
+    }
+
+    //! Edges are the exits of every scene, see Graph::exits().
+    static Adjacency forward(const Graph &g)
+    {
+        Adjacency out;
+        out.offsets.resize(g.nScenes + 1, 0);
+        out.targets.reserve(g.nChoices);
+        for (SceneId id = 0; id < g.nScenes; ++id)
+        {
+            std::uint32_t count = 0;
+            const ChoiceEntry *first = g.exits(id, count);
+            for (std::uint32_t c = 0; c < count; ++c)
+            {
+                if (first[c].target != END_SCENE)
+                    out.targets.push_back(first[c].target);
+            }
+            out.offsets[id + 1] = static_cast<std::uint32_t>(out.targets.size());
+        }
+        return out;
+    }
+
+    Adjacency reversed() const
+    {
+        Adjacency out;
+        out.offsets.assign(offsets.size(), 0);
+        out.targets.resize(targets.size());
+        for (const SceneId target : targets)
+        {
+            ++out.offsets[target + 1];
+        }
+        for (std::size_t i = 1; i < out.offsets.size(); ++i)
+        {
+            out.offsets[i] += out.offsets[i - 1];
+        }
+        std::vector<std::uint32_t> fill(out.offsets.begin(), out.offsets.end() - 1);
+        for (SceneId from = 0; from < size(); ++from)
+        {
+            for (std::uint32_t e = offsets[from]; e < offsets[from + 1]; ++e)
+            {
+                out.targets[fill[targets[e]]++] = from;
+            }
+        }
+        return out;
+    }
+};
+
+//! Level synchronous BFS, large frontiers are split between threads.
+//! Returns the distance of every scene to the closest source.
+inline std::vector<std::uint32_t> bfs(const Adjacency &adj, const std::vector<SceneId> &sources, unsigned threads)
+{
+    const std::size_t parallelFrontier = 4096;
+    std::vector<std::atomic<std::uint32_t>> dist(adj.size());
+    for (auto &d : dist)
+    {
+        d.store(UNREACHED, std::memory_order_relaxed);
+    }
+
+    std::vector<SceneId> frontier;
+    for (const SceneId s : sources)
+    {
+        if (dist[s].exchange(0) == UNREACHED)
+            frontier.push_back(s);
+    }
+
+    auto expand = [&](std::size_t begin, std::size_t end, std::uint32_t level, std::vector<SceneId> &next) {
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            const SceneId from = frontier[i];
+            for (std::uint32_t e = adj.offsets[from]; e < adj.offsets[from + 1]; ++e)
+            {
+                const SceneId to = adj.targets[e];
+                std::uint32_t expected = UNREACHED;
+                if (dist[to].load(std::memory_order_relaxed) == UNREACHED &&
+                    dist[to].compare_exchange_strong(expected, level, std::memory_order_relaxed))
+                    next.push_back(to);
+            }
+        }
+    };
+
+    std::vector<std::vector<SceneId>> local(std::max(1u, threads));
+    for (std::uint32_t level = 1; !frontier.empty(); ++level)
+    {
+        if (threads <= 1 || frontier.size() < parallelFrontier)
+        {
+            local[0].clear();
+            expand(0, frontier.size(), level, local[0]);
+            frontier.swap(local[0]);
+            continue;
+        }
+        std::vector<std::thread> workers;
+        const std::size_t share = (frontier.size() + threads - 1) / threads;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            local[t].clear();
+            const std::size_t begin = std::min(frontier.size(), t * share);
+            const std::size_t end = std::min(frontier.size(), begin + share);
+            workers.emplace_back(expand, begin, end, level, std::ref(local[t]));
+        }
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+        frontier.clear();
+        for (const auto &part : local)
+        {
+            frontier.insert(frontier.end(), part.begin(), part.end());
+        }
+    }
+
+    std::vector<std::uint32_t> out(dist.size());
+    for (std::size_t i = 0; i < dist.size(); ++i)
+    {
+        out[i] = dist[i].load(std::memory_order_relaxed);
+    }
+    return out;
+}
+
+//! Iterative Tarjan, components come out in reverse topological order.
+//! Returns the component of every scene and sets count to the number of them.
+inline std::vector<std::uint32_t> components(const Adjacency &adj, std::uint32_t &count)
+{
+    const std::uint32_t n = adj.size();
+    std::vector<std::uint32_t> index(n, UNREACHED);
+    std::vector<std::uint32_t> low(n, 0);
+    std::vector<std::uint32_t> component(n, UNREACHED);
+    std::vector<SceneId> stack;
+    std::vector<std::pair<SceneId, std::uint32_t>> calls; // Scene and next edge to visit.
+    std::uint32_t counter = 0;
+    count = 0;
+
+    for (SceneId root = 0; root < n; ++root)
+    {
+        if (index[root] != UNREACHED)
+            continue;
+        calls.emplace_back(root, adj.offsets[root]);
+        index[root] = low[root] = counter++;
+        stack.push_back(root);
+        while (!calls.empty())
+        {
+            const SceneId v = calls.back().first;
+            std::uint32_t &edge = calls.back().second;
+            if (edge < adj.offsets[v + 1])
+            {
+                const SceneId w = adj.targets[edge++];
+                if (index[w] == UNREACHED)
+                {
+                    index[w] = low[w] = counter++;
+                    stack.push_back(w);
+                    calls.emplace_back(w, adj.offsets[w]);
+                }
+                else if (component[w] == UNREACHED)
+                {
+                    low[v] = std::min(low[v], index[w]);
+                }
+                continue;
+            }
+            if (low[v] == index[v])
+            {
+                SceneId w;
+                do
+                {
+                    w = stack.back();
+                    stack.pop_back();
+                    component[w] = count;
+                } while (w != v);
+                ++count;
+            }
+            calls.pop_back();
+            if (!calls.empty())
+            {
+                const SceneId parent = calls.back().first;
+                low[parent] = std::min(low[parent], low[v]);
+            }
+        }
+    }
+    return component;
+}
+
+namespace detail
+{
+
+//! Numbers the components from first up of the scenes again, so every edge between two
+//! of them goes to a lower one, the order Tarjan gives them in. Edges leaving the scenes
+//! are left out.
+inline void orderComponents(const Adjacency &adj, const std::vector<SceneId> &scenes,
+                            std::vector<std::uint32_t> &component, std::uint32_t first, std::uint32_t count)
+{
+    const std::uint32_t n = count - first;
+    std::vector<std::uint32_t> offsets(n + 1, 0);
+    for (const SceneId v : scenes)
+    {
+        ++offsets[component[v] - first + 1];
+    }
+    for (std::uint32_t c = 0; c < n; ++c)
+    {
+        offsets[c + 1] += offsets[c];
+    }
+    std::vector<SceneId> members(scenes.size());
+    std::vector<std::uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    std::vector<std::uint32_t> incoming(n, 0);
+    for (const SceneId v : scenes)
+    {
+        members[fill[component[v] - first]++] = v;
+        for (std::uint32_t e = adj.offsets[v]; e < adj.offsets[v + 1]; ++e)
+        {
+            const std::uint32_t to = component[adj.targets[e]];
+            if (to >= first && to < count && to != component[v])
+                ++incoming[to - first];
+        }
+    }
+    std::vector<std::uint32_t> ready;
+    for (std::uint32_t c = 0; c < n; ++c)
+    {
+        if (incoming[c] == 0)
+            ready.push_back(c);
+    }
+    // Sources are taken first and get the highest numbers.
+    std::vector<std::uint32_t> renamed(n);
+    std::uint32_t next = count;
+    while (!ready.empty())
+    {
+        const std::uint32_t c = ready.back();
+        ready.pop_back();
+        renamed[c] = --next;
+        for (std::uint32_t i = offsets[c]; i < offsets[c + 1]; ++i)
+        {
+            const SceneId v = members[i];
+            for (std::uint32_t e = adj.offsets[v]; e < adj.offsets[v + 1]; ++e)
+            {
+                const std::uint32_t to = component[adj.targets[e]];
+                if (to >= first && to < count && to - first != c && --incoming[to - first] == 0)
+                    ready.push_back(to - first);
+            }
+        }
+    }
+    for (const SceneId v : scenes)
+    {
+        component[v] = renamed[component[v] - first];
+    }
+}
+
+} // namespace detail
+
+//! Forward-backward decomposition: the scenes both reached from a pivot and reaching
+//! it are its component, the ones only reached, only reaching or neither are three
+//! independent parts searched again by whichever thread is free. Scenes without
+//! incoming or outgoing edges, most of a branching story, are trimmed away first.
+//! Finds the components of components(), also numbered in reverse topological order.
+inline std::vector<std::uint32_t> components(const Adjacency &adj, std::uint32_t &count, unsigned threads)
+{
+    const std::uint32_t n = adj.size();
+    const Adjacency back = adj.reversed();
+    std::vector<std::uint32_t> component(n, UNREACHED);
+    std::uint32_t found = 0;
+
+    // Trim, each scene without edges left on one side is a component of its own. Scenes
+    // trimmed with no edges left out are numbered from 0 up, their targets went first.
+    // Those with no edges left in come before all they lead to, they get the highest
+    // numbers once the count is known.
+    const std::uint32_t source = UNREACHED - 1;
+    std::vector<std::uint32_t> in(n), out(n);
+    std::vector<SceneId> trimmed;
+    std::vector<SceneId> sources;
+    for (SceneId v = 0; v < n; ++v)
+    {
+        in[v] = back.offsets[v + 1] - back.offsets[v];
+        out[v] = adj.offsets[v + 1] - adj.offsets[v];
+        if (in[v] == 0 || out[v] == 0)
+            trimmed.push_back(v);
+    }
+    while (!trimmed.empty())
+    {
+        const SceneId v = trimmed.back();
+        trimmed.pop_back();
+        if (component[v] != UNREACHED)
+            continue;
+        if (in[v] == 0)
+        {
+            component[v] = source;
+            sources.push_back(v);
+        }
+        else
+        {
+            component[v] = found++;
+        }
+        for (std::uint32_t e = adj.offsets[v]; e < adj.offsets[v + 1]; ++e)
+        {
+            const SceneId w = adj.targets[e];
+            if (component[w] == UNREACHED && --in[w] == 0)
+                trimmed.push_back(w);
+        }
+        for (std::uint32_t e = back.offsets[v]; e < back.offsets[v + 1]; ++e)
+        {
+            const SceneId w = back.targets[e];
+            if (component[w] == UNREACHED && --out[w] == 0)
+                trimmed.push_back(w);
+        }
+    }
+
+    // Every part has a color of its own, scenes of other parts are never crossed.
+    // Colors are only written by the thread owning the part, read by its neighbours.
+    const std::uint32_t done = UNREACHED;
+    std::vector<std::atomic<std::uint32_t>> color(n);
+    std::vector<SceneId> rest;
+    for (SceneId v = 0; v < n; ++v)
+    {
+        color[v].store(component[v] == UNREACHED ? 0 : done, std::memory_order_relaxed);
+        if (component[v] == UNREACHED)
+            rest.push_back(v);
+    }
+    std::atomic<std::uint32_t> colors(1);
+    std::atomic<std::uint32_t> ids(found);
+
+    struct Part
+    {
+        std::uint32_t color;
+        std::vector<SceneId> scenes;
+    };
+    std::vector<Part> parts;
+    if (!rest.empty())
+        parts.push_back(Part{0, rest});
+    std::mutex lock;
+    std::condition_variable wake;
+    unsigned busy = 0;
+
+    // Splits a part, returns the parts left to search.
+    auto split = [&](Part &part, std::vector<Part> &left) {
+        const std::uint32_t c = part.color;
+        const std::uint32_t reached = colors.fetch_add(2, std::memory_order_relaxed);
+        const std::uint32_t reaching = reached + 1;
+        const std::uint32_t id = ids.fetch_add(1, std::memory_order_relaxed);
+        std::vector<SceneId> queue(1, part.scenes[0]);
+        color[queue[0]].store(reached, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < queue.size(); ++i)
+        {
+            for (std::uint32_t e = adj.offsets[queue[i]]; e < adj.offsets[queue[i] + 1]; ++e)
+            {
+                const SceneId w = adj.targets[e];
+                if (color[w].load(std::memory_order_relaxed) == c)
+                {
+                    color[w].store(reached, std::memory_order_relaxed);
+                    queue.push_back(w);
+                }
+            }
+        }
+        queue.assign(1, part.scenes[0]);
+        color[queue[0]].store(done, std::memory_order_relaxed);
+        component[queue[0]] = id;
+        for (std::size_t i = 0; i < queue.size(); ++i)
+        {
+            for (std::uint32_t e = back.offsets[queue[i]]; e < back.offsets[queue[i] + 1]; ++e)
+            {
+                const SceneId w = back.targets[e];
+                const std::uint32_t k = color[w].load(std::memory_order_relaxed);
+                if (k != c && k != reached)
+                    continue;
+                color[w].store(k == reached ? done : reaching, std::memory_order_relaxed);
+                if (k == reached)
+                    component[w] = id;
+                queue.push_back(w);
+            }
+        }
+        Part pieces[3] = {{reached, {}}, {reaching, {}}, {c, {}}};
+        for (const SceneId v : part.scenes)
+        {
+            const std::uint32_t k = color[v].load(std::memory_order_relaxed);
+            if (k != done)
+                pieces[k == reached ? 0 : k == reaching ? 1 : 2].scenes.push_back(v);
+        }
+        for (Part &piece : pieces)
+        {
+            if (!piece.scenes.empty())
+                left.push_back(std::move(piece));
+        }
+    };
+
+    auto work = [&] {
+        std::vector<Part> left;
+        std::unique_lock<std::mutex> guard(lock);
+        while (true)
+        {
+            wake.wait(guard, [&] { return !parts.empty() || busy == 0; });
+            if (parts.empty())
+                return;
+            Part part = std::move(parts.back());
+            parts.pop_back();
+            ++busy;
+            guard.unlock();
+            left.clear();
+            split(part, left);
+            guard.lock();
+            --busy;
+            for (Part &p : left)
+            {
+                parts.push_back(std::move(p));
+            }
+            wake.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; ++t)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    count = ids.load();
+    detail::orderComponents(adj, rest, component, found, count);
+    count += static_cast<std::uint32_t>(sources.size());
+    for (std::size_t i = 0; i < sources.size(); ++i)
+    {
+        component[sources[i]] = count - 1 - static_cast<std::uint32_t>(i);
+    }
+    return component;
+}
+
+struct Ending
+{
+    SceneId scene;
+    std::uint32_t shortest; // Choices from START.
+    std::uint32_t longest;  // Choices from START without going around a loop, a loop counts once.
+};
+
+class Analysis
+{
+    //! Everything that can go wrong in a story before anyone plays it.
+  public:
+    std::vector<SceneId> unreachable;        // Never reached from START.
+    std::vector<SceneId> stuck;              // Reached, but can never get to END.
+    std::vector<std::vector<SceneId>> loops; // Strongly connected components with a cycle.
+    std::vector<Ending> endings;             // Reachable scenes leading to END.
+    std::vector<std::string> undefined;      // Labels without scene, from CompiledStory.
+
+    //! Runs the forward and backward searches in parallel with the loop detection, itself
+    //! split between the threads.
+    static Analysis run(const Graph &g, unsigned threads = std::thread::hardware_concurrency())
+    {
+        Analysis out;
+        if (threads == 0)
+            threads = 1;
+        const Adjacency adj = Adjacency::forward(g);
+
+        std::uint32_t nComponents = 0;
+        std::vector<std::uint32_t> component;
+        std::thread search([&] {
+            component = threads > 1 ? components(adj, nComponents, threads) : components(adj, nComponents);
+        });
+
+        std::vector<SceneId> exitScenes;
+        for (SceneId id = 0; id < g.nScenes; ++id)
+        {
+            std::uint32_t count = 0;
+            const ChoiceEntry *first = g.exits(id, count);
+            bool ends = count == 0;
+            for (std::uint32_t c = 0; c < count && !ends; ++c)
+            {
+                ends = first[c].target == END_SCENE;
+            }
+            if (ends)
+                exitScenes.push_back(id);
+        }
+
+        std::vector<SceneId> start;
+        if (g.start != END_SCENE)
+            start.push_back(g.start);
+        const std::vector<std::uint32_t> dist = bfs(adj, start, threads);
+        const std::vector<std::uint32_t> toEnd = bfs(adj.reversed(), exitScenes, threads);
+        search.join();
+
+        std::vector<std::uint32_t> size(nComponents, 0);
+        for (SceneId id = 0; id < g.nScenes; ++id)
+        {
+            if (dist[id] == UNREACHED)
+                out.unreachable.push_back(id);
+            else if (toEnd[id] == UNREACHED)
+                out.stuck.push_back(id);
+            ++size[component[id]];
+        }
+
+        // A component is a loop if it has more than one scene or a scene choosing itself.
+        std::vector<std::uint32_t> loopOf(nComponents, UNREACHED);
+        for (SceneId id = 0; id < g.nScenes; ++id)
+        {
+            bool cyclic = size[component[id]] > 1;
+            for (std::uint32_t e = adj.offsets[id]; e < adj.offsets[id + 1] && !cyclic; ++e)
+            {
+                cyclic = adj.targets[e] == id;
+            }
+            if (!cyclic)
+                continue;
+            std::uint32_t &loop = loopOf[component[id]];
+            if (loop == UNREACHED)
+            {
+                loop = static_cast<std::uint32_t>(out.loops.size());
+                out.loops.emplace_back();
+            }
+            out.loops[loop].push_back(id);
+        }
+
+        // Longest path over the components, sources first: the reverse of their order.
+        std::vector<std::vector<SceneId>> members(nComponents);
+        for (SceneId id = 0; id < g.nScenes; ++id)
+        {
+            members[component[id]].push_back(id);
+        }
+        std::vector<std::uint32_t> longest(nComponents, UNREACHED);
+        if (g.start != END_SCENE)
+            longest[component[g.start]] = 0;
+        for (std::uint32_t c = nComponents; c-- > 0;)
+        {
+            if (longest[c] == UNREACHED)
+                continue;
+            for (const SceneId from : members[c])
+            {
+                for (std::uint32_t e = adj.offsets[from]; e < adj.offsets[from + 1]; ++e)
+                {
+                    const std::uint32_t next = component[adj.targets[e]];
+                    if (next != c && (longest[next] == UNREACHED || longest[next] < longest[c] + 1))
+                        longest[next] = longest[c] + 1;
+                }
+            }
+        }
+
+        for (const SceneId id : exitScenes)
+        {
+            if (dist[id] != UNREACHED)
+                out.endings.push_back(Ending{id, dist[id], longest[component[id]]});
+        }
+        return out;
+    }
+
+    //! No problem a player could run into.
+    bool clean() const
+    {
+        return unreachable.empty() && stuck.empty() && undefined.empty();
+    }
+
+    void report(const Graph &g, std::ostream &out) const
+    {
+        auto list = [&](const char *title, const std::vector<SceneId> &ids) {
+            out << title << ": " << ids.size() << '\n';
+            for (const SceneId id : ids)
+            {
+                out << "  " << g.str(g.scenes[id].label) << '\n';
+            }
+        };
+
+        out << "Undefined labels: " << undefined.size() << '\n';
+        for (const auto &label : undefined)
+        {
+            out << "  " << label << '\n';
+        }
+        list("Unreachable scenes", unreachable);
+        list("Scenes that never reach END", stuck);
+        out << "Loops: " << loops.size() << '\n';
+        for (const auto &loop : loops)
+        {
+            out << " ";
+            for (const SceneId id : loop)
+            {
+                out << ' ' << g.str(g.scenes[id].label);
+            }
+            out << '\n';
+        }
+        out << "Endings: " << endings.size() << '\n';
+        for (const auto &ending : endings)
+        {
+            out << "  " << g.str(g.scenes[ending.scene].label) << " shortest " << ending.shortest
+                << " longest " << ending.longest << '\n';
+        }
+    }
+};
+
+} // namespace SStory;
+
+#endif // SAnalysis_h
@@ -0,0 +1,31 @@
+/* sanalyze.cpp
+ * Checks a story script or binary story before shipping it.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ */
+
+#include <cstdlib>
+
+#include "sanalysis.h"
+#include "sscript.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " story.txt|story.ssb [threads]\n";
+        return 2;
+    }
+
+    SStory::StoryFile file;
+    if (!file.open(argv[1]))
+        return 1;
+
+    const unsigned threads = argc == 3 ? static_cast<unsigned>(std::atoi(argv[2])) : std::thread::hardware_concurrency();
+    const SStory::Graph graph = file.graph();
+    SStory::Analysis analysis = SStory::Analysis::run(graph, threads);
+    analysis.undefined = file.undefinedLabels();
+    analysis.report(graph, std::cout);
+    return analysis.clean() ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+/* sbench.h
+ * Synthetic stories and scripted players, for benchmarks and load tests.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ */
+
+#ifndef SBench_h
+#define SBench_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "sstory.h"
+
+namespace SStory
+{
+
+struct Rng
+{
+    //! xorshift64*, small and fast enough to never show up in a profile.
+    std::uint64_t state;
+
+    explicit Rng(std::uint64_t seed)
+        : state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+
+    std::uint64_t next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ull;
+    }
+
+    //! Uniform enough in [0, n) for n far below 2^32.
+    std::uint32_t below(std::uint32_t n)
+    {
+        return static_cast<std::uint32_t>(((next() >> 32) * n) >> 32);
+    }
+};
+
+struct StoryShape
+{
+    std::uint32_t scenes = 10000;
+    std::uint32_t branching = 3;  // Choices at the end of every scene.
+    std::uint32_t textLength = 200; // Bytes of text per block.
+    std::uint32_t blocks = 2;     // Blocks per scene, the last one has the choices.
+    double endings = 0.01;        // Share of choices going to END.
+    std::uint64_t seed = 1;
+};
+
+//! Fills the story with random scenes of the given shape, START is the first one.
+inline void generate(Story &story, const StoryShape &shape)
+{
+    static const char *const words[] = {"el", "camino", "bosque", "noche", "luna", "río", "lobo", "carro",
+                                        "árbol", "luz", "silencio", "viento", "casa", "sendero", "estrellas"};
+    Rng rng(shape.seed);
+    auto label = [](std::uint32_t i) { return i == 0 ? std::string("START") : "S" + std::to_string(i); };
+    std::string text, complement;
+    auto fill = [&](std::string &out) -> std::string & {
+        out.clear();
+        while (out.size() < shape.textLength)
+        {
+            if (!out.empty())
+                out += ' ';
+            out += words[rng.below(sizeof(words) / sizeof(words[0]))];
+        }
+        return out;
+    };
+
+    // Straight into the story tables, no ContentBody nor Choice in between.
+    for (std::uint32_t i = 0; i < shape.scenes; ++i)
+    {
+        story.beginScene(label(i));
+        for (std::uint32_t b = 1; b < shape.blocks; ++b)
+        {
+            if (rng.below(4) == 0)
+                story.addText(fill(text), static_cast<SSound::Sample>(rng.below(SSound::SAMPLE_COUNT)));
+            else
+                story.addText(fill(text));
+        }
+        story.addText(fill(text));
+        for (std::uint32_t c = 0; c < shape.branching; ++c)
+        {
+            const bool ends = rng.below(1000000) < shape.endings * 1000000;
+            const std::string target = ends ? std::string("END") : label(rng.below(shape.scenes));
+            if (c % 2 == 0)
+                story.addChoice(target, fill(text));
+            else
+                story.addChoice(target, fill(text), fill(complement));
+        }
+    }
+}
+
+class ScriptedPlayer
+{
+    //! Stands in for a human: answers every prompt with a pseudo random choice.
+  private:
+    const Graph &graph;
+    Rng rng;
+
+  public:
+    Session session;
+    std::uint64_t steps = 0;
+    std::uint64_t scenes = 0;
+    std::uint64_t endings = 0;
+
+    ScriptedPlayer(const Graph &g, std::uint64_t seed)
+        : graph(g), rng(seed) {}
+
+    void begin(std::vector<Event> &events)
+    {
+        graph.restart(session, events);
+        count(events);
+    }
+
+    //! Plays one step, starting over once the story ends.
+    void step(std::vector<Event> &events)
+    {
+        int input = 0;
+        const std::uint32_t shown = graph.choiceCount(session);
+        if (shown > 0)
+            input = static_cast<int>(rng.below(shown)) + 1;
+        ++steps;
+        if (!graph.step(session, input, events))
+        {
+            ++endings;
+            begin(events);
+            return;
+        }
+        count(events);
+    }
+
+  private:
+    void count(const std::vector<Event> &events)
+    {
+        for (const auto &event : events)
+        {
+            if (event.kind == EventKind::scene)
+                ++scenes;
+        }
+    }
+};
+
+} // namespace SStory;
+
+#endif // SBench_h
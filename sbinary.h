@@ -0,0 +1,271 @@
+/* sbinary.h
+ * Compact binary format for compiled stories, played straight from a memory map.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * Layout, every field little endian and 4 bytes aligned:
+ *
+ *   FileHeader
+ *   SceneEntry  scenes[nScenes]
+ *   BlockEntry  blocks[nBlocks]
+ *   ChoiceEntry choices[nChoices]
+ *   int32       initial[nVariables]
+ *   char        pool[poolSize]   (labels and every text, not null terminated)
+ *   uint8       code[codeSize]   (conditions and assignments, see scode.h)
+ *
+ * The checksum is FNV-1a over everything after the header.
+ */
+
+#ifndef SBinary_h
+#define SBinary_h
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sstory.h"
+
+namespace SStory
+{
+
+constexpr std::uint32_t BINARY_VERSION = 3;
+
+struct FileHeader
+{
+    char magic[4]; // "SSTB"
+    std::uint32_t version;
+    std::uint32_t checksum;
+    SceneId start;
+    std::uint32_t nScenes;
+    std::uint32_t nBlocks;
+    std::uint32_t nChoices;
+    std::uint32_t poolSize;
+    std::uint32_t nVariables;
+    std::uint32_t codeSize;
+};
+
+static_assert(sizeof(FileHeader) == 40 && sizeof(SceneEntry) == 16 && sizeof(BlockEntry) == 32 && sizeof(ChoiceEntry) == 28,
+              "The binary story layout must not depend on the compiler");
+static_assert(std::is_standard_layout<BlockEntry>::value && std::is_standard_layout<ChoiceEntry>::value,
+              "Compiled entries are written and mapped as raw memory");
+
+//! 32 bits FNV-1a, chained through the seed.
+inline std::uint32_t checksum(const char *data, std::size_t size, std::uint32_t seed = 2166136261u)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        seed ^= static_cast<unsigned char>(data[i]);
+        seed *= 16777619u;
+    }
+    return seed;
+}
+
+//! 64 bits FNV-1a, for keys that must not collide in practice.
+inline std::uint64_t hash64(const char *data, std::size_t size)
+{
+    std::uint64_t h = 14695981039346656037ull;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        h = (h ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+    }
+    return h;
+}
+
+//! Writes the graph in the binary format, returns false if the file could not be written.
+inline bool save(const Graph &g, const std::string &path)
+{
+    const char *sections[] = {reinterpret_cast<const char *>(g.scenes), reinterpret_cast<const char *>(g.blocks),
+                              reinterpret_cast<const char *>(g.choices), reinterpret_cast<const char *>(g.initial),
+                              g.pool, reinterpret_cast<const char *>(g.code)};
+    const std::size_t sizes[] = {g.nScenes * sizeof(SceneEntry), g.nBlocks * sizeof(BlockEntry),
+                                 g.nChoices * sizeof(ChoiceEntry), g.nVariables * sizeof(std::int32_t),
+                                 g.poolSize, g.codeSize};
+
+    FileHeader header = {{'S', 'S', 'T', 'B'}, BINARY_VERSION, 2166136261u, g.start, g.nScenes,
+                         g.nBlocks, g.nChoices, g.poolSize, g.nVariables, g.codeSize};
+    for (int i = 0; i < 6; ++i)
+    {
+        header.checksum = checksum(sections[i], sizes[i], header.checksum);
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (int i = 0; i < 6; ++i)
+    {
+        out.write(sections[i], sizes[i]);
+    }
+    return static_cast<bool>(out.flush());
+}
+
+class MappedStory
+{
+    //! A binary story mapped read only, its Graph points straight into the mapping.
+  private:
+    const char *base = nullptr;
+    std::size_t length = 0;
+
+    const FileHeader &header() const
+    {
+        return *reinterpret_cast<const FileHeader *>(base);
+    }
+
+    void fail(const std::string &path, const char *message)
+    {
+        std::cerr << "SStory(EE): " << path << ": " << message << '\n';
+        close();
+    }
+
+  public:
+    MappedStory() {}
+    MappedStory(const MappedStory &) = delete;
+    MappedStory &operator=(const MappedStory &) = delete;
+
+    ~MappedStory()
+    {
+        close();
+    }
+
+    //! Maps the file and checks its header, nothing else is read until played.
+    bool open(const std::string &path)
+    {
+        close();
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "SStory(EE): cannot open " << path << '\n';
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) >= sizeof(FileHeader))
+        {
+            void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                base = static_cast<const char *>(mapped);
+                length = info.st_size;
+            }
+        }
+        ::close(fd);
+        if (base == nullptr)
+        {
+            std::cerr << "SStory(EE): cannot map " << path << '\n';
+            return false;
+        }
+
+        const FileHeader &h = header();
+        if (std::memcmp(h.magic, "SSTB", 4) != 0)
+        {
+            fail(path, "not a binary story");
+            return false;
+        }
+        if (h.version != BINARY_VERSION)
+        {
+            fail(path, "unsupported version");
+            return false;
+        }
+        const std::uint64_t expected = sizeof(FileHeader) + std::uint64_t(h.nScenes) * sizeof(SceneEntry) +
+                                       std::uint64_t(h.nBlocks) * sizeof(BlockEntry) +
+                                       std::uint64_t(h.nChoices) * sizeof(ChoiceEntry) +
+                                       std::uint64_t(h.nVariables) * sizeof(std::int32_t) + h.poolSize + h.codeSize;
+        if (expected != length)
+        {
+            fail(path, "truncated file");
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (base != nullptr)
+            munmap(const_cast<char *>(base), length);
+        base = nullptr;
+        length = 0;
+    }
+
+    bool isOpen() const
+    {
+        return base != nullptr;
+    }
+
+    //! Full pass over the file: checksum and every index. Meant for untrusted files.
+    bool verify() const
+    {
+        if (base == nullptr || checksum(base + sizeof(FileHeader), length - sizeof(FileHeader)) != header().checksum)
+            return false;
+
+        const Graph g = graph();
+        auto inPool = [&g](TextRef t) { return std::uint64_t(t.offset) + t.size <= g.poolSize; };
+        auto runs = [&g](std::uint32_t at) {
+            return at == NO_CODE || validCode(g.code, g.codeSize, at, g.nVariables);
+        };
+        if (g.start != END_SCENE && g.start >= g.nScenes)
+            return false;
+        for (std::uint32_t i = 0; i < g.nScenes; ++i)
+        {
+            const SceneEntry &s = g.scenes[i];
+            if (!inPool(s.label) || std::uint64_t(s.firstBlock) + s.nBlocks > g.nBlocks)
+                return false;
+        }
+        for (std::uint32_t i = 0; i < g.nBlocks; ++i)
+        {
+            const BlockEntry &b = g.blocks[i];
+            if (!inPool(b.body) || std::uint64_t(b.firstChoice) + b.nChoices > g.nChoices ||
+                b.sample >= SSound::SAMPLE_COUNT || b.channel < 0 || b.channel >= SSound::CHANNEL_COUNT ||
+                !runs(b.condition) || (b.timeout != 0 && b.fallback >= b.nChoices))
+                return false;
+        }
+        for (std::uint32_t i = 0; i < g.nChoices; ++i)
+        {
+            const ChoiceEntry &c = g.choices[i];
+            if ((c.target != END_SCENE && c.target >= g.nScenes) || !inPool(c.displayText) ||
+                (c.complement.offset != NO_TEXT && !inPool(c.complement)) || !runs(c.condition) || !runs(c.effect))
+                return false;
+        }
+        return true;
+    }
+
+    Graph graph() const
+    {
+        const FileHeader &h = header();
+        const char *at = base + sizeof(FileHeader);
+        Graph g;
+        g.scenes = reinterpret_cast<const SceneEntry *>(at);
+        at += h.nScenes * sizeof(SceneEntry);
+        g.blocks = reinterpret_cast<const BlockEntry *>(at);
+        at += h.nBlocks * sizeof(BlockEntry);
+        g.choices = reinterpret_cast<const ChoiceEntry *>(at);
+        at += h.nChoices * sizeof(ChoiceEntry);
+        g.initial = reinterpret_cast<const std::int32_t *>(at);
+        at += h.nVariables * sizeof(std::int32_t);
+        g.pool = at;
+        at += h.poolSize;
+        g.code = reinterpret_cast<const std::uint8_t *>(at);
+        g.nScenes = h.nScenes;
+        g.nBlocks = h.nBlocks;
+        g.nChoices = h.nChoices;
+        g.poolSize = h.poolSize;
+        g.start = h.start;
+        g.nVariables = h.nVariables;
+        g.codeSize = h.codeSize;
+        return g;
+    }
+
+    void play() const
+    {
+        graph().play();
+    }
+};
+
+} // namespace SStory;
+
+#endif // SBinary_h
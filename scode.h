@@ -0,0 +1,563 @@
+/* scode.h
+ * Story variables: conditions and assignments compiled to bytecode.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * Expressions use integer variables and C operators:
+ *
+ *   condition:   has_key && gold >= 10 || !met_hunter
+ *   assignments: gold -= 10; has_key = 1
+ *
+ * true and false are 1 and 0. Every variable starts at its initial value, 0 if
+ * never declared. Division by zero gives 0 and overflow wraps around.
+ *
+ * A CodeBuilder compiles them once into one byte array shared by the whole
+ * story, an expression is an offset into it. run() evaluates an expression
+ * on a small fixed stack over the flat array of variables of a Session.
+ */
+
+#ifndef SCode_h
+#define SCode_h
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace SStory
+{
+
+//! Offset of a missing expression: a block or choice shown always, a choice without assignments.
+constexpr std::uint32_t NO_CODE = 0xFFFFFFFF;
+//! Values an expression may keep on the stack at once.
+constexpr int CODE_STACK = 16;
+//! Variables a story may have, their index takes two bytes.
+constexpr std::uint32_t MAX_VARIABLES = 65536;
+
+enum class Op : std::uint8_t
+{
+    end,    // Result is the top of the stack, if any.
+    push8,  // 1 byte signed immediate.
+    push32, // 4 bytes immediate.
+    load,   // 2 bytes variable index.
+    store,  // 2 bytes variable index, pops.
+    add,
+    sub,
+    mul,
+    div,
+    mod,
+    neg,
+    lnot,
+    eq,
+    ne,
+    lt,
+    le,
+    gt,
+    ge,
+    land,
+    lor,
+    test // 2 bytes variable, 1 byte comparison (eq to ge), 4 bytes immediate: the usual condition in one step.
+};
+
+constexpr int OP_COUNT = static_cast<int>(Op::test) + 1;
+
+namespace detail
+{
+
+inline std::uint16_t code16(const std::uint8_t *at)
+{
+    return static_cast<std::uint16_t>(at[0] | (at[1] << 8));
+}
+
+inline std::int32_t code32(const std::uint8_t *at)
+{
+    return static_cast<std::int32_t>(at[0] | (at[1] << 8) | (at[2] << 16) | (static_cast<std::uint32_t>(at[3]) << 24));
+}
+
+//! Bytes of the operand following the operation.
+inline int operand(Op op)
+{
+    return op == Op::push8 ? 1 : op == Op::push32 ? 4 : op == Op::load || op == Op::store ? 2 : op == Op::test ? 7 : 0;
+}
+
+inline std::uint32_t compare(Op relation, std::int32_t a, std::int32_t b)
+{
+    switch (relation)
+    {
+    case Op::eq: return a == b;
+    case Op::ne: return a != b;
+    case Op::lt: return a < b;
+    case Op::le: return a <= b;
+    case Op::gt: return a > b;
+    default: return a >= b;
+    }
+}
+
+} // namespace detail
+
+//! Evaluates the expression at code + at, reading vars. Assignments store into writes,
+//! which may be vars itself, and are skipped when it is null. Returns the value of a
+//! condition, 0 for assignments.
+inline std::int32_t run(const std::uint8_t *code, std::uint32_t at, const std::int32_t *vars, std::int32_t *writes = nullptr)
+{
+    // The top of the stack lives in a register, stack[0] is a dummy slot under the first value.
+    // Unsigned arithmetic, so overflow wraps instead of being undefined.
+    std::uint32_t stack[CODE_STACK];
+    std::uint32_t top = 0;
+    int depth = 0;
+    const std::uint8_t *pc = code + at;
+    while (true)
+    {
+        const Op op = static_cast<Op>(*pc++);
+        switch (op)
+        {
+        case Op::end:
+            return depth > 0 ? static_cast<std::int32_t>(top) : 0;
+        case Op::push8:
+            stack[depth++] = top;
+            top = static_cast<std::uint32_t>(static_cast<std::int32_t>(static_cast<std::int8_t>(*pc++)));
+            break;
+        case Op::push32:
+            stack[depth++] = top;
+            top = static_cast<std::uint32_t>(detail::code32(pc));
+            pc += 4;
+            break;
+        case Op::load:
+            stack[depth++] = top;
+            top = static_cast<std::uint32_t>(vars[detail::code16(pc)]);
+            pc += 2;
+            break;
+        case Op::store:
+            if (writes)
+                writes[detail::code16(pc)] = static_cast<std::int32_t>(top);
+            top = stack[--depth];
+            pc += 2;
+            break;
+        case Op::test:
+            stack[depth++] = top;
+            top = detail::compare(static_cast<Op>(pc[2]), vars[detail::code16(pc)], detail::code32(pc + 3));
+            pc += 7;
+            break;
+        case Op::neg:
+            top = 0u - top;
+            break;
+        case Op::lnot:
+            top = top == 0;
+            break;
+        default:
+        {
+            const std::uint32_t a = stack[--depth];
+            const std::uint32_t b = top;
+            const std::int32_t sa = static_cast<std::int32_t>(a);
+            const std::int32_t sb = static_cast<std::int32_t>(b);
+            switch (op)
+            {
+            case Op::add: top = a + b; break;
+            case Op::sub: top = a - b; break;
+            case Op::mul: top = a * b; break;
+            // x / -1 is -x, which wraps for INT_MIN instead of trapping.
+            case Op::div: top = sb == 0 ? 0 : sb == -1 ? 0u - a : static_cast<std::uint32_t>(sa / sb); break;
+            case Op::mod: top = sb == 0 || sb == -1 ? 0 : static_cast<std::uint32_t>(sa % sb); break;
+            case Op::eq:
+            case Op::ne:
+            case Op::lt:
+            case Op::le:
+            case Op::gt:
+            case Op::ge: top = detail::compare(op, sa, sb); break;
+            case Op::land: top = a != 0 && b != 0; break;
+            case Op::lor: top = a != 0 || b != 0; break;
+            default: break;
+            }
+        }
+        }
+    }
+}
+
+//! Whether the expression at code + at runs within bounds: known operations, operands
+//! inside the code, variables below nVariables and a stack that never overflows.
+//! Meant for code read from untrusted files, CodeBuilder only writes valid code.
+inline bool validCode(const std::uint8_t *code, std::uint32_t size, std::uint32_t at, std::uint32_t nVariables)
+{
+    int depth = 0;
+    while (at < size)
+    {
+        const int raw = code[at++];
+        if (raw >= OP_COUNT)
+            return false;
+        const Op op = static_cast<Op>(raw);
+        const int bytes = detail::operand(op);
+        if (size - at < static_cast<std::uint32_t>(bytes))
+            return false;
+        if ((op == Op::load || op == Op::store || op == Op::test) && detail::code16(code + at) >= nVariables)
+            return false;
+        if (op == Op::test && (code[at + 2] < static_cast<int>(Op::eq) || code[at + 2] > static_cast<int>(Op::ge)))
+            return false;
+        at += bytes;
+        if (op == Op::end)
+            return true;
+        if (op == Op::push8 || op == Op::push32 || op == Op::load || op == Op::test)
+        {
+            if (++depth > CODE_STACK)
+                return false;
+        }
+        else if (op == Op::store)
+        {
+            if (--depth < 0)
+                return false;
+        }
+        else if (op == Op::neg || op == Op::lnot)
+        {
+            if (depth < 1)
+                return false;
+        }
+        else if (--depth < 1) // Takes two values, leaves one.
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+class CodeBuilder
+{
+    //! Compiles the expressions of a story into one shared byte array and names its variables.
+    //! Variables are declared by their first use, or with variable() to give an initial value.
+  public:
+    std::vector<std::uint8_t> code;
+    std::vector<std::string> names;   // By index.
+    std::vector<std::int32_t> initial; // By index.
+
+  private:
+    typedef bool (CodeBuilder::*Level)();
+
+    std::unordered_map<std::string, std::uint32_t> ids;
+    const char *at = nullptr; // Next character to parse.
+    std::size_t start = 0;    // Offset of the expression being compiled.
+    std::string failure;
+    int depth = 0;
+    int deepest = 0;
+    int nesting = 0;          // Parentheses and unary operators being parsed.
+    std::size_t last = 0;     // Offset of the last operation emitted.
+    std::size_t previous = 0; // Offset of the one before.
+    std::size_t declared = 0; // Variables there were before the expression being compiled.
+
+    //! Rewrites "load, push, comparison" as a single test.
+    bool fuse(Op op)
+    {
+        if (op < Op::eq || op > Op::ge || previous >= last || previous < start ||
+            code[previous] != static_cast<std::uint8_t>(Op::load) ||
+            (code[last] != static_cast<std::uint8_t>(Op::push8) && code[last] != static_cast<std::uint8_t>(Op::push32)))
+            return false;
+        const std::uint8_t variable[2] = {code[previous + 1], code[previous + 2]};
+        const std::int32_t value = code[last] == static_cast<std::uint8_t>(Op::push8)
+                                       ? static_cast<std::int8_t>(code[last + 1])
+                                       : detail::code32(&code[last + 1]);
+        code.resize(previous);
+        code.push_back(static_cast<std::uint8_t>(Op::test));
+        code.push_back(variable[0]);
+        code.push_back(variable[1]);
+        code.push_back(static_cast<std::uint8_t>(op));
+        for (int i = 0; i < 4; ++i)
+        {
+            code.push_back(static_cast<std::uint8_t>((static_cast<std::uint32_t>(value) >> (8 * i)) & 0xFF));
+        }
+        depth -= 1;
+        last = previous;
+        return true;
+    }
+
+    void emit(Op op)
+    {
+        if (fuse(op))
+            return;
+        previous = last;
+        last = code.size();
+        code.push_back(static_cast<std::uint8_t>(op));
+        if (op == Op::push8 || op == Op::push32 || op == Op::load)
+            deepest = std::max(deepest, ++depth);
+        else if (op != Op::neg && op != Op::lnot && op != Op::end)
+            --depth;
+    }
+
+    void emit16(Op op, std::uint32_t v)
+    {
+        emit(op);
+        code.push_back(static_cast<std::uint8_t>(v & 0xFF));
+        code.push_back(static_cast<std::uint8_t>(v >> 8));
+    }
+
+    void number(std::int32_t v)
+    {
+        if (v >= -128 && v <= 127)
+        {
+            emit(Op::push8);
+            code.push_back(static_cast<std::uint8_t>(static_cast<std::int8_t>(v)));
+            return;
+        }
+        emit(Op::push32);
+        const std::uint32_t u = static_cast<std::uint32_t>(v);
+        for (int i = 0; i < 4; ++i)
+        {
+            code.push_back(static_cast<std::uint8_t>((u >> (8 * i)) & 0xFF));
+        }
+    }
+
+    bool fail(const std::string &message)
+    {
+        if (failure.empty())
+            failure = message;
+        return false;
+    }
+
+    void spaces()
+    {
+        while (*at == ' ' || *at == '\t')
+            ++at;
+    }
+
+    //! Consumes the token if it comes next.
+    bool accept(const char *token)
+    {
+        spaces();
+        const std::size_t n = std::strlen(token);
+        if (std::strncmp(at, token, n) != 0)
+            return false;
+        at += n;
+        return true;
+    }
+
+    bool name(std::string &out)
+    {
+        spaces();
+        if (!std::isalpha(static_cast<unsigned char>(*at)) && *at != '_')
+            return false;
+        const char *first = at;
+        while (std::isalnum(static_cast<unsigned char>(*at)) || *at == '_')
+            ++at;
+        out.assign(first, at);
+        return true;
+    }
+
+    //! A decimal number, with its minus sign if any, so that -2147483648 fits.
+    bool literal()
+    {
+        char *end = nullptr;
+        const long long v = std::strtoll(at, &end, 10);
+        if (v > 0x7FFFFFFFll || v < -0x80000000ll)
+            return fail("number too large");
+        at = end;
+        number(static_cast<std::int32_t>(v));
+        return true;
+    }
+
+    bool primary()
+    {
+        spaces();
+        if (accept("("))
+        {
+            if (++nesting > 64)
+                return fail("expression too deep");
+            const bool ok = expression() && (accept(")") || fail("missing )"));
+            --nesting;
+            return ok;
+        }
+        if (std::isdigit(static_cast<unsigned char>(*at)))
+            return literal();
+        std::string word;
+        if (!name(word))
+            return fail(*at ? std::string("unexpected '") + *at + "'" : "unexpected end");
+        if (word == "true" || word == "false")
+            number(word == "true");
+        else
+            emit16(Op::load, variable(word));
+        return true;
+    }
+
+    bool unary()
+    {
+        spaces();
+        if (*at == '-' && std::isdigit(static_cast<unsigned char>(at[1])))
+            return literal();
+        const Op op = accept("!") ? Op::lnot : accept("-") ? Op::neg : Op::end;
+        if (op == Op::end)
+            return primary();
+        if (++nesting > 64)
+            return fail("expression too deep");
+        const bool ok = unary();
+        --nesting;
+        if (ok)
+            emit(op);
+        return ok;
+    }
+
+    //! One level of left associative binary operators, tokens[i] compiles to ops[i].
+    bool binary(Level next, const char *const *tokens, const Op *ops, int count)
+    {
+        if (!(this->*next)())
+            return false;
+        while (true)
+        {
+            int i = 0;
+            while (i < count && !accept(tokens[i]))
+                ++i;
+            if (i == count)
+                return true;
+            if (!(this->*next)())
+                return false;
+            emit(ops[i]);
+        }
+    }
+
+    bool product()
+    {
+        static const char *const tokens[] = {"*", "/", "%"};
+        static const Op ops[] = {Op::mul, Op::div, Op::mod};
+        return binary(&CodeBuilder::unary, tokens, ops, 3);
+    }
+
+    bool sum()
+    {
+        static const char *const tokens[] = {"+", "-"};
+        static const Op ops[] = {Op::add, Op::sub};
+        return binary(&CodeBuilder::product, tokens, ops, 2);
+    }
+
+    bool comparison()
+    {
+        static const char *const tokens[] = {"==", "!=", "<=", ">=", "<", ">"};
+        static const Op ops[] = {Op::eq, Op::ne, Op::le, Op::ge, Op::lt, Op::gt};
+        return binary(&CodeBuilder::sum, tokens, ops, 6);
+    }
+
+    bool conjunction()
+    {
+        static const char *const tokens[] = {"&&"};
+        static const Op ops[] = {Op::land};
+        return binary(&CodeBuilder::comparison, tokens, ops, 1);
+    }
+
+    bool expression()
+    {
+        static const char *const tokens[] = {"||"};
+        static const Op ops[] = {Op::lor};
+        return binary(&CodeBuilder::conjunction, tokens, ops, 1);
+    }
+
+    bool assignment()
+    {
+        std::string target;
+        if (!name(target))
+            return fail("expected a variable");
+        const std::uint32_t id = variable(target);
+        Op op = Op::end;
+        if (accept("+="))
+            op = Op::add;
+        else if (accept("-="))
+            op = Op::sub;
+        else if (!accept("="))
+            return fail("expected =, += or -= after " + target);
+        if (op != Op::end)
+            emit16(Op::load, id);
+        if (!expression())
+            return false;
+        if (op != Op::end)
+            emit(op);
+        emit16(Op::store, id);
+        return true;
+    }
+
+    void reset(const std::string &text)
+    {
+        failure.clear();
+        at = text.c_str();
+        start = code.size();
+        last = start;
+        previous = start;
+        nesting = 0;
+        depth = 0;
+        deepest = 0;
+        declared = names.size();
+    }
+
+    //! Offset of the expression just parsed, or NO_CODE after dropping it if it does not compile.
+    std::uint32_t finish(bool ok)
+    {
+        spaces();
+        if (ok && *at != '\0')
+            ok = fail(std::string("unexpected '") + *at + "'");
+        if (ok && deepest > CODE_STACK)
+            ok = fail("expression too deep");
+        if (ok && names.size() > MAX_VARIABLES)
+            ok = fail("too many variables");
+        if (!ok)
+        {
+            // Variables first named by the dropped expression go with it.
+            for (std::size_t i = declared; i < names.size(); ++i)
+            {
+                ids.erase(names[i]);
+            }
+            names.resize(declared);
+            initial.resize(declared);
+            code.resize(start);
+            return NO_CODE;
+        }
+        emit(Op::end);
+        return static_cast<std::uint32_t>(start);
+    }
+
+  public:
+    //! Index of the variable, declared with initial value 0 the first time.
+    std::uint32_t variable(const std::string &label)
+    {
+        const auto found = ids.find(label);
+        if (found != ids.end())
+            return found->second;
+        const std::uint32_t id = static_cast<std::uint32_t>(names.size());
+        ids.emplace(label, id);
+        names.push_back(label);
+        initial.push_back(0);
+        return id;
+    }
+
+    void variable(const std::string &label, std::int32_t value)
+    {
+        initial[variable(label)] = value;
+    }
+
+    //! Offset of the compiled condition, NO_CODE and error() set if it is not valid.
+    std::uint32_t condition(const std::string &text)
+    {
+        reset(text);
+        return finish(expression());
+    }
+
+    //! Offset of the compiled assignments, separated by ;
+    std::uint32_t assignments(const std::string &text)
+    {
+        reset(text);
+        bool ok = assignment();
+        while (ok && accept(";"))
+        {
+            spaces();
+            if (*at == '\0')
+                break;
+            ok = assignment();
+        }
+        return finish(ok);
+    }
+
+    //! Why the last expression did not compile.
+    const std::string &error() const
+    {
+        return failure;
+    }
+};
+
+} // namespace SStory;
+
+#endif // SCode_h
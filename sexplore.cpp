@@ -0,0 +1,39 @@
+/* sexplore.cpp
+ * Plays a story at random millions of times and tells how likely each ending is.
+ * Without a file it explores the sample adventure of main.cpp.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ */
+
+#include <cstdlib>
+
+#include "example.h"
+#include "sexplore.h"
+#include "sscript.h"
+
+int main(int argc, char *argv[])
+{
+    SStory::ExploreOptions options;
+    if (argc > 2)
+        options.walks = static_cast<std::uint64_t>(std::atoll(argv[2]));
+    if (argc > 3)
+        options.threads = static_cast<unsigned>(std::atoi(argv[3]));
+
+    SStory::StoryFile file;
+    SStory::Graph graph;
+    if (argc > 1 && std::string(argv[1]) != "-")
+    {
+        if (!file.open(argv[1]))
+            return 1;
+        graph = file.graph();
+    }
+    else
+    {
+        graph = Example::graph();
+    }
+
+    const SStory::Exploration result = SStory::Exploration::run(graph, options);
+    result.report(graph, std::cout);
+    return 0;
+}
@@ -0,0 +1,218 @@
+/* sexplore.h
+ * Monte Carlo playthroughs over a compiled story graph.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ */
+
+#ifndef SExplore_h
+#define SExplore_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "sanalysis.h"
+#include "sbench.h"
+#include "sstory.h"
+
+namespace SStory
+{
+
+struct ExploreOptions
+{
+    std::uint64_t walks = 1000000;
+    std::uint32_t maxLength = 10000; // Choices before a walker counts as trapped.
+    unsigned threads = std::thread::hardware_concurrency();
+    std::uint64_t seed = 1;
+    //! Weight of every choice of the graph, empty for uniform walks.
+    std::vector<float> weights;
+};
+
+class Exploration
+{
+    //! What random players run into: where they end, how long it takes, where they get stuck.
+  public:
+    std::vector<std::uint64_t> endings; // Walks finished at each scene.
+    std::vector<std::uint64_t> visits;  // Times each scene was entered.
+    std::vector<std::uint64_t> trapped; // Walks cut off at each scene.
+    std::uint64_t walks = 0;
+    std::uint64_t finished = 0;
+    std::uint64_t length = 0; // Sum of choices of the finished walks.
+
+    //! Walks are handed out in chunks from a shared counter, a thread done with its
+    //! chunk takes the next one, so slow walks never leave cores idle. Every chunk
+    //! has its own RNG stream: the result does not depend on the number of threads.
+    static Exploration run(const Graph &g, const ExploreOptions &options)
+    {
+        const std::uint64_t chunk = 4096;
+        const std::uint64_t nChunks = (options.walks + chunk - 1) / chunk;
+        const unsigned threads = std::max(1u, options.threads);
+        std::atomic<std::uint64_t> nextChunk(0);
+        std::vector<Exploration> partial(threads);
+
+        auto worker = [&](Exploration &out) {
+            out.resize(g.nScenes);
+            for (std::uint64_t c = nextChunk++; c < nChunks; c = nextChunk++)
+            {
+                Rng rng(options.seed * 0x9E3779B97F4A7C15ull + c + 1);
+                const std::uint64_t end = std::min(options.walks, (c + 1) * chunk);
+                for (std::uint64_t w = c * chunk; w < end; ++w)
+                {
+                    out.walk(g, options, rng);
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; ++t)
+        {
+            pool.emplace_back(worker, std::ref(partial[t]));
+        }
+        worker(partial[0]);
+        for (auto &thread : pool)
+        {
+            thread.join();
+        }
+
+        Exploration total = std::move(partial[0]);
+        for (unsigned t = 1; t < threads; ++t)
+        {
+            total.merge(partial[t]);
+        }
+        return total;
+    }
+
+    void report(const Graph &g, std::ostream &out, std::size_t top = 10) const
+    {
+        out << "Walks: " << walks << ", finished: " << finished << ", average length: "
+            << (finished ? double(length) / finished : 0.0) << '\n';
+
+        out << "Endings:\n";
+        for (const SceneId id : ranked(endings, endings.size()))
+        {
+            out << "  " << g.str(g.scenes[id].label) << ' ' << 100.0 * endings[id] / walks << "%\n";
+        }
+
+        out << "Hot scenes:\n";
+        for (const SceneId id : ranked(visits, top))
+        {
+            out << "  " << g.str(g.scenes[id].label) << ' ' << visits[id] << '\n';
+        }
+
+        // Walkers cut off anywhere in the same loop are counted together.
+        std::uint32_t nComponents = 0;
+        const std::vector<std::uint32_t> component = components(Adjacency::forward(g), nComponents);
+        std::vector<std::uint64_t> perLoop(nComponents, 0);
+        std::vector<SceneId> sample(nComponents, END_SCENE);
+        for (SceneId id = 0; id < g.nScenes; ++id)
+        {
+            perLoop[component[id]] += trapped[id];
+            if (trapped[id] > 0 && sample[component[id]] == END_SCENE)
+                sample[component[id]] = id;
+        }
+        out << "Traps:\n";
+        for (const std::uint32_t c : ranked(perLoop, top))
+        {
+            out << "  loop with " << g.str(g.scenes[sample[c]].label) << ' ' << 100.0 * perLoop[c] / walks << "%\n";
+        }
+    }
+
+  private:
+    void resize(std::uint32_t scenes)
+    {
+        endings.assign(scenes, 0);
+        visits.assign(scenes, 0);
+        trapped.assign(scenes, 0);
+    }
+
+    void walk(const Graph &g, const ExploreOptions &options, Rng &rng)
+    {
+        ++walks;
+        SceneId scene = g.start;
+        for (std::uint32_t steps = 0; scene != END_SCENE; ++steps)
+        {
+            ++visits[scene];
+            std::uint32_t count = 0;
+            const ChoiceEntry *exits = g.exits(scene, count);
+            if (count == 0)
+            {
+                ++endings[scene];
+                ++finished;
+                length += steps;
+                return;
+            }
+            if (steps == options.maxLength)
+            {
+                ++trapped[scene];
+                return;
+            }
+
+            const ChoiceEntry &choice = exits[pick(exits - g.choices, count, options.weights, rng)];
+            if (choice.target == END_SCENE)
+            {
+                ++endings[scene];
+                ++finished;
+                length += steps + 1;
+                return;
+            }
+            scene = choice.target;
+        }
+    }
+
+    static std::uint32_t pick(std::ptrdiff_t first, std::uint32_t count, const std::vector<float> &weights, Rng &rng)
+    {
+        if (weights.empty())
+            return rng.below(count);
+        float total = 0.0f;
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            total += weights[first + i];
+        }
+        float at = total * static_cast<float>(rng.next() >> 40) / static_cast<float>(1 << 24);
+        for (std::uint32_t i = 0; i + 1 < count; ++i)
+        {
+            at -= weights[first + i];
+            if (at < 0.0f)
+                return i;
+        }
+        return count - 1;
+    }
+
+    void merge(const Exploration &other)
+    {
+        for (std::size_t i = 0; i < endings.size(); ++i)
+        {
+            endings[i] += other.endings[i];
+            visits[i] += other.visits[i];
+            trapped[i] += other.trapped[i];
+        }
+        walks += other.walks;
+        finished += other.finished;
+        length += other.length;
+    }
+
+    //! Indices of the largest non zero counts, largest first.
+    static std::vector<std::uint32_t> ranked(const std::vector<std::uint64_t> &counts, std::size_t top)
+    {
+        std::vector<std::uint32_t> ids;
+        for (std::uint32_t i = 0; i < counts.size(); ++i)
+        {
+            if (counts[i] > 0)
+                ids.push_back(i);
+        }
+        auto larger = [&counts](std::uint32_t a, std::uint32_t b) { return counts[a] > counts[b]; };
+        top = std::min(top, ids.size());
+        std::partial_sort(ids.begin(), ids.begin() + top, ids.end(), larger);
+        ids.resize(top);
+        return ids;
+    }
+};
+
+} // namespace SStory;
+
+#endif // SExplore_h
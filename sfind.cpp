@@ -0,0 +1,165 @@
+/* sfind.cpp
+ * Finds where a story mentions a word, plays a sample or goes to a scene.
+ * Without a file it searches the sample adventure of main.cpp.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ *   sfind story.txt|story.ssb|- [query ...]
+ *
+ * A query is a word, a "quoted phrase", a prefix*, sound:SAMPLE or to:LABEL
+ * (to:END for the choices and scenes finishing the story). Without queries
+ * they are read from the standard input, one per line, against the same index.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+
+#include "example.h"
+#include "sindex.h"
+#include "sscript.h"
+
+//! Bytes of text printed around each match.
+static const std::size_t CONTEXT = 40;
+
+static const char *kindName(SStory::FieldKind kind)
+{
+    switch (kind)
+    {
+    case SStory::FieldKind::body:
+        return "text";
+    case SStory::FieldKind::display:
+        return "choice";
+    default:
+        return "complement";
+    }
+}
+
+//! Moves back to the start of a UTF-8 character.
+static std::size_t boundary(const std::string &text, std::size_t at)
+{
+    while (at > 0 && at < text.size() && (static_cast<unsigned char>(text[at]) & 0xC0) == 0x80)
+    {
+        --at;
+    }
+    return at;
+}
+
+static void print(const SStory::StoryIndex &index, const SStory::Graph &graph, std::uint32_t id,
+                  std::pair<std::size_t, std::size_t> match)
+{
+    const SStory::Field &field = index.field(id);
+    std::string text = index.text(id);
+    std::replace(text.begin(), text.end(), '\n', ' ');
+    std::size_t from = 0, to = text.size();
+    if (match.second > match.first)
+    {
+        from = boundary(text, match.first > CONTEXT ? match.first - CONTEXT : 0);
+        to = boundary(text, std::min(text.size(), match.second + CONTEXT));
+    }
+    else if (to > 2 * CONTEXT)
+    {
+        to = boundary(text, 2 * CONTEXT);
+    }
+    std::cout << graph.str(graph.scenes[field.scene].label) << ':' << field.block - graph.scenes[field.scene].firstBlock
+              << ' ' << kindName(field.kind) << ": " << (from > 0 ? "..." : "") << text.substr(from, to - from)
+              << (to < text.size() ? "..." : "") << '\n';
+}
+
+static void query(const SStory::StoryIndex &index, const SStory::Graph &graph, const std::string &q)
+{
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<SStory::Posting> found;
+    std::vector<std::uint32_t> fields;
+    bool known = true;
+    if (q.compare(0, 6, "sound:") == 0)
+    {
+        SSound::Sample sample;
+        known = SSound::parse(q.substr(6), sample);
+        if (known)
+            fields = index.playing(sample);
+    }
+    else if (q.compare(0, 3, "to:") == 0)
+    {
+        const std::string label = q.substr(3);
+        const SStory::SceneId target = index.scene(label);
+        known = label == "END" || target != SStory::END_SCENE;
+        if (known)
+            fields = index.linksTo(target);
+    }
+    else if (!q.empty() && q.back() == '*')
+    {
+        found = index.prefix(q.substr(0, q.size() - 1));
+    }
+    else
+    {
+        found = index.phrase(q);
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    if (!known)
+    {
+        std::cerr << "Unknown sample or label in " << q << '\n';
+        return;
+    }
+    // A phrase is shown from its first word to its last.
+    const std::size_t words = SStory::tokenize(q).size();
+    std::set<SStory::SceneId> scenes;
+    for (const auto &p : found)
+    {
+        std::pair<std::size_t, std::size_t> match = index.locate(p);
+        if (words > 1)
+            match.second = index.locate(SStory::Posting{p.field, static_cast<std::uint32_t>(p.position + words - 1)}).second;
+        print(index, graph, p.field, match);
+        scenes.insert(index.field(p.field).scene);
+    }
+    for (const std::uint32_t id : fields)
+    {
+        print(index, graph, id, std::make_pair(std::size_t(0), std::size_t(0)));
+        scenes.insert(index.field(id).scene);
+    }
+    char line[128];
+    std::snprintf(line, sizeof(line), "%zu matches in %zu scenes, %.1f us\n", found.size() + fields.size(),
+                  scenes.size(), elapsed.count() / 1000.0);
+    std::cout << line;
+}
+
+int main(int argc, char *argv[])
+{
+    SStory::StoryFile file;
+    SStory::Graph graph;
+    if (argc > 1 && std::string(argv[1]) != "-")
+    {
+        if (!file.open(argv[1]))
+            return 1;
+        graph = file.graph();
+    }
+    else
+    {
+        graph = Example::graph();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const SStory::StoryIndex index = SStory::StoryIndex::build(graph);
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cerr << index.postingCount() << " words, " << index.wordCount() << " distinct, in " << index.fieldCount()
+              << " texts indexed in " << elapsed.count() << " ms, " << index.bytes() / 1024 << " KiB\n";
+
+    if (argc > 2)
+    {
+        for (int i = 2; i < argc; ++i)
+        {
+            query(index, graph, argv[i]);
+        }
+        return 0;
+    }
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        if (!line.empty())
+            query(index, graph, line);
+    }
+    return 0;
+}
@@ -0,0 +1,694 @@
+/* sindex.h
+ * Full-text, sound and link index over a compiled story, for authoring tools.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * Every block body, choice display text and complement is a field, split in
+ * words by tokenize(): lowercase, and without the diacritics of Latin letters,
+ * so "Cuál" finds "cual". A word maps to the sorted list of its postings, the
+ * field and the position of every place it appears, which answers words,
+ * phrases and prefixes with binary searches. Samples map to the bodies playing
+ * them and scenes to the choices going to them.
+ */
+
+#ifndef SIndex_h
+#define SIndex_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "sstory.h"
+
+namespace SStory
+{
+
+//! Choice of the fields that are block bodies.
+constexpr std::uint32_t NO_CHOICE = 0xFFFFFFFF;
+//! Id of a word no text has.
+constexpr std::uint32_t NO_WORD = 0xFFFFFFFF;
+
+namespace detail
+{
+
+struct FoldRun
+{
+    //! Code points up to last, from the end of the previous run, fold to ascii.
+    std::uint16_t last;
+    const char *ascii;
+};
+
+//! Latin-1 and Latin Extended-A letters and their base letters, "" separates words.
+static const FoldRun FOLDS[] = {
+    {0x00C5, "a"},  {0x00C6, "ae"}, {0x00C7, "c"},  {0x00CB, "e"},  {0x00CF, "i"},  {0x00D0, "d"},
+    {0x00D1, "n"},  {0x00D6, "o"},  {0x00D7, ""},   {0x00D8, "o"},  {0x00DC, "u"},  {0x00DD, "y"},
+    {0x00DE, "th"}, {0x00DF, "ss"}, {0x00E5, "a"},  {0x00E6, "ae"}, {0x00E7, "c"},  {0x00EB, "e"},
+    {0x00EF, "i"},  {0x00F0, "d"},  {0x00F1, "n"},  {0x00F6, "o"},  {0x00F7, ""},   {0x00F8, "o"},
+    {0x00FC, "u"},  {0x00FD, "y"},  {0x00FE, "th"}, {0x00FF, "y"},  {0x0105, "a"},  {0x010D, "c"},
+    {0x0111, "d"},  {0x011B, "e"},  {0x0123, "g"},  {0x0127, "h"},  {0x0131, "i"},  {0x0133, "ij"},
+    {0x0135, "j"},  {0x0138, "k"},  {0x0142, "l"},  {0x014B, "n"},  {0x0151, "o"},  {0x0153, "oe"},
+    {0x0159, "r"},  {0x0161, "s"},  {0x0167, "t"},  {0x0173, "u"},  {0x0175, "w"},  {0x0178, "y"},
+    {0x017E, "z"},  {0x017F, "s"}};
+
+inline const char *fold(std::uint32_t codePoint)
+{
+    const FoldRun *run = std::lower_bound(std::begin(FOLDS), std::end(FOLDS), codePoint,
+                                          [](const FoldRun &r, std::uint32_t c) { return r.last < c; });
+    return run->ascii;
+}
+
+inline bool isWordAscii(unsigned char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+//! Punctuation and spaces outside ASCII: Latin-1 symbols, general punctuation, CJK punctuation, BOM.
+inline bool separates(std::uint32_t codePoint)
+{
+    return codePoint < 0xC0 || (codePoint >= 0x2000 && codePoint <= 0x206F) ||
+           (codePoint >= 0x3000 && codePoint <= 0x303F) || codePoint == 0xFEFF;
+}
+
+} // namespace detail
+
+//! Calls emit(word, begin, end) for every word of the UTF-8 text, with the bytes it came from.
+//! Words are runs of letters and digits, lowercase and without diacritics on Latin letters.
+//! Other scripts are kept as written, invalid bytes separate words.
+template <typename F>
+void tokenize(const char *data, std::size_t size, std::string &word, F emit)
+{
+    word.clear();
+    std::size_t begin = 0;
+    auto separate = [&](std::size_t at) {
+        if (!word.empty())
+            emit(word, begin, at);
+        word.clear();
+    };
+    auto append = [&](std::size_t at, const char *s, std::size_t n) {
+        if (word.empty())
+            begin = at;
+        word.append(s, n);
+    };
+
+    std::size_t i = 0;
+    while (i < size)
+    {
+        const unsigned char c = static_cast<unsigned char>(data[i]);
+        if (c < 0x80)
+        {
+            if (!detail::isWordAscii(c))
+            {
+                separate(i);
+                ++i;
+                continue;
+            }
+            if (word.empty())
+                begin = i;
+            // Most of the text is ASCII, taken a run at a time.
+            for (; i < size && detail::isWordAscii(static_cast<unsigned char>(data[i])); ++i)
+            {
+                const char letter = data[i];
+                word.push_back(letter >= 'A' && letter <= 'Z' ? static_cast<char>(letter - 'A' + 'a') : letter);
+            }
+            continue;
+        }
+
+        std::size_t n = 0;
+        std::uint32_t codePoint = 0;
+        if (c >= 0xC2 && c < 0xE0)
+            n = 2, codePoint = c & 0x1F;
+        else if (c >= 0xE0 && c < 0xF0)
+            n = 3, codePoint = c & 0x0F;
+        else if (c >= 0xF0 && c < 0xF5)
+            n = 4, codePoint = c & 0x07;
+        for (std::size_t k = 1; k < n; ++k)
+        {
+            const unsigned char next = i + k < size ? static_cast<unsigned char>(data[i + k]) : 0;
+            if ((next & 0xC0) != 0x80)
+            {
+                n = 0;
+                break;
+            }
+            codePoint = codePoint << 6 | (next & 0x3F);
+        }
+        if (n == 0)
+        {
+            separate(i);
+            ++i;
+            continue;
+        }
+
+        if (codePoint >= 0x0300 && codePoint <= 0x036F)
+        {
+            // Combining diacritics, as in decomposed text, belong to the letter before.
+        }
+        else if (codePoint >= 0x00C0 && codePoint <= 0x017F)
+        {
+            const char *ascii = detail::fold(codePoint);
+            if (*ascii == '\0')
+                separate(i);
+            else
+                append(i, ascii, std::strlen(ascii));
+        }
+        else if (detail::separates(codePoint))
+            separate(i);
+        else
+            append(i, data + i, n);
+        i += n;
+    }
+    separate(size);
+}
+
+inline std::vector<std::string> tokenize(const std::string &text)
+{
+    std::vector<std::string> words;
+    std::string word;
+    tokenize(text.data(), text.size(), word,
+             [&words](const std::string &w, std::size_t, std::size_t) { words.push_back(w); });
+    return words;
+}
+
+enum class FieldKind : std::uint8_t
+{
+    body,
+    display,
+    complement
+};
+
+struct Field
+{
+    //! Text of the story in the index.
+    TextRef text;
+    SceneId scene;
+    std::uint32_t block;
+    std::uint32_t choice; // NO_CHOICE for a body.
+    FieldKind kind;
+};
+
+struct Posting
+{
+    //! A word at a place of the story.
+    std::uint32_t field;
+    std::uint32_t position; // Words before it in the field.
+
+    bool operator<(const Posting &other) const
+    {
+        return field < other.field || (field == other.field && position < other.position);
+    }
+};
+
+struct PostingRange
+{
+    //! Postings of one word, owned by the index.
+    const Posting *first = nullptr;
+    const Posting *last = nullptr;
+
+    const Posting *begin() const
+    {
+        return first;
+    }
+
+    const Posting *end() const
+    {
+        return last;
+    }
+
+    std::size_t size() const
+    {
+        return static_cast<std::size_t>(last - first);
+    }
+
+    bool empty() const
+    {
+        return first == last;
+    }
+};
+
+class StoryIndex
+{
+    //! Queries take microseconds, building takes a pass over the texts split between threads.
+  private:
+    Graph graph;
+    std::vector<Field> fields;
+    std::string lexicon;                       // Every word, sorted, back to back.
+    std::vector<std::uint32_t> lexiconOffsets; // nWords + 1
+    std::vector<std::uint32_t> postingOffsets; // nWords + 1
+    std::vector<Posting> postings;             // Of every word, by field then position.
+    std::vector<std::uint32_t> sampleOffsets;  // SAMPLE_COUNT + 1
+    std::vector<std::uint32_t> sampleFields;   // Bodies playing each sample.
+    std::vector<std::uint32_t> linkOffsets;    // nScenes + 2, END last.
+    std::vector<std::uint32_t> linkFields;     // Display texts of the choices going to each scene, see linksTo().
+    std::vector<SceneId> byLabel;
+
+    struct Part
+    {
+        //! Words of a run of fields, tokenized by one thread.
+        std::uint32_t firstField = 0;
+        std::uint32_t lastField = 0;
+        std::unordered_map<std::string, std::uint32_t> ids;
+        std::vector<const std::string *> words; // By local id.
+        std::vector<std::uint32_t> wordOf;      // Of every posting, local id then global id.
+        std::vector<Posting> found;
+        std::vector<std::uint32_t> next; // Where its next posting of every word goes.
+    };
+
+    std::uint32_t nWords() const
+    {
+        return static_cast<std::uint32_t>(lexiconOffsets.size() - 1);
+    }
+
+    int compareWord(std::uint32_t id, const std::string &word) const
+    {
+        return -word.compare(0, std::string::npos, lexicon.data() + lexiconOffsets[id],
+                             lexiconOffsets[id + 1] - lexiconOffsets[id]);
+    }
+
+    //! First word not before the given one.
+    std::uint32_t lowerWord(const std::string &word) const
+    {
+        std::uint32_t low = 0, high = nWords();
+        while (low < high)
+        {
+            const std::uint32_t middle = low + (high - low) / 2;
+            if (compareWord(middle, word) < 0)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low;
+    }
+
+    std::uint32_t wordId(const std::string &folded) const
+    {
+        const std::uint32_t id = lowerWord(folded);
+        return id < nWords() && compareWord(id, folded) == 0 ? id : NO_WORD;
+    }
+
+    //! First posting not before wanted, from at on: exponential steps, then a binary search.
+    static const Posting *gallop(const Posting *at, const Posting *end, const Posting &wanted)
+    {
+        if (at == end || !(*at < wanted))
+            return at;
+        std::size_t step = 1;
+        while (step < static_cast<std::size_t>(end - at) && at[step] < wanted)
+        {
+            at += step;
+            step *= 2;
+        }
+        return std::lower_bound(at + 1, at + std::min(step, static_cast<std::size_t>(end - at)), wanted);
+    }
+
+    PostingRange postingsOf(std::uint32_t id) const
+    {
+        PostingRange range;
+        if (id != NO_WORD)
+        {
+            range.first = postings.data() + postingOffsets[id];
+            range.last = postings.data() + postingOffsets[id + 1];
+        }
+        return range;
+    }
+
+    void addFields(const Graph &g)
+    {
+        for (SceneId id = 0; id < g.nScenes; ++id)
+        {
+            const SceneEntry &scene = g.scenes[id];
+            for (std::uint32_t b = scene.firstBlock; b < scene.firstBlock + scene.nBlocks; ++b)
+            {
+                const BlockEntry &block = g.blocks[b];
+                fields.push_back(Field{block.body, id, b, NO_CHOICE, FieldKind::body});
+                for (std::uint32_t c = block.firstChoice; c < block.firstChoice + block.nChoices; ++c)
+                {
+                    fields.push_back(Field{g.choices[c].displayText, id, b, c, FieldKind::display});
+                    if (g.choices[c].complement.offset != NO_TEXT && g.choices[c].complement.size > 0)
+                        fields.push_back(Field{g.choices[c].complement, id, b, c, FieldKind::complement});
+                }
+            }
+        }
+    }
+
+    void tokenizePart(Part &part) const
+    {
+        std::string word;
+        for (std::uint32_t f = part.firstField; f < part.lastField; ++f)
+        {
+            std::uint32_t position = 0;
+            tokenize(graph.data(fields[f].text), fields[f].text.size, word,
+                     [&](const std::string &w, std::size_t, std::size_t) {
+                         auto known = part.ids.find(w);
+                         if (known == part.ids.end())
+                         {
+                             known = part.ids.emplace(w, static_cast<std::uint32_t>(part.words.size())).first;
+                             part.words.push_back(&known->first);
+                         }
+                         part.wordOf.push_back(known->second);
+                         part.found.push_back(Posting{f, position++});
+                     });
+        }
+    }
+
+    //! Global ids of the words of the part, and how many postings it has of each.
+    void countPart(Part &part) const
+    {
+        std::vector<std::uint32_t> global(part.words.size());
+        for (std::size_t local = 0; local < part.words.size(); ++local)
+        {
+            global[local] = lowerWord(*part.words[local]);
+        }
+        part.next.assign(nWords(), 0);
+        for (std::uint32_t &id : part.wordOf)
+        {
+            id = global[id];
+            ++part.next[id];
+        }
+    }
+
+    //! Parts are in field order, so the postings of every word stay sorted.
+    void fillPart(Part &part)
+    {
+        for (std::size_t i = 0; i < part.found.size(); ++i)
+        {
+            postings[part.next[part.wordOf[i]]++] = part.found[i];
+        }
+    }
+
+    template <typename F>
+    static void parallel(std::vector<Part> &parts, F work)
+    {
+        std::vector<std::thread> workers;
+        for (std::size_t t = 1; t < parts.size(); ++t)
+        {
+            workers.emplace_back(work, std::ref(parts[t]));
+        }
+        work(parts[0]);
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void addWords(unsigned threads)
+    {
+        // Parts of about the same number of bytes.
+        std::uint64_t total = 0;
+        for (const Field &f : fields)
+        {
+            total += f.text.size;
+        }
+        std::vector<Part> parts(std::max(1u, threads));
+        std::uint64_t bytes = 0;
+        std::uint32_t f = 0;
+        for (std::size_t t = 0; t < parts.size(); ++t)
+        {
+            parts[t].firstField = f;
+            const std::uint64_t goal = total * (t + 1) / parts.size();
+            while (f < fields.size() && (bytes < goal || t + 1 == parts.size()))
+            {
+                bytes += fields[f++].text.size;
+            }
+            parts[t].lastField = f;
+        }
+        parallel(parts, [this](Part &part) { tokenizePart(part); });
+
+        std::vector<const std::string *> words;
+        for (const Part &part : parts)
+        {
+            words.insert(words.end(), part.words.begin(), part.words.end());
+        }
+        std::sort(words.begin(), words.end(), [](const std::string *a, const std::string *b) { return *a < *b; });
+        words.erase(std::unique(words.begin(), words.end(),
+                                [](const std::string *a, const std::string *b) { return *a == *b; }),
+                    words.end());
+        lexiconOffsets.assign(1, 0);
+        for (const std::string *word : words)
+        {
+            lexicon += *word;
+            lexiconOffsets.push_back(static_cast<std::uint32_t>(lexicon.size()));
+        }
+
+        parallel(parts, [this](Part &part) { countPart(part); });
+        postingOffsets.assign(nWords() + 1, 0);
+        std::uint32_t at = 0;
+        for (std::uint32_t id = 0; id < nWords(); ++id)
+        {
+            postingOffsets[id] = at;
+            for (Part &part : parts)
+            {
+                const std::uint32_t count = part.next[id];
+                part.next[id] = at;
+                at += count;
+            }
+        }
+        postingOffsets[nWords()] = at;
+        postings.resize(at);
+        parallel(parts, [this](Part &part) { fillPart(part); });
+    }
+
+    //! Counting sort of the fields by key, offsets get one row per key and one more.
+    template <typename Key>
+    void group(std::size_t keys, std::vector<std::uint32_t> &offsets, std::vector<std::uint32_t> &out, Key key)
+    {
+        offsets.assign(keys + 1, 0);
+        for (std::uint32_t f = 0; f < fields.size(); ++f)
+        {
+            const std::size_t k = key(fields[f]);
+            if (k < keys)
+                ++offsets[k + 1];
+        }
+        for (std::size_t k = 1; k <= keys; ++k)
+        {
+            offsets[k] += offsets[k - 1];
+        }
+        out.resize(offsets[keys]);
+        std::vector<std::uint32_t> next(offsets.begin(), offsets.end() - 1);
+        for (std::uint32_t f = 0; f < fields.size(); ++f)
+        {
+            const std::size_t k = key(fields[f]);
+            if (k < keys)
+                out[next[k]++] = f;
+        }
+    }
+
+  public:
+    //! Indexes every text, sample and choice of the story, which must outlive the index.
+    static StoryIndex build(const Graph &g, unsigned threads = std::thread::hardware_concurrency())
+    {
+        StoryIndex index;
+        index.graph = g;
+        index.addFields(g);
+        index.addWords(threads);
+
+        const std::size_t none = SSound::SAMPLE_COUNT;
+        index.group(SSound::SAMPLE_COUNT, index.sampleOffsets, index.sampleFields, [&g, none](const Field &f) {
+            const std::int16_t sample = g.blocks[f.block].sample;
+            return f.kind == FieldKind::body && sample >= 0 ? static_cast<std::size_t>(sample) : none;
+        });
+        // END goes last, in the row of scene nScenes.
+        const std::size_t scenes = g.nScenes;
+        index.group(scenes + 1, index.linkOffsets, index.linkFields, [&g, scenes](const Field &f) {
+            if (f.kind == FieldKind::body)
+            {
+                // Scenes without choices end the story after their last block.
+                const SceneEntry &scene = g.scenes[f.scene];
+                const bool last = f.block + 1 == scene.firstBlock + scene.nBlocks;
+                return last && g.blocks[f.block].nChoices == 0 ? scenes : scenes + 1;
+            }
+            if (f.kind != FieldKind::display)
+                return scenes + 1;
+            const SceneId target = g.choices[f.choice].target;
+            return target == END_SCENE ? scenes : static_cast<std::size_t>(target);
+        });
+
+        index.byLabel.resize(g.nScenes);
+        for (SceneId id = 0; id < g.nScenes; ++id)
+        {
+            index.byLabel[id] = id;
+        }
+        std::sort(index.byLabel.begin(), index.byLabel.end(), [&g](SceneId a, SceneId b) {
+            const TextRef la = g.scenes[a].label, lb = g.scenes[b].label;
+            return std::string(g.data(la), la.size) < std::string(g.data(lb), lb.size);
+        });
+        return index;
+    }
+
+    const Field &field(std::uint32_t id) const
+    {
+        return fields[id];
+    }
+
+    std::string text(std::uint32_t id) const
+    {
+        return graph.str(fields[id].text);
+    }
+
+    //! Bytes of the posting's word in the text of its field.
+    std::pair<std::size_t, std::size_t> locate(const Posting &p) const
+    {
+        std::pair<std::size_t, std::size_t> where(0, 0);
+        std::uint32_t position = 0;
+        std::string word;
+        tokenize(graph.data(fields[p.field].text), fields[p.field].text.size, word,
+                 [&](const std::string &, std::size_t begin, std::size_t end) {
+                     if (position++ == p.position)
+                         where = std::make_pair(begin, end);
+                 });
+        return where;
+    }
+
+    //! Every place of the word, which is folded like the texts.
+    PostingRange find(const std::string &word) const
+    {
+        const std::vector<std::string> folded = tokenize(word);
+        return folded.size() == 1 ? postingsOf(wordId(folded[0])) : PostingRange();
+    }
+
+    //! Places where the words of the text follow each other in a field, at its first word.
+    std::vector<Posting> phrase(const std::string &text) const
+    {
+        std::vector<Posting> out;
+        const std::vector<std::string> words = tokenize(text);
+        std::vector<PostingRange> ranges;
+        std::size_t rarest = 0;
+        for (const auto &word : words)
+        {
+            ranges.push_back(postingsOf(wordId(word)));
+            if (ranges.back().empty())
+                return out;
+            if (ranges.back().size() < ranges[rarest].size())
+                rarest = ranges.size() - 1;
+        }
+        if (ranges.size() == 1)
+            out.assign(ranges[0].begin(), ranges[0].end());
+        if (ranges.size() <= 1)
+            return out;
+
+        // Every place of the rarest word, checked against the others. Places only move
+        // forward, so each word keeps a cursor and gallops from it.
+        std::vector<const Posting *> cursors;
+        for (const auto &range : ranges)
+        {
+            cursors.push_back(range.begin());
+        }
+        for (const Posting &p : ranges[rarest])
+        {
+            if (p.position < rarest)
+                continue;
+            const Posting start = {p.field, static_cast<std::uint32_t>(p.position - rarest)};
+            bool matches = true;
+            for (std::size_t w = 0; w < ranges.size() && matches; ++w)
+            {
+                if (w == rarest)
+                    continue;
+                const Posting wanted = {start.field, static_cast<std::uint32_t>(start.position + w)};
+                cursors[w] = gallop(cursors[w], ranges[w].end(), wanted);
+                matches = cursors[w] != ranges[w].end() && cursors[w]->field == wanted.field &&
+                          cursors[w]->position == wanted.position;
+            }
+            if (matches)
+                out.push_back(start);
+        }
+        return out;
+    }
+
+    //! Every place of the words starting with the prefix, in story order.
+    std::vector<Posting> prefix(const std::string &start) const
+    {
+        std::vector<Posting> out;
+        const std::vector<std::string> folded = tokenize(start);
+        if (folded.size() != 1)
+            return out;
+        const std::string &p = folded[0];
+        std::vector<PostingRange> ranges;
+        std::size_t total = 0;
+        for (std::uint32_t id = lowerWord(p);
+             id < nWords() && lexicon.compare(lexiconOffsets[id], p.size(), p) == 0; ++id)
+        {
+            ranges.push_back(postingsOf(id));
+            total += ranges.back().size();
+        }
+
+        // Merge of the sorted postings of every word, on a heap of the words by their next place.
+        auto later = [](const PostingRange &a, const PostingRange &b) { return *b.first < *a.first; };
+        std::make_heap(ranges.begin(), ranges.end(), later);
+        out.reserve(total);
+        while (!ranges.empty())
+        {
+            std::pop_heap(ranges.begin(), ranges.end(), later);
+            PostingRange &next = ranges.back();
+            out.push_back(*next.first++);
+            if (next.empty())
+                ranges.pop_back();
+            else
+                std::push_heap(ranges.begin(), ranges.end(), later);
+        }
+        return out;
+    }
+
+    //! Bodies of the blocks playing the sample.
+    std::vector<std::uint32_t> playing(SSound::Sample sample) const
+    {
+        const std::size_t s = static_cast<std::size_t>(sample);
+        return std::vector<std::uint32_t>(sampleFields.begin() + sampleOffsets[s],
+                                          sampleFields.begin() + sampleOffsets[s + 1]);
+    }
+
+    //! Display texts of the choices going to the scene. For END_SCENE, those finishing the story
+    //! and the last bodies of the scenes without choices.
+    std::vector<std::uint32_t> linksTo(SceneId scene) const
+    {
+        const std::size_t row = scene == END_SCENE ? graph.nScenes : scene;
+        if (row > graph.nScenes)
+            return std::vector<std::uint32_t>();
+        return std::vector<std::uint32_t>(linkFields.begin() + linkOffsets[row],
+                                          linkFields.begin() + linkOffsets[row + 1]);
+    }
+
+    //! Scene of the label, END_SCENE for END and labels without scene.
+    SceneId scene(const std::string &label) const
+    {
+        auto found = std::lower_bound(byLabel.begin(), byLabel.end(), label, [this](SceneId id, const std::string &l) {
+            const TextRef ref = graph.scenes[id].label;
+            return l.compare(0, std::string::npos, graph.data(ref), ref.size) > 0;
+        });
+        if (found == byLabel.end() || graph.str(graph.scenes[*found].label) != label)
+            return END_SCENE;
+        return *found;
+    }
+
+    std::size_t fieldCount() const
+    {
+        return fields.size();
+    }
+
+    std::uint32_t wordCount() const
+    {
+        return nWords();
+    }
+
+    std::size_t postingCount() const
+    {
+        return postings.size();
+    }
+
+    //! Heap used by the index.
+    std::size_t bytes() const
+    {
+        return fields.capacity() * sizeof(Field) + lexicon.capacity() +
+               (lexiconOffsets.capacity() + postingOffsets.capacity() + sampleOffsets.capacity() +
+                sampleFields.capacity() + linkOffsets.capacity() + linkFields.capacity() + byLabel.capacity()) *
+                   sizeof(std::uint32_t) +
+               postings.capacity() * sizeof(Posting);
+    }
+};
+
+} // namespace SStory;
+
+#endif // SIndex_h
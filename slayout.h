@@ -0,0 +1,384 @@
+/* slayout.h
+ * Word wrapping of UTF-8 story text to the width of the terminal.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * Widths are counted in terminal columns: one per character, none for
+ * combining marks and two for wide (CJK, emoji) ones. Runs of ASCII and Latin
+ * text, most of any story, are counted 16 bytes at a time with SSE2.
+ *
+ * Layout keeps the lines of every text it wrapped, keyed by where the text
+ * is and its margins, so a paragraph is wrapped once and played any number of
+ * times. A hit compares the text with a copy, so a table mapped again at the
+ * same address is never served stale lines. It follows the terminal size
+ * through SIGWINCH and starts over when it changes.
+ */
+
+#ifndef SLayout_h
+#define SLayout_h
+
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "sstory.h"
+
+namespace SStory
+{
+
+//! Texts kept by a Layout before it starts over.
+constexpr std::size_t LAYOUT_CAPACITY = 1 << 16;
+
+struct LineSpan
+{
+    //! One line of a wrapped text, in bytes from the start of the text.
+    std::uint32_t offset;
+    std::uint32_t size;
+};
+
+namespace detail
+{
+
+inline bool continuation(unsigned char c)
+{
+    return (c & 0xC0) == 0x80;
+}
+
+//! Columns taken by a code point.
+inline unsigned columns(std::uint32_t cp)
+{
+    if (cp < 0x300)
+        return 1;
+    if (cp <= 0x36F || (cp >= 0x200B && cp <= 0x200F) || (cp >= 0xFE00 && cp <= 0xFE0F))
+        return 0;
+    if ((cp >= 0x1100 && cp <= 0x115F) || (cp >= 0x2E80 && cp <= 0xA4CF && cp != 0x303F) ||
+        (cp >= 0xAC00 && cp <= 0xD7A3) || (cp >= 0xF900 && cp <= 0xFAFF) || (cp >= 0xFE30 && cp <= 0xFE4F) ||
+        (cp >= 0xFF00 && cp <= 0xFF60) || (cp >= 0xFFE0 && cp <= 0xFFE6) || (cp >= 0x1F300 && cp <= 0x1F64F) ||
+        (cp >= 0x1F900 && cp <= 0x1F9FF) || (cp >= 0x20000 && cp <= 0x3FFFD))
+        return 2;
+    return 1;
+}
+
+//! Decodes the character at s, returns its size in bytes. A broken sequence is one byte wide.
+inline std::size_t decode(const unsigned char *s, std::size_t size, std::uint32_t &cp)
+{
+    const unsigned char c = s[0];
+    std::size_t n = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+    if (n == 0 || n > size)
+    {
+        cp = c;
+        return 1;
+    }
+    cp = n == 1 ? c : c & (0x7F >> n);
+    for (std::size_t i = 1; i < n; ++i)
+    {
+        if (!continuation(s[i]))
+        {
+            cp = c;
+            return 1;
+        }
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    return n;
+}
+
+#if defined(__SSE2__)
+//! Columns of 16 bytes holding only one column characters (ASCII and Latin up to U+02FF),
+//! -1 otherwise. A character starting in the block counts in it, wherever it ends.
+inline int simpleColumns(const unsigned char *s)
+{
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+    // Lead bytes from 0xCC on start combining marks or later scripts.
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(static_cast<char>(0xCB))),
+                                         _mm_set1_epi8(static_cast<char>(0xCB)))) != 0xFFFF)
+        return -1;
+    // Continuation bytes, 0x80 to 0xBF, are the ones below -64 as signed bytes.
+    const int rest = _mm_movemask_epi8(_mm_cmplt_epi8(v, _mm_set1_epi8(-64)));
+    return 16 - __builtin_popcount(rest);
+}
+#endif
+
+} // namespace detail
+
+//! Bytes of the text fitting in the columns, never splitting a character.
+//! used gets the columns they take.
+inline std::size_t fitting(const char *text, std::size_t size, std::size_t room, std::size_t &used)
+{
+    const unsigned char *s = reinterpret_cast<const unsigned char *>(text);
+    std::size_t i = 0;
+    used = 0;
+#if defined(__SSE2__)
+    while (i + 16 <= size && used + 16 <= room)
+    {
+        const int n = detail::simpleColumns(s + i);
+        if (n < 0)
+            break;
+        used += n;
+        i += 16;
+    }
+    // A character counted in the last block may end in the next one.
+    while (i < size && detail::continuation(s[i]))
+    {
+        ++i;
+    }
+#endif
+    while (i < size)
+    {
+        std::uint32_t cp = 0;
+        const std::size_t n = detail::decode(s + i, size - i, cp);
+        const unsigned w = detail::columns(cp);
+        if (used + w > room)
+            break;
+        used += w;
+        i += n;
+    }
+    return i;
+}
+
+//! Columns the text takes, on a single line.
+inline std::size_t textWidth(const char *text, std::size_t size)
+{
+    std::size_t used = 0;
+    fitting(text, size, static_cast<std::size_t>(-1) - 16, used);
+    return used;
+}
+
+//! Splits the text in lines of at most width columns, breaking at spaces and at every
+//! new line. The first line starts at column, the others at indent.
+inline void wrap(const char *text, std::size_t size, std::size_t width, std::size_t column, std::size_t indent,
+                 std::vector<LineSpan> &lines)
+{
+    std::size_t at = 0;
+    while (true)
+    {
+        const char *newline = static_cast<const char *>(std::memchr(text + at, '\n', size - at));
+        const std::size_t end = newline ? static_cast<std::size_t>(newline - text) : size;
+        while (true)
+        {
+            const std::size_t room = width > column ? width - column : 0;
+            std::size_t used = 0;
+            std::size_t fit = fitting(text + at, end - at, room, used);
+            if (at + fit == end)
+            {
+                lines.push_back(LineSpan{static_cast<std::uint32_t>(at), static_cast<std::uint32_t>(fit)});
+                break;
+            }
+            std::size_t cut = fit;
+            while (cut > 0 && text[at + cut] != ' ')
+            {
+                --cut;
+            }
+            if (cut == 0 && text[at] != ' ')
+            {
+                // A word longer than the line: split it, unless a fresh line would hold it.
+                if (column > indent)
+                    cut = 0;
+                else if (fit > 0)
+                    cut = fit;
+                else
+                {
+                    std::uint32_t cp = 0;
+                    cut = detail::decode(reinterpret_cast<const unsigned char *>(text + at), end - at, cp);
+                }
+            }
+            std::size_t last = cut;
+            while (last > 0 && text[at + last - 1] == ' ')
+            {
+                --last;
+            }
+            lines.push_back(LineSpan{static_cast<std::uint32_t>(at), static_cast<std::uint32_t>(last)});
+            at += cut;
+            while (at < end && text[at] == ' ')
+            {
+                ++at;
+            }
+            if (at == end)
+                break;
+            column = indent;
+        }
+        if (newline == nullptr)
+            break;
+        at = end + 1;
+        column = 0;
+    }
+}
+
+namespace detail
+{
+
+static volatile std::sig_atomic_t resized = 0;
+
+inline void onResize(int)
+{
+    resized = 1;
+}
+
+} // namespace detail
+
+//! Columns of the terminal on the descriptor, 0 if it is not one.
+inline std::size_t terminalWidth(int fd)
+{
+    winsize size;
+    if (!isatty(fd) || ioctl(fd, TIOCGWINSZ, &size) != 0)
+        return 0;
+    return size.ws_col;
+}
+
+class Layout : public TextLayout
+{
+    //! Cache of wrapped texts for one width. A width of 0 leaves texts as they are.
+  private:
+    struct Key
+    {
+        const char *data;
+        std::uint32_t size;
+        std::uint32_t column;
+        std::uint32_t indent;
+
+        bool operator==(const Key &other) const
+        {
+            return data == other.data && size == other.size && column == other.column && indent == other.indent;
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key &k) const
+        {
+            const std::uint64_t h = (reinterpret_cast<std::uintptr_t>(k.data) ^ (std::uint64_t(k.size) << 40) ^
+                                     (std::uint64_t(k.column) << 20) ^ k.indent) *
+                                    0x9E3779B97F4A7C15ull;
+            return static_cast<std::size_t>(h ^ (h >> 32));
+        }
+    };
+
+    struct Entry
+    {
+        std::size_t copy;    // Offset of the text in texts.
+        std::uint32_t first; // First line in spans.
+        std::uint32_t count;
+    };
+
+    std::unordered_map<Key, Entry, KeyHash> cached;
+    std::string texts; // Copies of the cached texts, back to back.
+    std::vector<LineSpan> spans;
+    std::size_t width = 0;
+    int terminal = -1;
+
+  public:
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+
+    explicit Layout(std::size_t columns = 0)
+        : width(columns) {}
+
+    //! Wraps to the width of the terminal on the descriptor, following its changes.
+    void follow(int fd)
+    {
+        terminal = fd;
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_handler = detail::onResize;
+        sigaction(SIGWINCH, &action, nullptr);
+        resize(terminalWidth(fd));
+    }
+
+    void resize(std::size_t columns)
+    {
+        if (columns == width)
+            return;
+        width = columns;
+        clear();
+    }
+
+    void clear()
+    {
+        cached.clear();
+        spans.clear();
+        texts.clear();
+    }
+
+    std::size_t columns()
+    {
+        if (detail::resized && terminal >= 0)
+        {
+            detail::resized = 0;
+            resize(terminalWidth(terminal));
+        }
+        return width;
+    }
+
+    //! Lines of the text starting at column, the next ones at indent.
+    //! Valid until the next call.
+    const LineSpan *lines(const char *text, std::size_t size, std::size_t column, std::size_t indent,
+                          std::uint32_t &count)
+    {
+        const std::size_t w = columns(); // First, a resize drops every line.
+        // No terminal is that wide, the margins are only clamped to fit the key.
+        const std::size_t limit = 0xFFFFFFFFu;
+        const Key key = {text, static_cast<std::uint32_t>(size), static_cast<std::uint32_t>(std::min<std::size_t>(column, limit)),
+                         static_cast<std::uint32_t>(std::min<std::size_t>(indent, limit))};
+        auto found = cached.find(key);
+        if (found != cached.end() && std::memcmp(texts.data() + found->second.copy, text, size) == 0)
+        {
+            ++hits;
+            count = found->second.count;
+            return spans.data() + found->second.first;
+        }
+        ++misses;
+        if (cached.size() >= LAYOUT_CAPACITY)
+        {
+            clear();
+            found = cached.end();
+        }
+        const std::size_t first = spans.size();
+        wrap(text, size, w, key.column, key.indent, spans);
+        count = static_cast<std::uint32_t>(spans.size() - first);
+        const Entry entry = {texts.size(), static_cast<std::uint32_t>(first), count};
+        texts.append(text, size);
+        if (found != cached.end())
+            found->second = entry;
+        else
+            cached.emplace(key, entry);
+        return spans.data() + first;
+    }
+
+    void append(std::string &out, const char *data, std::size_t size, bool hanging) override
+    {
+        if (columns() == 0)
+        {
+            out.append(data, size);
+            return;
+        }
+        const std::size_t start = out.rfind('\n') + 1; // npos + 1 is 0.
+        const std::size_t column = textWidth(out.data() + start, out.size() - start);
+        const std::size_t indent = hanging ? column : 0;
+        std::uint32_t count = 0;
+        const LineSpan *line = lines(data, size, column, indent, count);
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            if (i > 0)
+            {
+                out += '\n';
+                out.append(indent, ' ');
+            }
+            out.append(data + line[i].offset, line[i].size);
+        }
+    }
+};
+
+} // namespace SStory;
+
+#endif // SLayout_h
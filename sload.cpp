@@ -0,0 +1,369 @@
+/* sload.cpp
+ * Load generator for the story server: thousands of scripted players at once.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ *   sload ADDRESS [clients] [seconds] [think ms] [story|-] [threads]
+ *
+ * Every client connects to ADDRESS (tcp:HOST:PORT or unix:PATH), plays like
+ * a ScriptedPlayer and waits the think time before every answer. It plays
+ * the story locally too, so it knows every byte the server must send and
+ * checks them. A response is over once all of them arrived, which is when
+ * its latency is taken. A client whose story ended connects again. The
+ * server must play the same story, untranslated: the sample adventure with
+ * -, the default. Prints one JSON object, like sbench.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "example.h"
+#include "sbench.h"
+#include "sscript.h"
+#include "sserver.h"
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+struct Totals
+{
+    std::uint64_t connects = 0;
+    std::uint64_t answers = 0;
+    std::uint64_t sessions = 0;   // Played to the end.
+    std::uint64_t mismatches = 0; // Responses that were not what the story says.
+    std::uint64_t errors = 0;     // Failed connections and dropped ones.
+    std::vector<std::uint32_t> latencies; // Microseconds.
+};
+
+struct Client
+{
+    int fd = -1;
+    SStory::Session session;
+    std::string expected;
+    std::size_t received = 0;
+    std::uint64_t generation = 0; // Of the connection, stale timers do not match it.
+    Clock::time_point asked;
+    bool answered = false; // Waiting for the response to an answer, not to the connection.
+};
+
+struct Timer
+{
+    Clock::time_point when;
+    std::uint32_t client;
+    std::uint64_t generation;
+
+    bool operator<(const Timer &other) const
+    {
+        return when > other.when; // Soonest on top of the heap.
+    }
+};
+
+class Swarm
+{
+    //! The clients of one thread, on one epoll loop.
+  private:
+    const SStory::Graph &graph;
+    const sockaddr_storage &address;
+    socklen_t addressSize;
+    std::chrono::milliseconds think;
+    int epoll;
+    std::vector<Client> clients;
+    std::vector<Timer> timers;
+    SStory::Rng rng;
+    std::vector<SStory::Event> events;
+    SStory::TelnetSink sink;
+    SStory::Renderer renderer;
+
+    void later(std::uint32_t i, std::chrono::milliseconds delay)
+    {
+        timers.push_back(Timer{Clock::now() + delay, i, clients[i].generation});
+        std::push_heap(timers.begin(), timers.end());
+    }
+
+    void expect(Client &c)
+    {
+        c.expected.clear();
+        c.received = 0;
+        sink.out = &c.expected;
+        renderer.render(graph, events);
+    }
+
+    void disconnect(Client &c)
+    {
+        if (c.fd >= 0)
+            ::close(c.fd);
+        c.fd = -1;
+        ++c.generation;
+    }
+
+    void connect(std::uint32_t i)
+    {
+        Client &c = clients[i];
+        disconnect(c);
+        c.fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        const int one = 1;
+        if (c.fd >= 0 && address.ss_family != AF_UNIX)
+            setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (c.fd < 0 ||
+            (::connect(c.fd, reinterpret_cast<const sockaddr *>(&address), addressSize) != 0 && errno != EINPROGRESS))
+        {
+            ++totals.errors;
+            disconnect(c);
+            later(i, std::chrono::milliseconds(100));
+            return;
+        }
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, c.fd, &event);
+        ++totals.connects;
+        c.session = graph.initialSession();
+        graph.resume(c.session, events);
+        expect(c);
+        c.answered = false;
+    }
+
+    void answer(std::uint32_t i)
+    {
+        Client &c = clients[i];
+        const std::uint32_t shown = graph.choiceCount(c.session);
+        const int input = shown > 0 ? static_cast<int>(rng.below(shown)) + 1 : 0;
+        const std::string line = shown > 0 ? std::to_string(input) + "\r\n" : std::string("\r\n");
+        graph.step(c.session, input, events);
+        expect(c);
+        c.answered = true;
+        c.asked = Clock::now();
+        if (::send(c.fd, line.data(), line.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(line.size()))
+        {
+            ++totals.errors;
+            connect(i);
+        }
+    }
+
+    void receive(std::uint32_t i)
+    {
+        Client &c = clients[i];
+        char bytes[16384];
+        const ssize_t size = ::read(c.fd, bytes, sizeof(bytes));
+        if (size < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        if (size <= 0)
+        {
+            ++totals.errors;
+            connect(i);
+            return;
+        }
+        if (c.received + size > c.expected.size() || std::memcmp(bytes, c.expected.data() + c.received, size) != 0)
+        {
+            ++totals.mismatches;
+            connect(i);
+            return;
+        }
+        c.received += static_cast<std::size_t>(size);
+        if (c.received < c.expected.size())
+            return;
+
+        if (c.answered)
+        {
+            ++totals.answers;
+            const auto took = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - c.asked).count();
+            totals.latencies.push_back(static_cast<std::uint32_t>(took));
+        }
+        if (c.session.scene == SStory::END_SCENE)
+        {
+            ++totals.sessions;
+            connect(i);
+        }
+        else if (think.count() == 0)
+        {
+            answer(i);
+        }
+        else
+        {
+            later(i, think);
+        }
+    }
+
+  public:
+    Totals totals;
+
+    Swarm(const SStory::Graph &g, const sockaddr_storage &addr, socklen_t size, std::uint32_t count,
+          std::chrono::milliseconds wait, std::uint64_t seed)
+        : graph(g), address(addr), addressSize(size), think(wait), epoll(epoll_create1(EPOLL_CLOEXEC)),
+          clients(count), rng(seed), renderer(sink) {}
+
+    Swarm(const Swarm &) = delete;
+    Swarm &operator=(const Swarm &) = delete;
+
+    ~Swarm()
+    {
+        for (auto &c : clients)
+        {
+            disconnect(c);
+        }
+        ::close(epoll);
+    }
+
+    void run(Clock::time_point until)
+    {
+        for (std::uint32_t i = 0; i < clients.size(); ++i)
+        {
+            connect(i);
+        }
+        epoll_event ready[256];
+        while (true)
+        {
+            const Clock::time_point now = Clock::now();
+            if (now >= until)
+                break;
+            while (!timers.empty() && timers.front().when <= now)
+            {
+                const Timer timer = timers.front();
+                std::pop_heap(timers.begin(), timers.end());
+                timers.pop_back();
+                if (clients[timer.client].fd < 0)
+                    connect(timer.client);
+                else if (clients[timer.client].generation == timer.generation)
+                    answer(timer.client);
+            }
+            const Clock::time_point wake = timers.empty() ? until : std::min(until, timers.front().when);
+            const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(wake - Clock::now()).count();
+            const int n = epoll_wait(epoll, ready, 256, wait > 0 ? static_cast<int>(wait) : 0);
+            for (int k = 0; k < n; ++k)
+            {
+                receive(ready[k].data.u32);
+            }
+        }
+    }
+};
+
+bool resolve(const std::string &text, sockaddr_storage &address, socklen_t &size)
+{
+    std::memset(&address, 0, sizeof(address));
+    if (text.compare(0, 5, "unix:") == 0)
+    {
+        sockaddr_un *un = reinterpret_cast<sockaddr_un *>(&address);
+        const std::string path = text.substr(5);
+        if (path.empty() || path.size() >= sizeof(un->sun_path))
+            return false;
+        un->sun_family = AF_UNIX;
+        std::memcpy(un->sun_path, path.c_str(), path.size());
+        size = sizeof(sockaddr_un);
+        return true;
+    }
+    const std::size_t colon = text.rfind(':');
+    if (text.compare(0, 4, "tcp:") != 0 || colon < 4)
+        return false;
+    const std::string host = colon > 4 ? text.substr(4, colon - 4) : std::string("127.0.0.1");
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *found = nullptr;
+    if (getaddrinfo(host.c_str(), text.substr(colon + 1).c_str(), &hints, &found) != 0 || found == nullptr)
+        return false;
+    std::memcpy(&address, found->ai_addr, found->ai_addrlen);
+    size = found->ai_addrlen;
+    freeaddrinfo(found);
+    return true;
+}
+
+std::uint32_t percentile(std::vector<std::uint32_t> &values, double p)
+{
+    if (values.empty())
+        return 0;
+    const std::size_t at = std::min(values.size() - 1, static_cast<std::size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + at, values.end());
+    return values[at];
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " tcp:HOST:PORT|unix:PATH [clients] [seconds] [think ms] [story|-] [threads]\n";
+        return 2;
+    }
+    const std::uint32_t clients = argc > 2 ? static_cast<std::uint32_t>(std::atoi(argv[2])) : 1000;
+    const double seconds = argc > 3 ? std::atof(argv[3]) : 10.0;
+    const std::chrono::milliseconds think(argc > 4 ? std::atoi(argv[4]) : 100);
+    const std::string storyPath = argc > 5 ? argv[5] : "-";
+    unsigned threads = argc > 6 ? static_cast<unsigned>(std::atoi(argv[6])) : std::thread::hardware_concurrency();
+    threads = std::max(1u, std::min(threads, std::max(1u, clients)));
+
+    sockaddr_storage address;
+    socklen_t addressSize = 0;
+    if (!resolve(argv[1], address, addressSize))
+    {
+        std::cerr << "Cannot resolve " << argv[1] << '\n';
+        return 1;
+    }
+    SStory::StoryFile file;
+    SStory::Graph graph = Example::graph();
+    if (storyPath != "-")
+    {
+        if (!file.open(storyPath))
+            return 1;
+        graph = file.graph();
+    }
+    if (SStory::raiseFileLimit() < clients + 64)
+        std::cerr << "Not enough descriptors for " << clients << " clients, raise ulimit -n\n";
+
+    std::vector<std::unique_ptr<Swarm>> swarms;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        const std::uint32_t count = clients / threads + (t < clients % threads ? 1 : 0);
+        swarms.emplace_back(new Swarm(graph, address, addressSize, count, think, t + 1));
+    }
+    const Clock::time_point until = Clock::now() + std::chrono::microseconds(static_cast<std::int64_t>(seconds * 1e6));
+    std::vector<std::thread> running;
+    for (auto &swarm : swarms)
+    {
+        running.emplace_back(&Swarm::run, swarm.get(), until);
+    }
+    Totals all;
+    for (std::size_t t = 0; t < running.size(); ++t)
+    {
+        running[t].join();
+        const Totals &part = swarms[t]->totals;
+        all.connects += part.connects;
+        all.answers += part.answers;
+        all.sessions += part.sessions;
+        all.mismatches += part.mismatches;
+        all.errors += part.errors;
+        all.latencies.insert(all.latencies.end(), part.latencies.begin(), part.latencies.end());
+    }
+
+    const std::uint32_t p50 = percentile(all.latencies, 0.50);
+    const std::uint32_t p99 = percentile(all.latencies, 0.99);
+    const std::uint32_t p999 = percentile(all.latencies, 0.999);
+    const std::uint32_t max = all.latencies.empty() ? 0 : *std::max_element(all.latencies.begin(), all.latencies.end());
+    std::printf("{\"address\":\"%s\",\"clients\":%u,\"threads\":%u,\"seconds\":%.1f,\"think_ms\":%lld,"
+                "\"connects\":%llu,\"answers\":%llu,\"answers_per_s\":%.0f,\"sessions\":%llu,\"mismatches\":%llu,"
+                "\"errors\":%llu,\"p50_us\":%u,\"p99_us\":%u,\"p999_us\":%u,\"max_us\":%u}\n",
+                argv[1], clients, threads, seconds, static_cast<long long>(think.count()),
+                static_cast<unsigned long long>(all.connects), static_cast<unsigned long long>(all.answers),
+                all.answers / seconds, static_cast<unsigned long long>(all.sessions),
+                static_cast<unsigned long long>(all.mismatches), static_cast<unsigned long long>(all.errors), p50, p99,
+                p999, max);
+    return all.mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+/* slocale.cpp
+ * Makes the string tables that translate a story, see slocale.h.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ *   slocale template story.txt|story.ssb en.txt
+ *
+ * writes every text of the story as a line "KEY text", grouped by scene. The
+ * translator replaces the text after each key, lines left out or empty keep the
+ * original text. Inside text, \n is a new line and \\ a backslash.
+ *
+ *   slocale build en.txt story.en.ssl
+ *
+ * turns the translated lines into the table ExGame maps with SSTORY_LOCALE=en.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "slocale.h"
+#include "sscript.h"
+
+static std::string escape(const char *data, std::size_t size)
+{
+    std::string out;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        if (data[i] == '\n')
+            out += "\\n";
+        else if (data[i] == '\\')
+            out += "\\\\";
+        else
+            out += data[i];
+    }
+    return out;
+}
+
+static std::string unescape(const std::string &s)
+{
+    std::string out;
+    for (std::size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] == '\\' && i + 1 < s.size())
+        {
+            const char next = s[++i];
+            out += next == 'n' ? '\n' : next;
+        }
+        else
+        {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+static int writeTemplate(const std::string &story, const std::string &path)
+{
+    SStory::StoryFile file;
+    if (!file.open(story))
+        return 1;
+    const SStory::Graph g = file.graph();
+    std::ofstream out(path);
+    if (!out)
+    {
+        std::cerr << "Cannot write " << path << '\n';
+        return 1;
+    }
+    out << "# Texts of " << story << ", translate what follows every key.\n";
+
+    std::unordered_set<std::uint64_t> written;
+    std::size_t count = 0;
+    char key[17];
+    auto line = [&](SStory::TextRef t) {
+        const std::uint64_t k = SStory::textKey(g, t);
+        if (t.size == 0 || !written.insert(k).second)
+            return;
+        std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(k));
+        out << key << ' ' << escape(g.data(t), t.size) << '\n';
+        ++count;
+    };
+    for (SStory::SceneId s = 0; s < g.nScenes; ++s)
+    {
+        out << "\n# scene " << g.str(g.scenes[s].label) << '\n';
+        for (std::uint32_t b = g.scenes[s].firstBlock; b < g.scenes[s].firstBlock + g.scenes[s].nBlocks; ++b)
+        {
+            line(g.blocks[b].body);
+            for (std::uint32_t c = g.blocks[b].firstChoice; c < g.blocks[b].firstChoice + g.blocks[b].nChoices; ++c)
+            {
+                line(g.choices[c].displayText);
+                if (g.choices[c].complement.offset != SStory::NO_TEXT)
+                    line(g.choices[c].complement);
+            }
+        }
+    }
+    std::cout << count << " texts written to " << path << '\n';
+    return out ? 0 : 1;
+}
+
+static int build(const std::string &translation, const std::string &path)
+{
+    std::ifstream in(translation);
+    if (!in)
+    {
+        std::cerr << "Cannot read " << translation << '\n';
+        return 1;
+    }
+    std::vector<std::pair<std::uint64_t, std::string>> strings;
+    std::string text;
+    int line = 0;
+    int errors = 0;
+    while (std::getline(in, text))
+    {
+        ++line;
+        if (!text.empty() && text.back() == '\r')
+            text.pop_back();
+        if (text.empty() || text[0] == '#')
+            continue;
+        char *end = nullptr;
+        const std::uint64_t key = std::strtoull(text.c_str(), &end, 16);
+        if (end != text.c_str() + 16 || (*end != ' ' && *end != '\0'))
+        {
+            std::cerr << "Locale(EE): line " << line << ": expected a key of 16 hexadecimal digits\n";
+            ++errors;
+            continue;
+        }
+        if (text.size() > 17)
+            strings.emplace_back(key, unescape(text.substr(17)));
+    }
+    if (errors > 0)
+        return 1;
+    if (!SStory::saveStrings(strings, path))
+    {
+        std::cerr << "Cannot write " << path << '\n';
+        return 1;
+    }
+    std::cout << strings.size() << " texts written to " << path << '\n';
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const std::string command = argc > 1 ? argv[1] : "";
+    if (argc == 4 && command == "template")
+        return writeTemplate(argv[2], argv[3]);
+    if (argc == 4 && command == "build")
+        return build(argv[2], argv[3]);
+    std::cerr << "Usage: " << argv[0] << " template story.txt|story.ssb en.txt\n"
+              << "       " << argv[0] << " build en.txt story.en.ssl\n";
+    return 2;
+}
@@ -0,0 +1,323 @@
+/* slocale.h
+ * Translations of a story in string tables, one file per locale.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * A string table maps the key of a text of the story to its translation. The
+ * key is the 64 bits FNV-1a of the original text, so a table still fits the
+ * story after it is recompiled or edited, and texts nobody translated yet show
+ * up in the original language. Layout, every field little endian:
+ *
+ *   LocaleHeader
+ *   LocaleEntry entries[nEntries]  (sorted by key)
+ *   char        text[textSize]     (not null terminated)
+ *
+ * The checksum is FNV-1a over everything after the header. Tables are
+ * mapped read only, a Locale keeps one for the language being played and
+ * optionally one to fall back on, whatever the number of languages shipped.
+ * The compiled story is the same for every locale.
+ */
+
+#ifndef SLocale_h
+#define SLocale_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sbinary.h"
+#include "sstory.h"
+
+namespace SStory
+{
+
+constexpr std::uint32_t LOCALE_VERSION = 1;
+
+struct LocaleHeader
+{
+    char magic[4]; // "SSTL"
+    std::uint32_t version;
+    std::uint32_t checksum;
+    std::uint32_t nEntries;
+    std::uint32_t textSize;
+    std::uint32_t reserved; // Zero, keeps the entries 8 bytes aligned.
+};
+
+struct LocaleEntry
+{
+    std::uint64_t key; // textKey() of the original text.
+    std::uint32_t offset;
+    std::uint32_t size;
+};
+
+static_assert(sizeof(LocaleHeader) == 24 && sizeof(LocaleEntry) == 16,
+              "The string table layout must not depend on the compiler");
+
+//! Key of a text in every string table.
+inline std::uint64_t textKey(const Graph &g, TextRef t)
+{
+    return hash64(g.data(t), t.size);
+}
+
+//! Writes a string table, returns false if the file could not be written.
+//! Entries may come in any order, the last one wins for a repeated key.
+inline bool saveStrings(std::vector<std::pair<std::uint64_t, std::string>> strings, const std::string &path)
+{
+    std::stable_sort(strings.begin(), strings.end(),
+                     [](const std::pair<std::uint64_t, std::string> &a, const std::pair<std::uint64_t, std::string> &b) {
+                         return a.first < b.first;
+                     });
+    std::vector<LocaleEntry> entries;
+    std::string text;
+    for (const auto &item : strings)
+    {
+        if (!entries.empty() && entries.back().key == item.first)
+            entries.pop_back();
+        entries.push_back(LocaleEntry{item.first, static_cast<std::uint32_t>(text.size()),
+                                      static_cast<std::uint32_t>(item.second.size())});
+        text += item.second;
+    }
+
+    LocaleHeader header = {{'S', 'S', 'T', 'L'}, LOCALE_VERSION, 2166136261u, static_cast<std::uint32_t>(entries.size()),
+                           static_cast<std::uint32_t>(text.size()), 0};
+    header.checksum = checksum(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(LocaleEntry));
+    header.checksum = checksum(text.data(), text.size(), header.checksum);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(LocaleEntry));
+    out.write(text.data(), text.size());
+    return static_cast<bool>(out.flush());
+}
+
+class StringTable
+{
+    //! A string table mapped read only, only the pages looked up are ever read.
+  private:
+    const char *base = nullptr;
+    std::size_t length = 0;
+
+    const LocaleHeader &header() const
+    {
+        return *reinterpret_cast<const LocaleHeader *>(base);
+    }
+
+    const LocaleEntry *entries() const
+    {
+        return reinterpret_cast<const LocaleEntry *>(base + sizeof(LocaleHeader));
+    }
+
+    const char *text() const
+    {
+        return base + sizeof(LocaleHeader) + header().nEntries * sizeof(LocaleEntry);
+    }
+
+    void fail(const std::string &path, const char *message)
+    {
+        std::cerr << "SStory(EE): " << path << ": " << message << '\n';
+        close();
+    }
+
+  public:
+    StringTable() {}
+    StringTable(const StringTable &) = delete;
+    StringTable &operator=(const StringTable &) = delete;
+
+    ~StringTable()
+    {
+        close();
+    }
+
+    //! Maps the file and checks its header.
+    bool open(const std::string &path)
+    {
+        close();
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "SStory(EE): cannot open " << path << '\n';
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) >= sizeof(LocaleHeader))
+        {
+            void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                base = static_cast<const char *>(mapped);
+                length = info.st_size;
+            }
+        }
+        ::close(fd);
+        if (base == nullptr)
+        {
+            std::cerr << "SStory(EE): cannot map " << path << '\n';
+            return false;
+        }
+
+        const LocaleHeader &h = header();
+        if (std::memcmp(h.magic, "SSTL", 4) != 0)
+        {
+            fail(path, "not a string table");
+            return false;
+        }
+        if (h.version != LOCALE_VERSION)
+        {
+            fail(path, "unsupported version");
+            return false;
+        }
+        if (sizeof(LocaleHeader) + std::uint64_t(h.nEntries) * sizeof(LocaleEntry) + h.textSize != length)
+        {
+            fail(path, "truncated file");
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (base != nullptr)
+            munmap(const_cast<char *>(base), length);
+        base = nullptr;
+        length = 0;
+    }
+
+    bool isOpen() const
+    {
+        return base != nullptr;
+    }
+
+    void swap(StringTable &other)
+    {
+        std::swap(base, other.base);
+        std::swap(length, other.length);
+    }
+
+    //! Full pass over the file: checksum, order and every offset. Meant for untrusted files,
+    //! open() only checks the header and find() never reads past the text.
+    bool verify() const
+    {
+        if (base == nullptr || checksum(base + sizeof(LocaleHeader), length - sizeof(LocaleHeader)) != header().checksum)
+            return false;
+        const LocaleEntry *e = entries();
+        for (std::uint32_t i = 0; i < header().nEntries; ++i)
+        {
+            if ((i > 0 && e[i - 1].key >= e[i].key) || std::uint64_t(e[i].offset) + e[i].size > header().textSize)
+                return false;
+        }
+        return true;
+    }
+
+    std::uint32_t size() const
+    {
+        return base == nullptr ? 0 : header().nEntries;
+    }
+
+    //! Binary search of the key, data is not null terminated.
+    bool find(std::uint64_t key, const char *&data, std::uint32_t &bytes) const
+    {
+        if (base == nullptr)
+            return false;
+        const LocaleEntry *first = entries();
+        const LocaleEntry *last = first + header().nEntries;
+        const LocaleEntry *found = std::lower_bound(
+            first, last, key, [](const LocaleEntry &e, std::uint64_t k) { return e.key < k; });
+        if (found == last || found->key != key || std::uint64_t(found->offset) + found->size > header().textSize)
+            return false;
+        data = text() + found->offset;
+        bytes = found->size;
+        return true;
+    }
+};
+
+//! Table of a locale next to a story: story.ssb and en give story.en.ssl.
+inline std::string localePath(const std::string &story, const std::string &locale)
+{
+    const std::size_t slash = story.rfind('/');
+    const std::size_t dot = story.rfind('.');
+    const std::string base = dot == std::string::npos || (slash != std::string::npos && dot < slash) ? story
+                                                                                                     : story.substr(0, dot);
+    return base + '.' + locale + ".ssl";
+}
+
+class Locale : public Translation
+{
+    //! Translation of a story to one locale, with a fallback locale for what is missing
+    //! and the story itself after both. Switch between renders, never during one.
+  private:
+    StringTable active;
+    StringTable fallback;
+
+  public:
+    //! Plays in the locale of the table, returns false and keeps the current one on errors.
+    //! Only the header is checked, the table is not read before its texts are looked up.
+    bool select(const std::string &path)
+    {
+        StringTable table;
+        if (!table.open(path))
+            return false;
+        // The old table is only unmapped once the new one is known to be good.
+        active.swap(table);
+        return true;
+    }
+
+    //! Table looked up for texts the selected locale has not translated.
+    bool fallBack(const std::string &path)
+    {
+        return fallback.open(path);
+    }
+
+    //! Back to the texts of the story.
+    void clear()
+    {
+        active.close();
+        fallback.close();
+    }
+
+    //! Picks locales from a list like "pt_BR:pt:es", the first table found next to the
+    //! story is selected and the second one is the fallback. Missing ones are skipped.
+    bool use(const std::string &story, const std::string &list)
+    {
+        clear();
+        std::size_t begin = 0;
+        while (begin <= list.size() && !fallback.isOpen())
+        {
+            std::size_t end = list.find(':', begin);
+            if (end == std::string::npos)
+                end = list.size();
+            const std::string path = localePath(story, list.substr(begin, end - begin));
+            if (end > begin && access(path.c_str(), R_OK) == 0)
+            {
+                if (!active.isOpen())
+                    select(path);
+                else
+                    fallBack(path);
+            }
+            begin = end + 1;
+        }
+        return active.isOpen();
+    }
+
+    bool find(const Graph &g, TextRef t, const char *&data, std::uint32_t &size) const override
+    {
+        if (!active.isOpen())
+            return false;
+        const std::uint64_t key = textKey(g, t);
+        return active.find(key, data, size) || fallback.find(key, data, size);
+    }
+};
+
+} // namespace SStory;
+
+#endif // SLocale_h
@@ -0,0 +1,571 @@
+/* sloop.h
+ * Console front-end on an event loop: input, timers and sound on one thread.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * EventLoop waits with ppoll on the descriptors watched and the next timer, so
+ * it never sleeps in a read while something else is due. Console plays a story
+ * on it: the terminal goes to raw mode and every key is handled as soon as it
+ * arrives, timed choices fall to their default choice when their timer fires,
+ * and the sound backend is pumped every few milliseconds. Piped input is read
+ * by lines, the same answers as Graph::play().
+ *
+ * Text is wrapped to the width of the terminal, see slayout.h, and can be typed
+ * out a few characters at a time by a Typewriter. A key pressed while it types
+ * shows the rest at once, timers of timed choices start once the text is out.
+ */
+
+#ifndef SLoop_h
+#define SLoop_h
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "slayout.h"
+#include "ssound.h"
+#include "sstory.h"
+#include "strace.h"
+
+namespace SStory
+{
+
+//! Milliseconds between two pumps of the sound backend.
+constexpr int SOUND_PUMP_PERIOD = 10;
+//! Longest wait, in milliseconds, between two writes of a Typewriter.
+constexpr int TYPEWRITER_PERIOD = 16;
+
+class EventLoop
+{
+    //! Timers and ready descriptors, dispatched on the thread calling run().
+  public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::uint64_t TimerId;
+
+  private:
+    struct Timer
+    {
+        std::function<void()> task;
+        Clock::duration period; // Zero for timers that fire once.
+    };
+
+    std::map<TimerId, Timer> timers;
+    std::vector<std::pair<Clock::time_point, TimerId>> queue; // Heap, soonest first.
+    std::vector<pollfd> fds;
+    std::vector<std::function<void()>> handlers; // Same order as fds.
+    TimerId next = 1;
+    bool running = false;
+
+    static bool later(const std::pair<Clock::time_point, TimerId> &a, const std::pair<Clock::time_point, TimerId> &b)
+    {
+        return a.first > b.first || (a.first == b.first && a.second > b.second);
+    }
+
+    void schedule(Clock::time_point when, TimerId id)
+    {
+        queue.emplace_back(when, id);
+        std::push_heap(queue.begin(), queue.end(), later);
+    }
+
+    //! Runs the timers due, returns when the next one is.
+    bool fire(Clock::time_point &soonest)
+    {
+        while (!queue.empty() && running)
+        {
+            const std::pair<Clock::time_point, TimerId> top = queue.front();
+            auto found = timers.find(top.second);
+            if (found == timers.end())
+            {
+                // Cancelled.
+                std::pop_heap(queue.begin(), queue.end(), later);
+                queue.pop_back();
+                continue;
+            }
+            const Clock::time_point now = Clock::now();
+            if (top.first > now)
+            {
+                soonest = top.first;
+                return true;
+            }
+            std::pop_heap(queue.begin(), queue.end(), later);
+            queue.pop_back();
+            std::function<void()> task = found->second.task;
+            if (found->second.period != Clock::duration::zero())
+                schedule(std::max(top.first + found->second.period, now), top.second);
+            else
+                timers.erase(found);
+            task();
+        }
+        return false;
+    }
+
+  public:
+    //! Runs the task once, after the delay.
+    TimerId after(Clock::duration delay, std::function<void()> task)
+    {
+        timers[next] = Timer{std::move(task), Clock::duration::zero()};
+        schedule(Clock::now() + delay, next);
+        return next++;
+    }
+
+    //! Runs the task every period, the first time one period from now.
+    TimerId every(Clock::duration period, std::function<void()> task)
+    {
+        timers[next] = Timer{std::move(task), period};
+        schedule(Clock::now() + period, next);
+        return next++;
+    }
+
+    //! Harmless for timers that already fired.
+    void cancel(TimerId id)
+    {
+        timers.erase(id);
+    }
+
+    //! Calls ready every time the descriptor can be read without blocking.
+    void watch(int fd, std::function<void()> ready)
+    {
+        fds.push_back(pollfd{fd, POLLIN, 0});
+        handlers.push_back(std::move(ready));
+    }
+
+    void unwatch(int fd)
+    {
+        for (std::size_t i = 0; i < fds.size(); ++i)
+        {
+            if (fds[i].fd == fd)
+            {
+                fds.erase(fds.begin() + i);
+                handlers.erase(handlers.begin() + i);
+                return;
+            }
+        }
+    }
+
+    //! Makes run() return once the current task is over.
+    void stop()
+    {
+        running = false;
+    }
+
+    //! Dispatches until stop(), or until there is nothing left to wait for.
+    void run()
+    {
+        running = true;
+        while (running)
+        {
+            Clock::time_point soonest;
+            const bool timed = fire(soonest);
+            if (!running || (!timed && fds.empty()))
+                break;
+
+            timespec wait = {0, 0};
+            if (timed)
+            {
+                const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(soonest - Clock::now()).count();
+                if (left > 0)
+                    wait = timespec{static_cast<time_t>(left / 1000000000), static_cast<long>(left % 1000000000)};
+            }
+            const int ready = ppoll(fds.data(), fds.size(), timed ? &wait : nullptr, nullptr);
+            if (ready <= 0)
+                continue;
+            // Handlers may watch or unwatch, only the descriptors polled are looked at.
+            std::vector<std::pair<int, short>> polled;
+            for (const pollfd &p : fds)
+            {
+                polled.emplace_back(p.fd, p.revents);
+            }
+            for (const auto &p : polled)
+            {
+                if (p.second == 0 || !running)
+                    continue;
+                for (std::size_t i = 0; i < fds.size(); ++i)
+                {
+                    if (fds[i].fd == p.first)
+                    {
+                        std::function<void()> handler = handlers[i];
+                        handler();
+                        break;
+                    }
+                }
+            }
+        }
+        running = false;
+    }
+};
+
+namespace detail
+{
+
+//! Terminal settings to put back, also from a signal handler.
+static termios savedTerminal;
+static volatile std::sig_atomic_t rawTerminal = 0;
+
+inline void restoreTerminal(int signal)
+{
+    if (rawTerminal)
+        tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal);
+    rawTerminal = 0;
+    if (signal != 0)
+    {
+        STRACE(STrace::TRACE.flush());
+        std::signal(signal, SIG_DFL);
+        std::raise(signal);
+    }
+}
+
+} // namespace detail
+
+class TerminalInput
+{
+    //! Standard input read as it arrives and handed out by lines. A terminal is put in
+    //! raw mode, with the typed line echoed and edited here, until destroyed.
+  private:
+    Sink &echo;
+    std::string line;
+    bool raw = false;
+
+  public:
+    explicit TerminalInput(Sink &out)
+        : echo(out)
+    {
+        if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &detail::savedTerminal) != 0)
+            return;
+        termios settings = detail::savedTerminal;
+        settings.c_lflag &= ~(ICANON | ECHO);
+        settings.c_cc[VMIN] = 1;
+        settings.c_cc[VTIME] = 0;
+        if (tcsetattr(STDIN_FILENO, TCSANOW, &settings) != 0)
+            return;
+        raw = true;
+        detail::rawTerminal = 1;
+        std::signal(SIGINT, detail::restoreTerminal);
+        std::signal(SIGTERM, detail::restoreTerminal);
+        std::signal(SIGHUP, detail::restoreTerminal);
+    }
+
+    TerminalInput(const TerminalInput &) = delete;
+    TerminalInput &operator=(const TerminalInput &) = delete;
+
+    ~TerminalInput()
+    {
+        if (raw)
+            detail::restoreTerminal(0);
+    }
+
+    //! Drops what was typed so far, for a prompt that went away.
+    void discard()
+    {
+        line.clear();
+    }
+
+    //! Reads what is available, calling done for every whole line.
+    //! Returns false once the input is over.
+    bool read(const std::function<void(const std::string &)> &done)
+    {
+        char bytes[256];
+        const ssize_t size = ::read(STDIN_FILENO, bytes, sizeof(bytes));
+        if (size < 0)
+            return errno == EINTR || errno == EAGAIN;
+        if (size == 0)
+            return false;
+        for (ssize_t i = 0; i < size; ++i)
+        {
+            const char c = bytes[i];
+            if (c == '\n' || c == '\r')
+            {
+                if (raw)
+                    echo.write("\n", 1);
+                std::string whole;
+                whole.swap(line);
+                done(whole);
+            }
+            else if (raw && c == 4)
+            {
+                // Ctrl-D ends the input, as in a cooked terminal.
+                if (line.empty())
+                    return false;
+            }
+            else if (raw && (c == 127 || c == 8))
+            {
+                if (!line.empty())
+                {
+                    line.pop_back();
+                    echo.write("\b \b", 3);
+                }
+            }
+            else if (!raw || static_cast<unsigned char>(c) >= 32)
+            {
+                line += c;
+                if (raw)
+                    echo.write(&c, 1);
+            }
+        }
+        return true;
+    }
+};
+
+class Typewriter : public Sink
+{
+    //! Writes to another sink at a steady number of characters per second,
+    //! never splitting a UTF-8 character. At 0 it writes straight through.
+  private:
+    Sink &out;
+    EventLoop &loop;
+    unsigned rate = 0;
+    std::string pending;
+    std::size_t at = 0; // Bytes of pending already written.
+    std::size_t typed = 0; // Characters written since started.
+    EventLoop::Clock::time_point started;
+    EventLoop::TimerId timer = 0;
+    std::vector<std::function<void()>> waiting;
+
+    void tick()
+    {
+        const double seconds = std::chrono::duration<double>(EventLoop::Clock::now() - started).count();
+        const std::size_t due = static_cast<std::size_t>(seconds * rate);
+        std::size_t end = at;
+        for (; typed < due && end < pending.size(); ++typed)
+        {
+            ++end;
+            while (end < pending.size() && detail::continuation(pending[end]))
+            {
+                ++end;
+            }
+        }
+        out.write(pending.data() + at, end - at);
+        at = end;
+        if (at == pending.size())
+            done();
+    }
+
+    void done()
+    {
+        loop.cancel(timer);
+        timer = 0;
+        pending.clear();
+        at = 0;
+        std::vector<std::function<void()>> callbacks;
+        callbacks.swap(waiting);
+        for (const auto &callback : callbacks)
+        {
+            callback();
+        }
+    }
+
+  public:
+    Typewriter(Sink &s, EventLoop &l, unsigned charactersPerSecond = 0)
+        : out(s), loop(l), rate(charactersPerSecond) {}
+
+    Typewriter(const Typewriter &) = delete;
+    Typewriter &operator=(const Typewriter &) = delete;
+
+    //! Characters per second, 0 to write straight through. Applies to the next write.
+    void speed(unsigned charactersPerSecond)
+    {
+        finish();
+        rate = charactersPerSecond;
+    }
+
+    void write(const char *data, std::size_t size) override
+    {
+        if (rate == 0)
+        {
+            out.write(data, size);
+            return;
+        }
+        pending.append(data, size);
+        if (timer != 0)
+            return;
+        started = EventLoop::Clock::now();
+        typed = 0;
+        const int period = std::max(1, std::min<int>(TYPEWRITER_PERIOD, 1000 / rate));
+        timer = loop.every(std::chrono::milliseconds(period), [this] { tick(); });
+    }
+
+    //! Writes what is left at once.
+    void finish()
+    {
+        if (timer == 0)
+            return;
+        out.write(pending.data() + at, pending.size() - at);
+        done();
+    }
+
+    bool busy() const
+    {
+        return timer != 0;
+    }
+
+    //! Calls the task once everything written so far is out, now if it already is.
+    void whenDone(std::function<void()> task)
+    {
+        if (timer == 0)
+            task();
+        else
+            waiting.push_back(std::move(task));
+    }
+};
+
+class Console
+{
+    //! Plays a Graph in the terminal on an EventLoop. Answers are read by lines:
+    //! a number for a choice, anything for a pause. Blank lines at a choice are ignored,
+    //! lines starting with ':' go to the command handler when there is one.
+  private:
+    const Graph graph; // A view, copied: callers pass temporaries like Example::graph().
+    EventLoop loop;
+    Typewriter typewriter;
+    Layout layout;
+    Renderer renderer;
+    TerminalInput input;
+    Session session;
+    std::vector<Event> events;
+    std::function<void(int)> accepted;
+    std::function<void(const std::string &)> command;
+    EventLoop::TimerId timer = 0;
+    std::uint64_t steps = 0; // Scenes and blocks shown so far.
+    STRACE(std::string label; std::uint64_t asked = 0;)
+
+    //! Plays and renders the events of the last step, then waits for the next answer.
+    void show()
+    {
+        ++steps;
+        STRACE(label = traceLabel(graph, session));
+        {
+            STRACE_SCOPE("scene", label);
+            playSounds(graph, events);
+            renderer.render(graph, events);
+        }
+        STRACE(traceVisits(graph, events));
+        STRACE(asked = STrace::TRACE.now());
+        if (session.scene == END_SCENE)
+        {
+            typewriter.whenDone([this] { loop.stop(); });
+            return;
+        }
+        for (const auto &event : events)
+        {
+            if (event.kind == EventKind::timer)
+            {
+                const std::uint64_t step = steps;
+                const std::uint32_t ms = event.value;
+                typewriter.whenDone([this, step, ms] {
+                    // Skipped if the player answered while the text was typed.
+                    if (steps == step)
+                        timer = loop.after(std::chrono::milliseconds(ms), [this] { expire(); });
+                });
+            }
+        }
+    }
+
+    void answer(const std::string &line)
+    {
+        if (command && !line.empty() && line[0] == ':')
+        {
+            command(line.substr(1));
+            return;
+        }
+        if (session.scene == END_SCENE)
+            return;
+        const bool choice = graph.waitsChoice(session);
+        if (choice && line.find_first_not_of(" \t") == std::string::npos)
+            return;
+        STRACE(STrace::TRACE.add("input", label.data(), label.size(), asked, STrace::TRACE.now() - asked));
+        const int number = choice ? std::atoi(line.c_str()) : 0;
+        STRACE(traceAnswer(graph, session, number));
+        if (accepted && graph.accepts(session, number))
+            accepted(number);
+        loop.cancel(timer);
+        graph.step(session, number, events);
+        show();
+    }
+
+    void expire()
+    {
+        input.discard();
+        const int number = graph.expire(session, events);
+        STRACE(STrace::TRACE.mark("timeout", label));
+        if (number == 0)
+            return;
+        if (accepted)
+            accepted(number);
+        show();
+    }
+
+  public:
+    Console(const Graph &g, Sink &out, const Translation *translation = nullptr)
+        : graph(g), typewriter(out, loop), renderer(typewriter), input(out)
+    {
+        renderer.translate(translation);
+        layout.follow(STDOUT_FILENO);
+        renderer.wrap(&layout);
+    }
+
+    //! Types the text out at the rate, 0 to show it at once.
+    void typeAt(unsigned charactersPerSecond)
+    {
+        typewriter.speed(charactersPerSecond);
+    }
+
+    //! Handles the lines starting with ':', without the colon, between two steps.
+    void onCommand(std::function<void(const std::string &)> handler)
+    {
+        command = std::move(handler);
+    }
+
+    //! Plays until the story ends or the input is over. Every accepted input,
+    //! default choices included, is handed to the callback to journal it.
+    void play(Session start, std::function<void(int)> onAccepted = nullptr)
+    {
+        session = std::move(start);
+        accepted = std::move(onAccepted);
+        loop.watch(STDIN_FILENO, [this] {
+            // The key that was pressed also skips the rest of the text.
+            typewriter.finish();
+            if (!input.read([this](const std::string &line) { answer(line); }))
+            {
+                STRACE(if (session.scene != END_SCENE) STrace::TRACE.mark("quit", label));
+                loop.stop();
+            }
+        });
+        loop.every(std::chrono::milliseconds(SOUND_PUMP_PERIOD), [] { SSound::MASTER.pump(); });
+        // The loop pumps often enough to start a sound once decoded, instead of waiting for it.
+        SSound::MASTER.setDeferMisses(true);
+        graph.resume(session, events);
+        show();
+        loop.run();
+        SSound::MASTER.setDeferMisses(false);
+        renderer.flush();
+        typewriter.finish();
+    }
+
+    //! The loop the console runs on, to add timers or descriptors of the front-end.
+    EventLoop &eventLoop()
+    {
+        return loop;
+    }
+
+    //! Where play() left the story, to save it.
+    const Session &current() const
+    {
+        return session;
+    }
+};
+
+} // namespace SStory;
+
+#endif // SLoop_h
@@ -0,0 +1,654 @@
+/* smixer.h
+ * Software mixer for the SSound channels, without OpenAL.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * Mixer resamples every voice to one output rate, pans it from the position
+ * of its PlayOptions (equal power, gain 1 / distance like OpenAL) and adds it
+ * to a float bus with SSE or AVX, turned into 16 bit stereo at the end.
+ * Every kernel multiplies and then adds, in the same order for any width,
+ * so the same input renders the same bytes with or without SIMD, as long as
+ * the compiler does not fuse them: build with -ffp-contract=off, like the
+ * Makefile does, and with SSE math rather than x87.
+ *
+ * MixerBackend plays the sounds of SSound::MASTER through a Mixer into a
+ * FrameRing, read by a device callback, or renders them straight to a WAV.
+ */
+
+#ifndef SMixer_h
+#define SMixer_h
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "ssound.h"
+
+namespace SSound
+{
+
+struct Pcm
+{
+    //! Samples of a Wave as floats in [-1, 1], one plane per channel.
+    int frequency = 0;
+    std::vector<float> left;
+    std::vector<float> right; // Empty for mono.
+
+    std::size_t frames() const
+    {
+        return left.size();
+    }
+
+    bool decode(const Wave &wave)
+    {
+        return decode(wave.view());
+    }
+
+    bool decode(const WaveView &wave)
+    {
+        const std::size_t width = static_cast<std::size_t>(wave.bits / 8 * wave.channels);
+        if (width == 0 || wave.frequency <= 0)
+            return false;
+        const std::size_t count = wave.size / width;
+        frequency = wave.frequency;
+        left.resize(count);
+        right.resize(wave.channels == 2 ? count : 0);
+        const unsigned char *at = reinterpret_cast<const unsigned char *>(wave.data);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            left[i] = value(at, wave.bits);
+            at += wave.bits / 8;
+            if (wave.channels == 2)
+            {
+                right[i] = value(at, wave.bits);
+                at += wave.bits / 8;
+            }
+        }
+        return true;
+    }
+
+  private:
+    static float value(const unsigned char *at, int bits)
+    {
+        if (bits == 8)
+            return (static_cast<int>(at[0]) - 128) / 128.0f;
+        return static_cast<std::int16_t>(at[0] | (at[1] << 8)) / 32768.0f;
+    }
+};
+
+namespace detail
+{
+
+//! out[i] += in[i] * gain
+inline void accumulate(float *out, const float *in, float gain, std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__AVX__)
+    const __m256 g8 = _mm256_set1_ps(gain);
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 v = _mm256_mul_ps(_mm256_loadu_ps(in + i), g8);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), v));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128 g4 = _mm_set1_ps(gain);
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128 v = _mm_mul_ps(_mm_loadu_ps(in + i), g4);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), v));
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        out[i] += in[i] * gain;
+    }
+}
+
+//! out[i] += in[i] * (gain + slope * i), a gain moving linearly across the frames.
+inline void ramp(float *out, const float *in, float gain, float slope, std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__AVX__)
+    const __m256 g8 = _mm256_set1_ps(gain);
+    const __m256 s8 = _mm256_set1_ps(slope);
+    const __m256 lanes8 = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 at = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lanes8);
+        const __m256 g = _mm256_add_ps(g8, _mm256_mul_ps(s8, at));
+        const __m256 v = _mm256_mul_ps(_mm256_loadu_ps(in + i), g);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), v));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128 g4 = _mm_set1_ps(gain);
+    const __m128 s4 = _mm_set1_ps(slope);
+    const __m128 lanes4 = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128 at = _mm_add_ps(_mm_set1_ps(static_cast<float>(i)), lanes4);
+        const __m128 g = _mm_add_ps(g4, _mm_mul_ps(s4, at));
+        const __m128 v = _mm_mul_ps(_mm_loadu_ps(in + i), g);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), v));
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        const float g = gain + slope * static_cast<float>(i);
+        out[i] += in[i] * g;
+    }
+}
+
+//! Clamps both planes to [-1, 1] and writes them as interleaved 16 bit stereo,
+//! rounding to nearest even like the SSE conversion does.
+inline void interleave(std::int16_t *out, const float *left, const float *right, std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    const __m128 hi = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128 l = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(left + i), lo), hi), scale);
+        const __m128 r = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(right + i), lo), hi), scale);
+        const __m128i li = _mm_cvtps_epi32(l);
+        const __m128i ri = _mm_cvtps_epi32(r);
+        const __m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(li, ri), _mm_unpackhi_epi32(li, ri));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * i), packed);
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        out[2 * i] = static_cast<std::int16_t>(std::lrintf(std::min(std::max(left[i], -1.0f), 1.0f) * 32767.0f));
+        out[2 * i + 1] = static_cast<std::int16_t>(std::lrintf(std::min(std::max(right[i], -1.0f), 1.0f) * 32767.0f));
+    }
+}
+
+} // namespace detail
+
+constexpr std::size_t MIX_BLOCK = 256; // Frames mixed at once, fades ramp across each block.
+
+class Mixer
+{
+    //! Mixes up to a fixed number of voices into 16 bit stereo at one rate.
+    //! play() and stop() may run on another thread than mix().
+  private:
+    struct Voice
+    {
+        std::shared_ptr<const Pcm> pcm; // Null when the voice is free.
+        std::uint64_t at = 0;   // Source frame, 32.32 fixed point.
+        std::uint64_t step = 0; // Source frames per output frame, 32.32 fixed point.
+        float gainLeft = 0.0f;
+        float gainRight = 0.0f;
+        float fade = 1.0f;
+        float fadeStep = 0.0f;  // Added to fade every block, the voice ends when fade reaches 0.
+        bool loop = false;
+        int group = -1;
+        int priority = 0;
+        std::uint64_t started = 0;
+    };
+
+    int rate;
+    std::vector<Voice> voices;
+    float crossfade = 1.5f;
+    std::uint64_t plays = 0;
+    std::atomic<std::uint64_t> mixed;
+    std::mutex lock;
+
+    float left[MIX_BLOCK];
+    float right[MIX_BLOCK];
+    float sourceLeft[MIX_BLOCK];
+    float sourceRight[MIX_BLOCK];
+
+    float fadeStep() const
+    {
+        return crossfade > 0.0f ? static_cast<float>(MIX_BLOCK) / (crossfade * rate) : 1.0f;
+    }
+
+    //! A free voice, else the lowest priority and oldest one. -1 if every voice outranks it.
+    int allocate(const PlayOptions &options) const
+    {
+        int victim = -1;
+        for (std::size_t i = 0; i < voices.size(); ++i)
+        {
+            const Voice &voice = voices[i];
+            if (!voice.pcm)
+                return static_cast<int>(i);
+            if (victim < 0 || voice.priority < voices[victim].priority ||
+                (voice.priority == voices[victim].priority && voice.started < voices[victim].started))
+                victim = static_cast<int>(i);
+        }
+        if (victim >= 0 && voices[victim].priority > options.priority)
+            return -1;
+        return victim;
+    }
+
+    //! Linear interpolation of the voice into sourceLeft and sourceRight.
+    //! Returns the frames written, fewer than n once a sound without loop ends.
+    std::size_t resample(Voice &voice, std::size_t n)
+    {
+        const Pcm &pcm = *voice.pcm;
+        const std::uint64_t frames = pcm.frames();
+        const std::uint64_t end = frames << 32;
+        const bool stereo = !pcm.right.empty();
+        std::size_t i = 0;
+        if (voice.step == 1ull << 32)
+        {
+            while (i < n && voice.at < end)
+            {
+                const std::size_t from = static_cast<std::size_t>(voice.at >> 32);
+                const std::size_t count = std::min<std::size_t>(n - i, frames - from);
+                std::copy(pcm.left.data() + from, pcm.left.data() + from + count, sourceLeft + i);
+                if (stereo)
+                    std::copy(pcm.right.data() + from, pcm.right.data() + from + count, sourceRight + i);
+                i += count;
+                voice.at += static_cast<std::uint64_t>(count) << 32;
+                if (voice.at >= end && voice.loop)
+                    voice.at -= end;
+            }
+            return i;
+        }
+        for (; i < n && voice.at < end; ++i)
+        {
+            const std::size_t a = static_cast<std::size_t>(voice.at >> 32);
+            std::size_t b = a + 1;
+            if (b == frames)
+                b = voice.loop ? 0 : a;
+            const float t = static_cast<float>(voice.at & 0xFFFFFFFFull) * (1.0f / 4294967296.0f);
+            sourceLeft[i] = pcm.left[a] + (pcm.left[b] - pcm.left[a]) * t;
+            if (stereo)
+                sourceRight[i] = pcm.right[a] + (pcm.right[b] - pcm.right[a]) * t;
+            voice.at += voice.step;
+            if (voice.at >= end && voice.loop)
+                voice.at -= end;
+        }
+        return i;
+    }
+
+    void mixBlock(std::int16_t *out, std::size_t n)
+    {
+        std::fill(left, left + n, 0.0f);
+        std::fill(right, right + n, 0.0f);
+        for (auto &voice : voices)
+        {
+            if (!voice.pcm)
+                continue;
+            const std::size_t count = resample(voice, n);
+            const float *r = voice.pcm->right.empty() ? sourceLeft : sourceRight;
+            const float next = std::max(0.0f, std::min(1.0f, voice.fade + voice.fadeStep));
+            if (next == voice.fade)
+            {
+                detail::accumulate(left, sourceLeft, voice.gainLeft * voice.fade, count);
+                detail::accumulate(right, r, voice.gainRight * voice.fade, count);
+            }
+            else
+            {
+                // Fades move sample by sample, so stopping or replacing a voice never clicks.
+                const float slope = (next - voice.fade) / static_cast<float>(n);
+                detail::ramp(left, sourceLeft, voice.gainLeft * voice.fade, voice.gainLeft * slope, count);
+                detail::ramp(right, r, voice.gainRight * voice.fade, voice.gainRight * slope, count);
+            }
+            voice.fade = next;
+            if (count < n || voice.fade <= 0.0f)
+                voice = Voice();
+        }
+        detail::interleave(out, left, right, n);
+        mixed += n;
+    }
+
+  public:
+    explicit Mixer(int frequency = 44100, std::size_t count = 32)
+        : rate(frequency), voices(count), mixed(0) {}
+
+    int frequency() const
+    {
+        return rate;
+    }
+
+    //! Seconds of crossfade between voices of the same group.
+    void setCrossfade(float seconds)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        crossfade = seconds;
+    }
+
+    //! Starts the sound on a voice, returns it or -1 if every voice is busy with something more important.
+    int play(const std::shared_ptr<const Pcm> &pcm, const PlayOptions &options)
+    {
+        if (!pcm || pcm->frames() == 0)
+            return -1;
+        std::lock_guard<std::mutex> guard(lock);
+        bool replaces = false;
+        if (options.group >= 0)
+        {
+            for (auto &voice : voices)
+            {
+                if (voice.pcm && voice.group == options.group && voice.fadeStep >= 0.0f)
+                {
+                    voice.fadeStep = -fadeStep();
+                    replaces = true;
+                }
+            }
+        }
+        const int index = allocate(options);
+        if (index < 0)
+            return -1;
+
+        const Point &p = options.position;
+        const float distance = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+        const float pan = distance > 0.0f ? p.x / distance : 0.0f;
+        const float angle = (pan + 1.0f) * 0.78539816f;
+        const float gain = options.gain / std::max(1.0f, distance);
+
+        Voice &voice = voices[index];
+        voice = Voice();
+        voice.pcm = pcm;
+        voice.step = (static_cast<std::uint64_t>(pcm->frequency) << 32) / static_cast<std::uint64_t>(rate);
+        voice.gainLeft = gain * std::cos(angle);
+        voice.gainRight = gain * std::sin(angle);
+        voice.loop = options.loop;
+        voice.group = options.group;
+        voice.priority = options.priority;
+        voice.started = ++plays;
+        if (replaces)
+        {
+            voice.fade = 0.0f;
+            voice.fadeStep = fadeStep();
+        }
+        return index;
+    }
+
+    //! Fades the voice out across the next block, then frees it.
+    void stop(int voice)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (voice >= 0 && static_cast<std::size_t>(voice) < voices.size() && voices[voice].pcm)
+            voices[voice].fadeStep = -1.0f;
+    }
+
+    //! Writes frames of interleaved 16 bit stereo, silence when nothing plays.
+    void mix(std::int16_t *out, std::size_t frames)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (std::size_t done = 0; done < frames; done += MIX_BLOCK)
+        {
+            mixBlock(out + 2 * done, std::min(MIX_BLOCK, frames - done));
+        }
+    }
+
+    //! Frames mixed so far.
+    std::uint64_t position() const
+    {
+        return mixed;
+    }
+
+    std::size_t playing()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return static_cast<std::size_t>(
+            std::count_if(voices.begin(), voices.end(), [](const Voice &voice) { return voice.pcm != nullptr; }));
+    }
+};
+
+class FrameRing
+{
+    //! Single producer, single consumer queue of stereo frames, without locks.
+  private:
+    std::vector<std::int16_t> data;
+    std::size_t mask;
+    std::atomic<std::size_t> head; // Next frame read.
+    std::atomic<std::size_t> tail; // Next frame written.
+
+  public:
+    //! Capacity is rounded up to a power of two.
+    explicit FrameRing(std::size_t frames = 8192)
+        : head(0), tail(0)
+    {
+        std::size_t capacity = 1;
+        while (capacity < frames)
+            capacity <<= 1;
+        data.resize(2 * capacity);
+        mask = capacity - 1;
+    }
+
+    std::size_t space() const
+    {
+        return mask + 1 - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+    }
+
+    std::size_t available() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);
+    }
+
+    //! Producer side, writes at most space() frames and returns how many.
+    std::size_t write(const std::int16_t *frames, std::size_t count)
+    {
+        const std::size_t at = tail.load(std::memory_order_relaxed);
+        count = std::min(count, space());
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            data[2 * ((at + i) & mask)] = frames[2 * i];
+            data[2 * ((at + i) & mask) + 1] = frames[2 * i + 1];
+        }
+        tail.store(at + count, std::memory_order_release);
+        return count;
+    }
+
+    //! Consumer side, pads with silence when the producer fell behind. Returns the frames really read.
+    std::size_t read(std::int16_t *frames, std::size_t count)
+    {
+        const std::size_t at = head.load(std::memory_order_relaxed);
+        const std::size_t ready = std::min(count, available());
+        for (std::size_t i = 0; i < ready; ++i)
+        {
+            frames[2 * i] = data[2 * ((at + i) & mask)];
+            frames[2 * i + 1] = data[2 * ((at + i) & mask) + 1];
+        }
+        std::fill(frames + 2 * ready, frames + 2 * count, 0);
+        head.store(at + ready, std::memory_order_release);
+        return ready;
+    }
+};
+
+class WavWriter
+{
+    //! 16 bit stereo WAV file, the sizes in the header are written by close().
+  private:
+    std::ofstream out;
+    std::uint32_t bytes = 0;
+
+    void put(std::uint32_t v, int size)
+    {
+        for (int i = 0; i < size; ++i)
+        {
+            out.put(static_cast<char>((v >> (8 * i)) & 0xFF));
+        }
+    }
+
+  public:
+    WavWriter() {}
+    WavWriter(const WavWriter &) = delete;
+    WavWriter &operator=(const WavWriter &) = delete;
+
+    ~WavWriter()
+    {
+        close();
+    }
+
+    bool open(const std::string &path, int frequency)
+    {
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            std::cerr << "SSound(EE): cannot write " << path << '\n';
+            return false;
+        }
+        bytes = 0;
+        out.write("RIFF\0\0\0\0WAVEfmt ", 16);
+        put(16, 4);
+        put(1, 2); // PCM
+        put(2, 2);
+        put(static_cast<std::uint32_t>(frequency), 4);
+        put(static_cast<std::uint32_t>(frequency) * 4, 4);
+        put(4, 2);
+        put(16, 2);
+        out.write("data\0\0\0\0", 8);
+        return static_cast<bool>(out);
+    }
+
+    void write(const std::int16_t *frames, std::size_t count)
+    {
+        char block[4 * MIX_BLOCK];
+        for (std::size_t done = 0; done < count; done += MIX_BLOCK)
+        {
+            const std::size_t n = std::min(MIX_BLOCK, count - done);
+            for (std::size_t i = 0; i < 2 * n; ++i)
+            {
+                const std::uint16_t v = static_cast<std::uint16_t>(frames[2 * done + i]);
+                block[2 * i] = static_cast<char>(v & 0xFF);
+                block[2 * i + 1] = static_cast<char>(v >> 8);
+            }
+            out.write(block, static_cast<std::streamsize>(4 * n));
+        }
+        bytes += static_cast<std::uint32_t>(4 * count);
+    }
+
+    bool close()
+    {
+        if (!out.is_open())
+            return true;
+        out.seekp(4);
+        put(36 + bytes, 4);
+        out.seekp(40);
+        put(bytes, 4);
+        const bool ok = static_cast<bool>(out.flush());
+        out.close();
+        return ok;
+    }
+};
+
+class MixerBackend : public Backend
+{
+    //! Plays the sounds with a Mixer. pump() keeps the ring full, an audio callback
+    //! drains it with read(). Samples are decoded whole the first time they are played,
+    //! from the pack of ASSETS or from the directory given. A missing file plays silence
+    //! and is reported once.
+  private:
+    Mixer engine;
+    FrameRing ring;
+    std::mutex lock; // Guards samples and failed, play() and prefetch() may come from several threads.
+    std::shared_ptr<const Pcm> samples[SAMPLE_COUNT];
+    bool failed[SAMPLE_COUNT] = {};
+    std::string base;
+
+    std::shared_ptr<const Pcm> load(Sample sound)
+    {
+        const int sample = static_cast<int>(sound);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (samples[sample] || failed[sample])
+                return samples[sample];
+        }
+        // Decoded unlocked, a sample decoded twice at once keeps the first one stored.
+        STRACE_SCOPE("decode", file(sound));
+        const std::string path = base.empty() ? ASSETS.path(sound) : base + file(sound);
+        Wave wave;
+        WaveView packed;
+        std::shared_ptr<Pcm> pcm(new Pcm);
+        const bool decoded = base.empty() && ASSETS.packed(sound, packed) ? pcm->decode(packed)
+                                                                          : wave.load(path) && pcm->decode(wave);
+        std::lock_guard<std::mutex> guard(lock);
+        if (samples[sample] || failed[sample])
+            return samples[sample];
+        if (decoded)
+        {
+            samples[sample] = pcm;
+        }
+        else
+        {
+            failed[sample] = true;
+            std::cerr << "SSound(EE): cannot read " << path << '\n';
+        }
+        return samples[sample];
+    }
+
+  public:
+    //! Without a path, samples come from SSound::ASSETS.
+    explicit MixerBackend(int frequency = 44100, std::string path = std::string(), std::size_t ringFrames = 8192)
+        : engine(frequency), ring(ringFrames), base(std::move(path)) {}
+
+    Mixer &mixer()
+    {
+        return engine;
+    }
+
+    int play(Sample sound, const PlayOptions &options) override
+    {
+        return engine.play(load(sound), options);
+    }
+
+    void stop(int voice) override
+    {
+        engine.stop(voice);
+    }
+
+    void prefetch(Sample sound) override
+    {
+        load(sound);
+    }
+
+    void pump() override
+    {
+        fill();
+    }
+
+    //! Mixes until the ring is full.
+    void fill()
+    {
+        std::int16_t block[2 * MIX_BLOCK];
+        for (std::size_t n = std::min(ring.space(), MIX_BLOCK); n > 0; n = std::min(ring.space(), MIX_BLOCK))
+        {
+            engine.mix(block, n);
+            ring.write(block, n);
+        }
+    }
+
+    //! For the audio callback: takes mixed frames, silence if there are not enough.
+    std::size_t read(std::int16_t *frames, std::size_t count)
+    {
+        return ring.read(frames, count);
+    }
+
+    //! Offline: mixes the next frames straight into a WAV, as fast as the CPU goes.
+    void render(WavWriter &out, std::size_t frames)
+    {
+        std::int16_t block[2 * MIX_BLOCK];
+        for (std::size_t done = 0; done < frames; done += MIX_BLOCK)
+        {
+            const std::size_t n = std::min(MIX_BLOCK, frames - done);
+            engine.mix(block, n);
+            out.write(block, n);
+        }
+    }
+};
+
+} // namespace SSound;
+
+#endif // SMixer_h
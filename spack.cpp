@@ -0,0 +1,122 @@
+/* spack.cpp
+ * Bundles the sounds of a game in one pack, see spack.h.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ *   spack pack sounds.sspk sounds/ [name=file.wav ...]
+ *
+ * decodes the file of every SSound::Sample in the directory, then every extra
+ * sample given, into a pack ExGame plays when it finds it next to itself.
+ * Samples that are missing or not 8 or 16 bit PCM are played from their files
+ * as before. Those of SSound::Sample keep an empty entry, so the id of every
+ * one of them is still the value of the enum.
+ *
+ *   spack list sounds.sspk
+ *
+ * checks every sample of a pack and prints its id, name and format.
+ */
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ssound.h"
+
+static int pack(const std::string &path, std::string directory, const std::vector<std::string> &extras)
+{
+    if (!directory.empty() && directory.back() != '/')
+        directory += '/';
+    std::vector<std::pair<std::string, std::string>> files;
+    for (int i = 0; i < SSound::SAMPLE_COUNT; ++i)
+    {
+        const SSound::Sample sample = static_cast<SSound::Sample>(i);
+        files.emplace_back(SSound::name(sample), directory + SSound::file(sample));
+    }
+    for (const auto &extra : extras)
+    {
+        const std::size_t equals = extra.find('=');
+        if (equals == std::string::npos || equals == 0)
+        {
+            std::cerr << "Expected name=file.wav, not " << extra << '\n';
+            return 2;
+        }
+        files.emplace_back(extra.substr(0, equals), extra.substr(equals + 1));
+    }
+
+    std::vector<std::unique_ptr<SSound::Wave>> waves;
+    std::vector<std::pair<std::string, SSound::WaveView>> samples;
+    std::set<std::string> names;
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+        const auto &item = files[i];
+        if (!names.insert(item.first).second)
+        {
+            std::cerr << "Pack(EE): " << item.first << " is given twice\n";
+            return 1;
+        }
+        std::unique_ptr<SSound::Wave> wave(new SSound::Wave);
+        if (!wave->load(item.second))
+        {
+            std::cerr << "Pack(WW): " << item.second << " left out, missing or not 8 or 16 bit PCM\n";
+            if (i < static_cast<std::size_t>(SSound::SAMPLE_COUNT))
+                samples.emplace_back(item.first, SSound::WaveView());
+            continue;
+        }
+        samples.emplace_back(item.first, wave->view());
+        bytes += wave->data.size();
+        waves.push_back(std::move(wave));
+    }
+    if (!SSound::savePack(samples, path))
+    {
+        std::cerr << "Cannot write " << path << '\n';
+        return 1;
+    }
+    std::cout << waves.size() << " samples, " << bytes << " bytes of PCM written to " << path << '\n';
+    return 0;
+}
+
+static int list(const std::string &path)
+{
+    SSound::SoundPack samples;
+    if (!samples.open(path))
+        return 1;
+    if (!samples.verify())
+    {
+        std::cerr << "Pack(EE): " << path << ": corrupted samples\n";
+        return 1;
+    }
+    char line[128];
+    for (std::uint32_t id = 0; id < samples.size(); ++id)
+    {
+        if (!samples.has(id))
+        {
+            std::snprintf(line, sizeof(line), "%4u %-20s missing\n", id, samples.name(id).c_str());
+            std::cout << line;
+            continue;
+        }
+        const SSound::WaveView wave = samples.wave(id);
+        const double seconds = static_cast<double>(wave.size) / (wave.bits / 8 * wave.channels) / wave.frequency;
+        std::snprintf(line, sizeof(line), "%4u %-20s %d ch %2d bit %6d Hz %8.2f s %10zu bytes\n", id,
+                      samples.name(id).c_str(), wave.channels, wave.bits, wave.frequency, seconds, wave.size);
+        std::cout << line;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const std::string command = argc > 1 ? argv[1] : "";
+    if (argc >= 4 && command == "pack")
+        return pack(argv[2], argv[3], std::vector<std::string>(argv + 4, argv + argc));
+    if (argc == 3 && command == "list")
+        return list(argv[2]);
+    std::cerr << "Usage: " << argv[0] << " pack sounds.sspk sounds/ [name=file.wav ...]\n"
+              << "       " << argv[0] << " list sounds.sspk\n";
+    return 2;
+}
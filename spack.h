@@ -0,0 +1,364 @@
+/* spack.h
+ * Sound pack: every sample in one file, already decoded to PCM.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * A pack is mapped read only and played straight from the mapping, so
+ * loading the sounds of a game is one open and one mmap, and a sample costs
+ * the page cache reads of its bytes the first time it plays. Layout, every
+ * field little endian:
+ *
+ *   PackHeader
+ *   PackEntry     entries[nEntries]  (by id)
+ *   std::uint32_t byName[nEntries]   (ids sorted by name)
+ *   char          names[namesSize]   (not null terminated)
+ *   PCM data, every sample at a multiple of PACK_ALIGN
+ *
+ * The checksum covers the entries, the index and the names, and is checked on
+ * open. The PCM data has its own checksum, only checked by verify(). Packs
+ * made by spack keep the samples of SSound::Sample first, in their order, with
+ * an empty entry (no channels, no data) for each one missing, so their id is
+ * the value of the enum. find() never returns an empty entry.
+ */
+
+#ifndef SPack_h
+#define SPack_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SSound
+{
+
+constexpr std::uint32_t PACK_VERSION = 1;
+//! Alignment of the PCM data of every sample in a pack.
+constexpr std::size_t PACK_ALIGN = 64;
+
+struct PackHeader
+{
+    char magic[4]; // "SSPK"
+    std::uint32_t version;
+    std::uint32_t checksum;     // Entries, index and names.
+    std::uint32_t dataChecksum; // Everything after the names.
+    std::uint32_t nEntries;
+    std::uint32_t namesSize;
+    std::uint64_t size; // Of the whole file.
+};
+
+struct PackEntry
+{
+    std::uint32_t name; // Offset in names.
+    std::uint32_t nameSize;
+    std::uint32_t frequency;
+    std::uint16_t channels;
+    std::uint16_t bits;
+    std::uint64_t offset; // From the start of the file.
+    std::uint64_t size;
+};
+
+static_assert(sizeof(PackHeader) == 32 && sizeof(PackEntry) == 32, "The pack layout must not depend on the compiler");
+
+struct WaveView
+{
+    //! PCM data owned by someone else, a Wave or a SoundPack.
+    int channels = 0;
+    int bits = 0;
+    int frequency = 0;
+    const char *data = nullptr;
+    std::size_t size = 0;
+};
+
+namespace detail
+{
+
+//! FNV-1a, the checksum of every SStory file.
+inline std::uint32_t fnv1a(const char *data, std::size_t size, std::uint32_t hash = 2166136261u)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+} // namespace detail
+
+//! Writes a pack of the samples, in that order, returns false if the file could not be written.
+//! Names must be unique. A sample without channels is written as an empty entry.
+inline bool savePack(const std::vector<std::pair<std::string, WaveView>> &samples, const std::string &path)
+{
+    const std::uint32_t count = static_cast<std::uint32_t>(samples.size());
+    std::vector<PackEntry> entries;
+    std::vector<std::uint32_t> byName(count);
+    std::string names;
+    for (std::uint32_t i = 0; i < count; ++i)
+    {
+        const WaveView &wave = samples[i].second;
+        entries.push_back(PackEntry{static_cast<std::uint32_t>(names.size()),
+                                    static_cast<std::uint32_t>(samples[i].first.size()),
+                                    static_cast<std::uint32_t>(wave.frequency), static_cast<std::uint16_t>(wave.channels),
+                                    static_cast<std::uint16_t>(wave.bits), 0, wave.size});
+        names += samples[i].first;
+        byName[i] = i;
+    }
+    std::sort(byName.begin(), byName.end(),
+              [&samples](std::uint32_t a, std::uint32_t b) { return samples[a].first < samples[b].first; });
+
+    std::uint64_t at = sizeof(PackHeader) + count * (sizeof(PackEntry) + sizeof(std::uint32_t)) + names.size();
+    const std::uint64_t dataStart = at;
+    for (auto &entry : entries)
+    {
+        at = (at + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+        entry.offset = at;
+        at += entry.size;
+    }
+
+    PackHeader header = {{'S', 'S', 'P', 'K'}, PACK_VERSION, 0, 2166136261u, count,
+                         static_cast<std::uint32_t>(names.size()), at};
+    header.checksum = detail::fnv1a(reinterpret_cast<const char *>(entries.data()), count * sizeof(PackEntry));
+    header.checksum = detail::fnv1a(reinterpret_cast<const char *>(byName.data()), count * sizeof(std::uint32_t),
+                                    header.checksum);
+    header.checksum = detail::fnv1a(names.data(), names.size(), header.checksum);
+
+    // Padding is part of the data checksum, it is written as zeros.
+    std::string padding;
+    std::uint64_t written = dataStart;
+    for (std::uint32_t i = 0; i < count; ++i)
+    {
+        padding.assign(entries[i].offset - written, '\0');
+        header.dataChecksum = detail::fnv1a(padding.data(), padding.size(), header.dataChecksum);
+        header.dataChecksum = detail::fnv1a(samples[i].second.data, samples[i].second.size, header.dataChecksum);
+        written = entries[i].offset + entries[i].size;
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()), count * sizeof(PackEntry));
+    out.write(reinterpret_cast<const char *>(byName.data()), count * sizeof(std::uint32_t));
+    out.write(names.data(), names.size());
+    written = dataStart;
+    for (std::uint32_t i = 0; i < count; ++i)
+    {
+        padding.assign(entries[i].offset - written, '\0');
+        out.write(padding.data(), padding.size());
+        out.write(samples[i].second.data, samples[i].second.size);
+        written = entries[i].offset + entries[i].size;
+    }
+    return static_cast<bool>(out.flush());
+}
+
+class SoundPack
+{
+    //! A pack mapped read only, samples are looked up by id or by name.
+  private:
+    const char *base = nullptr;
+    std::size_t length = 0;
+
+    const PackHeader &header() const
+    {
+        return *reinterpret_cast<const PackHeader *>(base);
+    }
+
+    const PackEntry *entries() const
+    {
+        return reinterpret_cast<const PackEntry *>(base + sizeof(PackHeader));
+    }
+
+    const std::uint32_t *byName() const
+    {
+        return reinterpret_cast<const std::uint32_t *>(entries() + header().nEntries);
+    }
+
+    const char *names() const
+    {
+        return reinterpret_cast<const char *>(byName() + header().nEntries);
+    }
+
+    std::size_t tableSize() const
+    {
+        return header().nEntries * (sizeof(PackEntry) + sizeof(std::uint32_t)) + header().namesSize;
+    }
+
+    void fail(const std::string &path, const char *message)
+    {
+        std::cerr << "SSound(EE): " << path << ": " << message << '\n';
+        close();
+    }
+
+    //! Every offset of the table, so lookups never leave the mapping.
+    bool validTable() const
+    {
+        const PackEntry *e = entries();
+        const std::uint32_t count = header().nEntries;
+        const std::uint64_t dataStart = sizeof(PackHeader) + tableSize();
+        for (std::uint32_t i = 0; i < count; ++i)
+        {
+            const bool empty = e[i].channels == 0 && e[i].bits == 0 && e[i].frequency == 0 && e[i].size == 0;
+            if (std::uint64_t(e[i].name) + e[i].nameSize > header().namesSize || byName()[i] >= count ||
+                e[i].offset < dataStart || e[i].offset % PACK_ALIGN != 0 || e[i].offset > length ||
+                e[i].size > length - e[i].offset)
+                return false;
+            if (!empty && ((e[i].channels != 1 && e[i].channels != 2) || (e[i].bits != 8 && e[i].bits != 16) ||
+                           e[i].frequency == 0))
+                return false;
+        }
+        for (std::uint32_t i = 1; i < count; ++i)
+        {
+            if (name(byName()[i - 1]) >= name(byName()[i]))
+                return false;
+        }
+        return true;
+    }
+
+  public:
+    SoundPack() {}
+    SoundPack(const SoundPack &) = delete;
+    SoundPack &operator=(const SoundPack &) = delete;
+
+    ~SoundPack()
+    {
+        close();
+    }
+
+    //! Maps the file and checks its table, the PCM data is not read.
+    bool open(const std::string &path)
+    {
+        close();
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "SSound(EE): cannot open " << path << '\n';
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) >= sizeof(PackHeader))
+        {
+            void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                base = static_cast<const char *>(mapped);
+                length = info.st_size;
+            }
+        }
+        ::close(fd);
+        if (base == nullptr)
+        {
+            std::cerr << "SSound(EE): cannot map " << path << '\n';
+            return false;
+        }
+
+        const PackHeader &h = header();
+        if (std::memcmp(h.magic, "SSPK", 4) != 0)
+        {
+            fail(path, "not a sound pack");
+            return false;
+        }
+        if (h.version != PACK_VERSION)
+        {
+            fail(path, "unsupported version");
+            return false;
+        }
+        if (h.size != length || sizeof(PackHeader) + std::uint64_t(h.nEntries) * (sizeof(PackEntry) + sizeof(std::uint32_t)) + h.namesSize > length)
+        {
+            fail(path, "truncated file");
+            return false;
+        }
+        if (detail::fnv1a(base + sizeof(PackHeader), tableSize()) != h.checksum || !validTable())
+        {
+            fail(path, "corrupted table");
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (base != nullptr)
+            munmap(const_cast<char *>(base), length);
+        base = nullptr;
+        length = 0;
+    }
+
+    bool isOpen() const
+    {
+        return base != nullptr;
+    }
+
+    //! Reads every sample to check its data, meant for untrusted files.
+    bool verify() const
+    {
+        const std::size_t dataStart = sizeof(PackHeader) + tableSize();
+        return base != nullptr && detail::fnv1a(base + dataStart, length - dataStart) == header().dataChecksum;
+    }
+
+    std::uint32_t size() const
+    {
+        return base == nullptr ? 0 : header().nEntries;
+    }
+
+    std::string name(std::uint32_t id) const
+    {
+        return std::string(names() + entries()[id].name, entries()[id].nameSize);
+    }
+
+    //! False for the empty entries standing for samples missing when the pack was made.
+    bool has(std::uint32_t id) const
+    {
+        return id < size() && entries()[id].channels != 0;
+    }
+
+    //! Id of the sample, -1 if the pack has none by that name or only an empty entry.
+    int find(const std::string &sample) const
+    {
+        if (base == nullptr)
+            return -1;
+        const std::uint32_t *first = byName();
+        const std::uint32_t *last = first + header().nEntries;
+        const std::uint32_t *found = std::lower_bound(first, last, sample, [this](std::uint32_t id, const std::string &s) {
+            const PackEntry &e = entries()[id];
+            return s.compare(0, std::string::npos, names() + e.name, e.nameSize) > 0;
+        });
+        if (found == last || name(*found) != sample || !has(*found))
+            return -1;
+        return static_cast<int>(*found);
+    }
+
+    //! PCM of the sample, valid while the pack stays open. Empty for an empty entry.
+    WaveView wave(std::uint32_t id) const
+    {
+        const PackEntry &e = entries()[id];
+        WaveView view;
+        view.channels = e.channels;
+        view.bits = e.bits;
+        view.frequency = static_cast<int>(e.frequency);
+        view.data = base + e.offset;
+        view.size = static_cast<std::size_t>(e.size);
+        return view;
+    }
+
+    //! Asks the kernel to read the sample ahead, before it plays.
+    void willNeed(std::uint32_t id) const
+    {
+        const PackEntry &e = entries()[id];
+        const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const std::size_t start = static_cast<std::size_t>(e.offset) / page * page;
+        madvise(const_cast<char *>(base) + start, static_cast<std::size_t>(e.offset + e.size) - start, MADV_WILLNEED);
+    }
+};
+
+} // namespace SSound;
+
+#endif // SPack_h
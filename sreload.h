@@ -0,0 +1,530 @@
+/* sreload.h
+ * Live reload of a story script while it is being played.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * LiveStory watches a script with inotify. When it is saved, only the scenes
+ * whose text changed are parsed again, the story is rebuilt from the parsed
+ * scenes, compiled and published as a new StoryVersion with one atomic store.
+ * Only parsing is incremental: choices point at scene ids, which move when a
+ * scene is added or removed, so every reload compiles the whole story again.
+ * A script with errors or undefined labels is never published.
+ *
+ * Every LiveSession announces the serial of the version it plays on. A version
+ * is freed once it is older than every announced serial, so a session always
+ * steps on a whole graph, never a half built one. Between steps update() moves
+ * the session to the latest version: the scene is found again by its label and
+ * the variables by their name. A session on a deleted scene starts the story over,
+ * with the initial values of the variables.
+ */
+
+#ifndef SReload_h
+#define SReload_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "sbinary.h"
+#include "sscript.h"
+#include "sstory.h"
+
+namespace SStory
+{
+
+//! Serial announced by a LiveSession that protects no version.
+constexpr std::uint64_t NO_VERSION = ~0ull;
+
+struct ScriptScene
+{
+    //! A scene as read from a script, before it goes into a Story.
+    std::string label;
+    std::vector<ContentBody> blocks;
+};
+
+namespace detail
+{
+
+class SceneCollector : public ScriptReader
+{
+    //! Keeps what it reads instead of adding it to a story.
+  public:
+    std::vector<ScriptScene> scenes;
+    std::vector<std::pair<std::string, std::int32_t>> variables;
+
+  protected:
+    void addScene(std::string l, std::vector<ContentBody> blocks) override
+    {
+        scenes.push_back(ScriptScene{std::move(l), std::move(blocks)});
+    }
+
+    void addVariable(const std::string &name, std::int32_t value) override
+    {
+        variables.emplace_back(name, value);
+    }
+};
+
+} // namespace detail
+
+class ScriptCache
+{
+    //! A script cut in pieces, one per scene plus what comes before the first one.
+    //! A piece is parsed the first time its text is seen and reused while it stays the same.
+  private:
+    struct Piece
+    {
+        std::vector<ScriptScene> scenes;
+        std::vector<std::pair<std::string, std::int32_t>> variables;
+    };
+
+    std::unordered_map<std::uint64_t, std::shared_ptr<const Piece>> pieces; // By hash of the text.
+
+    static bool startsScene(const std::string &text, std::size_t at)
+    {
+        at = text.find_first_not_of(" \t", at);
+        return at != std::string::npos && text.compare(at, 6, "scene ") == 0;
+    }
+
+  public:
+    std::size_t parsed = 0; // Pieces parsed again by the last build().
+    std::size_t total = 0;  // Pieces of the script.
+
+    //! Adds the whole script to the story, parsing only the pieces that changed.
+    //! Returns false, and keeps the previous pieces, if some piece has errors.
+    bool build(const std::string &text, Story &story)
+    {
+        std::vector<std::pair<std::uint64_t, std::shared_ptr<const Piece>>> order;
+        std::unordered_map<std::uint64_t, std::shared_ptr<const Piece>> next;
+        parsed = 0;
+        bool ok = true;
+        int line = 0;
+        std::size_t begin = 0;
+        while (begin < text.size())
+        {
+            // A piece runs up to the next line starting a scene.
+            std::size_t end = text.find('\n', begin);
+            int lines = 1;
+            while (end != std::string::npos && end + 1 < text.size() && !startsScene(text, end + 1))
+            {
+                end = text.find('\n', end + 1);
+                ++lines;
+            }
+            end = end == std::string::npos ? text.size() : end + 1;
+
+            const std::uint64_t h = hash64(text.data() + begin, end - begin);
+            auto found = pieces.find(h);
+            std::shared_ptr<const Piece> piece;
+            if (found != pieces.end())
+            {
+                piece = found->second;
+            }
+            else
+            {
+                ++parsed;
+                detail::SceneCollector reader;
+                std::istringstream in(text.substr(begin, end - begin));
+                ok = reader.read(in, line) && ok;
+                std::shared_ptr<Piece> fresh(new Piece);
+                fresh->scenes = std::move(reader.scenes);
+                fresh->variables = std::move(reader.variables);
+                piece = fresh;
+            }
+            next[h] = piece;
+            order.emplace_back(h, piece);
+            line += lines;
+            begin = end;
+        }
+        if (!ok)
+            return false;
+
+        pieces.swap(next);
+        total = order.size();
+        for (const auto &item : order)
+        {
+            for (const auto &variable : item.second->variables)
+            {
+                story.addVariable(variable.first, variable.second);
+            }
+            for (const auto &scene : item.second->scenes)
+            {
+                story.addScene(scene.label, scene.blocks);
+            }
+        }
+        return true;
+    }
+};
+
+struct StoryVersion
+{
+    //! One compiled state of a live story. Never changes once published.
+    std::uint64_t serial;
+    CompiledStory story;
+    Graph graph;
+    std::unordered_map<std::string, SceneId> scenes;           // By label.
+    std::unordered_map<std::string, std::uint32_t> variables; // By name.
+};
+
+enum class Remap : std::uint8_t
+{
+    same, // Already on the latest version.
+    kept, // Moved to the latest version, on the same scene.
+    lost  // Its scene was deleted, moved to the start of the latest version.
+};
+
+class LiveSession;
+
+class LiveStory
+{
+    //! A story script kept up to date with its file while sessions play it.
+    friend class LiveSession;
+
+  private:
+    std::string path;
+    ScriptCache cache;
+    std::atomic<const StoryVersion *> latest;
+    std::list<std::unique_ptr<StoryVersion>> versions; // Oldest first, only the writer touches it.
+    std::uint64_t serial = 0;
+    std::uint64_t published = 0; // Hash of the text of the latest version.
+
+    std::mutex readersLock; // Guards the list, not the values.
+    std::list<std::atomic<std::uint64_t>> readers; // Serial announced by every LiveSession.
+
+    std::thread watcher;
+    int notify = -1;
+    int wake[2] = {-1, -1};
+
+    bool readFile(std::string &text) const
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            return false;
+        text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    void publish(std::unique_ptr<StoryVersion> next)
+    {
+        latest.store(next.get());
+        versions.push_back(std::move(next));
+
+        // Nobody can reach a version older than every announced serial anymore.
+        std::uint64_t oldest = versions.back()->serial;
+        {
+            std::lock_guard<std::mutex> guard(readersLock);
+            for (const auto &reader : readers)
+            {
+                oldest = std::min(oldest, reader.load());
+            }
+        }
+        while (versions.front()->serial < oldest)
+        {
+            versions.pop_front();
+        }
+    }
+
+    //! Whether the inotify events waiting are about the script.
+    bool changed()
+    {
+        const std::size_t slash = path.rfind('/');
+        const std::string file = slash == std::string::npos ? path : path.substr(slash + 1);
+        bool found = false;
+        alignas(inotify_event) char buffer[4096];
+        ssize_t size = 0;
+        while ((size = ::read(notify, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *at = buffer; at < buffer + size;)
+            {
+                const inotify_event *event = reinterpret_cast<const inotify_event *>(at);
+                if (event->len > 0 && file == event->name)
+                    found = true;
+                at += sizeof(inotify_event) + event->len;
+            }
+        }
+        return found;
+    }
+
+    void run()
+    {
+        pollfd fds[2] = {{notify, POLLIN, 0}, {wake[0], POLLIN, 0}};
+        while (true)
+        {
+            if (poll(fds, 2, -1) < 0)
+                continue;
+            if (fds[1].revents)
+                return;
+            if (!changed())
+                continue;
+            // Editors save in several writes, wait until the file settles.
+            while (poll(fds, 2, 50) > 0)
+            {
+                if (fds[1].revents)
+                    return;
+                changed();
+            }
+            reload();
+        }
+    }
+
+  public:
+    LiveStory()
+        : latest(nullptr) {}
+    LiveStory(const LiveStory &) = delete;
+    LiveStory &operator=(const LiveStory &) = delete;
+
+    ~LiveStory()
+    {
+        stop();
+    }
+
+    //! Reads and publishes the first version of the script.
+    bool open(const std::string &file)
+    {
+        path = file;
+        return reload();
+    }
+
+    //! Publishes the script as it is on disk now, parsing only the scenes that changed.
+    //! Returns false and keeps the current version if it does not compile cleanly.
+    bool reload()
+    {
+        std::string text;
+        if (!readFile(text))
+        {
+            std::cerr << "SStory(EE): cannot open " << path << '\n';
+            return false;
+        }
+        const std::uint64_t h = hash64(text.data(), text.size());
+        if (serial > 0 && h == published)
+            return true;
+        Story story;
+        if (!cache.build(text, story))
+        {
+            std::cerr << "SStory(EE): " << path << " not reloaded\n";
+            return false;
+        }
+        std::unique_ptr<StoryVersion> next(new StoryVersion);
+        next->story = story.compile();
+        if (!next->story.undefinedLabels().empty())
+        {
+            std::cerr << "SStory(EE): " << path << " not reloaded, some labels are undefined\n";
+            return false;
+        }
+        next->serial = ++serial;
+        next->graph = next->story.graph();
+        for (SceneId id = 0; id < next->graph.nScenes; ++id)
+        {
+            next->scenes.emplace(next->graph.str(next->graph.scenes[id].label), id);
+        }
+        const std::vector<std::string> &names = next->story.variableNames();
+        for (std::uint32_t i = 0; i < names.size(); ++i)
+        {
+            next->variables.emplace(names[i], i);
+        }
+        if (serial > 1)
+            std::cerr << "SStory: " << path << " reloaded, " << cache.parsed << " of " << cache.total
+                      << " pieces parsed\n";
+        published = h;
+        publish(std::move(next));
+        return true;
+    }
+
+    //! Starts a thread that reloads the script every time it is saved.
+    bool watch()
+    {
+        const std::size_t slash = path.rfind('/');
+        const std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        // The directory is watched, editors often replace the file instead of writing it.
+        if (notify < 0 || inotify_add_watch(notify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0 ||
+            pipe(wake) != 0)
+        {
+            std::cerr << "SStory(EE): cannot watch " << path << '\n';
+            stop();
+            return false;
+        }
+        watcher = std::thread(&LiveStory::run, this);
+        return true;
+    }
+
+    void stop()
+    {
+        if (watcher.joinable())
+        {
+            const char byte = 0;
+            if (::write(wake[1], &byte, 1) == 1)
+                watcher.join();
+        }
+        for (int *fd : {&notify, &wake[0], &wake[1]})
+        {
+            if (*fd >= 0)
+                ::close(*fd);
+            *fd = -1;
+        }
+    }
+
+    //! Versions still kept in memory, the latest included.
+    std::size_t kept() const
+    {
+        return versions.size();
+    }
+
+    //! Console front-end, like Graph::play(), following every reload.
+    void play();
+};
+
+class LiveSession
+{
+    //! A Session that moves to every new version of a LiveStory, between steps.
+  private:
+    LiveStory &live;
+    std::list<std::atomic<std::uint64_t>>::iterator slot;
+    const StoryVersion *version;
+
+  public:
+    Session session;
+
+    explicit LiveSession(LiveStory &story)
+        : live(story)
+    {
+        std::lock_guard<std::mutex> guard(live.readersLock);
+        // Protects every version while the latest one is read, then only that one.
+        live.readers.emplace_back(0);
+        slot = std::prev(live.readers.end());
+        version = live.latest.load();
+        slot->store(version->serial);
+        session = version->graph.initialSession();
+    }
+
+    LiveSession(const LiveSession &) = delete;
+    LiveSession &operator=(const LiveSession &) = delete;
+
+    ~LiveSession()
+    {
+        std::lock_guard<std::mutex> guard(live.readersLock);
+        live.readers.erase(slot);
+    }
+
+    //! Graph of the version the session is on, valid until the next update().
+    const Graph &graph() const
+    {
+        return version->graph;
+    }
+
+    std::uint64_t serial() const
+    {
+        return version->serial;
+    }
+
+    //! Moves the session to the latest version. Call it between steps, after a move
+    //! the block the session waits on should be presented again with Graph::resume().
+    Remap update()
+    {
+        const StoryVersion *next = live.latest.load();
+        if (next == version)
+            return Remap::same;
+
+        // Still announcing the old version, which protects every newer one too.
+        std::vector<std::int32_t> vars(next->graph.initial, next->graph.initial + next->graph.nVariables);
+        const std::vector<std::string> &names = version->story.variableNames();
+        for (std::uint32_t i = 0; i < names.size() && i < session.vars.size(); ++i)
+        {
+            const auto found = next->variables.find(names[i]);
+            if (found != next->variables.end())
+                vars[found->second] = session.vars[i];
+        }
+        session.vars.swap(vars);
+
+        Remap result = Remap::kept;
+        if (session.scene != END_SCENE)
+        {
+            const auto found = next->scenes.find(version->graph.str(version->graph.scenes[session.scene].label));
+            if (found == next->scenes.end())
+            {
+                session.scene = next->graph.start;
+                session.block = 0;
+                session.vars.assign(next->graph.initial, next->graph.initial + next->graph.nVariables);
+                result = Remap::lost;
+            }
+            else
+            {
+                session.scene = found->second;
+                if (session.block >= next->graph.scenes[session.scene].nBlocks)
+                    session.block = 0;
+            }
+        }
+        version = next;
+        slot->store(next->serial);
+        return result;
+    }
+};
+
+inline void LiveStory::play()
+{
+    std::cout.flush();
+    FdSink out(STDOUT_FILENO);
+    Renderer renderer(out);
+    LiveSession player(*this);
+    std::vector<Event> events;
+    player.graph().resume(player.session, events);
+    while (true)
+    {
+        STRACE(const std::string label = traceLabel(player.graph(), player.session));
+        {
+            STRACE_SCOPE("scene", label);
+            playSounds(player.graph(), events);
+            renderer.render(player.graph(), events);
+        }
+        STRACE(traceVisits(player.graph(), events));
+        if (player.session.scene == END_SCENE || !std::cin)
+            break;
+
+        int input = 0;
+        bool answered = false;
+        {
+            STRACE_SCOPE("input", label);
+            answered = readInput(player.graph().waitsChoice(player.session), input);
+        }
+        if (!answered)
+        {
+            STRACE(STrace::TRACE.mark("quit", label));
+            break;
+        }
+        // The answer was given to the old text, the new one is shown instead.
+        const Remap moved = player.update();
+        if (moved != Remap::same)
+        {
+            static const char updated[] = "\n(The story was updated)\n";
+            static const char gone[] = "\n(The story was updated, this scene is gone)\n";
+            if (moved == Remap::kept)
+                out.write(updated, sizeof(updated) - 1);
+            else
+                out.write(gone, sizeof(gone) - 1);
+            player.graph().resume(player.session, events);
+            continue;
+        }
+        STRACE(traceAnswer(player.graph(), player.session, input));
+        player.graph().step(player.session, input, events);
+    }
+    renderer.flush();
+}
+
+} // namespace SStory;
+
+#endif // SReload_h
@@ -0,0 +1,94 @@
+/* srender.cpp
+ * Renders the soundtrack of a scripted playthrough to a WAV file, faster than real time.
+ * Without a story (or with -) it plays the sample adventure of example.h.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * The player takes READING_SPEED characters per second to read the text of
+ * every step and THINKING seconds to answer, then picks a pseudo random
+ * choice from the seed. The same story, seed and sounds always render the
+ * same bytes, so the output can be compared with cmp, on every build made
+ * with -ffp-contract=off (see smixer.h).
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "example.h"
+#include "sbench.h"
+#include "smixer.h"
+#include "sscript.h"
+
+// Whole numbers, so the position of every step is computed in integer frames
+// and does not depend on the floating point of the build.
+constexpr std::uint64_t READING_SPEED = 20; // Characters per second.
+constexpr std::uint64_t THINKING = 1;       // Seconds before answering.
+constexpr std::uint64_t TAIL = 2;           // Seconds rendered after the last step.
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " story|- out.wav [seed] [choices]\n";
+        return 1;
+    }
+    const std::uint64_t seed = argc > 3 ? static_cast<std::uint64_t>(std::atoll(argv[3])) : 1;
+    const std::uint64_t maxSteps = argc > 4 ? static_cast<std::uint64_t>(std::atoll(argv[4])) : 1000;
+
+    SStory::StoryFile file;
+    SStory::Graph graph;
+    if (std::string(argv[1]) != "-")
+    {
+        if (!file.open(argv[1]))
+            return 1;
+        graph = file.graph();
+    }
+    else
+    {
+        graph = Example::graph();
+    }
+
+    SSound::MixerBackend *backend = new SSound::MixerBackend();
+    SSound::MASTER.use(std::unique_ptr<SSound::Backend>(backend));
+    const int rate = backend->mixer().frequency();
+
+    SSound::WavWriter wav;
+    if (!wav.open(argv[2], rate))
+        return 1;
+
+    SStory::ScriptedPlayer player(graph, seed);
+    std::vector<SStory::Event> events;
+    events.reserve(32);
+    player.begin(events);
+    std::uint64_t characters = 0; // Read by the player so far.
+    std::uint64_t answers = 0;
+    while (true)
+    {
+        for (const auto &event : events)
+        {
+            if (event.kind == SStory::EventKind::sound)
+                SSound::MASTER.play(static_cast<SSound::Sample>(event.value), static_cast<SSound::Channel>(event.channel));
+            else if (event.kind == SStory::EventKind::text || event.kind == SStory::EventKind::choice)
+                characters += event.text.size;
+        }
+        ++answers;
+        const std::uint64_t until = characters * rate / READING_SPEED + answers * THINKING * rate;
+        backend->render(wav, static_cast<std::size_t>(until - backend->mixer().position()));
+
+        if (player.steps == maxSteps)
+            break;
+        player.step(events);
+        if (player.endings > 0)
+            break;
+    }
+    backend->render(wav, static_cast<std::size_t>(TAIL * rate));
+
+    if (!wav.close())
+        return 1;
+    std::cout << "Rendered " << player.steps << " steps, " << static_cast<double>(backend->mixer().position()) / rate
+              << " s of sound to " << argv[2] << '\n';
+    return 0;
+}
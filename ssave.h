@@ -0,0 +1,312 @@
+/* ssave.h
+ * Save states and choice journals for story sessions.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * Both formats are little endian byte streams, the same on every host:
+ *
+ *   Snapshot: "SSSV" version story scene block nVars var... count input...
+ *   Journal:  "SSJL" version story input input ...
+ *
+ * version, story, scene and block are 4 bytes. nVars, count and every input
+ * are LEB128 varints, almost always one byte, every var a zigzag varint. story is the fingerprint of the
+ * Graph the session belongs to, so a save never resumes on another story.
+ * A journal is only appended to, a torn last input is ignored on load.
+ */
+
+#ifndef SSave_h
+#define SSave_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sbinary.h"
+#include "sstory.h"
+
+namespace SStory
+{
+
+//! Each format has its own version: snapshots gained the variables, journals never changed.
+constexpr std::uint32_t SNAPSHOT_VERSION = 2;
+constexpr std::uint32_t JOURNAL_VERSION = 1;
+
+//! Same value as the checksum of the story saved with SStory::save().
+inline std::uint32_t fingerprint(const Graph &g)
+{
+    std::uint32_t sum = checksum(reinterpret_cast<const char *>(g.scenes), g.nScenes * sizeof(SceneEntry));
+    sum = checksum(reinterpret_cast<const char *>(g.blocks), g.nBlocks * sizeof(BlockEntry), sum);
+    sum = checksum(reinterpret_cast<const char *>(g.choices), g.nChoices * sizeof(ChoiceEntry), sum);
+    sum = checksum(reinterpret_cast<const char *>(g.initial), g.nVariables * sizeof(std::int32_t), sum);
+    sum = checksum(g.pool, g.poolSize, sum);
+    return checksum(reinterpret_cast<const char *>(g.code), g.codeSize, sum);
+}
+
+namespace detail
+{
+
+inline void put32(std::string &out, std::uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out += static_cast<char>((v >> (8 * i)) & 0xFF);
+    }
+}
+
+inline void putVarint(std::string &out, std::uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        out += static_cast<char>((v & 0x7F) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+inline bool get32(const char *&at, const char *end, std::uint32_t &v)
+{
+    if (end - at < 4)
+        return false;
+    const unsigned char *b = reinterpret_cast<const unsigned char *>(at);
+    v = b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<std::uint32_t>(b[3]) << 24);
+    at += 4;
+    return true;
+}
+
+inline bool getVarint(const char *&at, const char *end, std::uint32_t &v)
+{
+    v = 0;
+    for (int shift = 0; at < end && shift < 35; shift += 7)
+    {
+        const unsigned char byte = static_cast<unsigned char>(*at++);
+        v |= static_cast<std::uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+inline bool readFile(const std::string &path, std::string &out)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+} // namespace detail
+
+struct Snapshot
+{
+    //! Everything needed to resume a session anywhere the same story is loaded.
+    std::uint32_t story = 0;
+    Session session = {END_SCENE, 0, {}};
+    std::vector<std::uint32_t> history; // Every accepted input since START.
+
+    //! The save of a session of the graph, reached with the inputs of history.
+    static Snapshot of(const Graph &g, const Session &session, const std::vector<std::uint32_t> &history)
+    {
+        Snapshot snapshot;
+        snapshot.story = fingerprint(g);
+        snapshot.session = session;
+        snapshot.history = history;
+        return snapshot;
+    }
+
+    std::string encode() const
+    {
+        std::string out("SSSV");
+        detail::put32(out, SNAPSHOT_VERSION);
+        detail::put32(out, story);
+        detail::put32(out, session.scene);
+        detail::put32(out, session.block);
+        detail::putVarint(out, static_cast<std::uint32_t>(session.vars.size()));
+        for (const std::int32_t var : session.vars)
+        {
+            detail::putVarint(out, (static_cast<std::uint32_t>(var) << 1) ^ static_cast<std::uint32_t>(var >> 31));
+        }
+        detail::putVarint(out, static_cast<std::uint32_t>(history.size()));
+        for (const std::uint32_t input : history)
+        {
+            detail::putVarint(out, input);
+        }
+        return out;
+    }
+
+    bool decode(const char *data, std::size_t size)
+    {
+        if (size < 4 || std::memcmp(data, "SSSV", 4) != 0)
+            return false;
+        const char *at = data + 4;
+        const char *end = data + size;
+        std::uint32_t version = 0;
+        std::uint32_t count = 0;
+        if (!detail::get32(at, end, version) || version != SNAPSHOT_VERSION ||
+            !detail::get32(at, end, story) || !detail::get32(at, end, session.scene) ||
+            !detail::get32(at, end, session.block) || !detail::getVarint(at, end, count) ||
+            count > static_cast<std::size_t>(end - at))
+            return false;
+        session.vars.resize(count);
+        for (auto &var : session.vars)
+        {
+            std::uint32_t zigzag = 0;
+            if (!detail::getVarint(at, end, zigzag))
+                return false;
+            var = static_cast<std::int32_t>((zigzag >> 1) ^ (0u - (zigzag & 1)));
+        }
+        if (!detail::getVarint(at, end, count) || count > static_cast<std::size_t>(end - at))
+            return false;
+        history.resize(count);
+        for (auto &input : history)
+        {
+            if (!detail::getVarint(at, end, input))
+                return false;
+        }
+        return true;
+    }
+
+    bool save(const std::string &path) const
+    {
+        const std::string data = encode();
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), data.size());
+        return static_cast<bool>(out.flush());
+    }
+
+    bool load(const std::string &path)
+    {
+        std::string data;
+        return detail::readFile(path, data) && decode(data.data(), data.size());
+    }
+
+    //! The session is only trusted if it points inside the graph it was saved from.
+    bool fits(const Graph &g) const
+    {
+        if (story != fingerprint(g))
+            return false;
+        return session.vars.size() == g.nVariables &&
+               (session.scene == END_SCENE ||
+                (session.scene < g.nScenes && session.block < g.scenes[session.scene].nBlocks));
+    }
+};
+
+//! Fast forward: feeds the inputs to a fresh session, nothing is rendered nor played.
+//! Returns false if some input does not fit the story, session stops right before it.
+inline bool replay(const Graph &g, const std::vector<std::uint32_t> &inputs, Session &session)
+{
+    std::vector<Event> events;
+    events.reserve(32);
+    session = g.begin(events);
+    for (const std::uint32_t input : inputs)
+    {
+        if (!g.accepts(session, static_cast<int>(input)))
+            return false;
+        g.step(session, static_cast<int>(input), events);
+    }
+    return true;
+}
+
+class Journal
+{
+    //! Append only log of accepted inputs, one write per input so a crash loses at most the last one.
+  private:
+    int fd = -1;
+    std::string buffer;
+
+  public:
+    std::vector<std::uint32_t> inputs; // Read back by open().
+
+    Journal() {}
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+
+    ~Journal()
+    {
+        close();
+    }
+
+    //! Reads what the journal already holds and opens it for appending.
+    //! A journal of another story is refused.
+    bool open(const std::string &path, const Graph &g)
+    {
+        close();
+        inputs.clear();
+        const std::uint32_t story = fingerprint(g);
+        std::string data;
+        std::size_t valid = 0;
+        if (detail::readFile(path, data) && !data.empty())
+        {
+            const char *at = data.data() + std::min<std::size_t>(4, data.size());
+            const char *end = data.data() + data.size();
+            std::uint32_t version = 0;
+            std::uint32_t owner = 0;
+            if (data.size() < 4 || std::memcmp(data.data(), "SSJL", 4) != 0 || !detail::get32(at, end, version) ||
+                version != JOURNAL_VERSION || !detail::get32(at, end, owner) || owner != story)
+            {
+                std::cerr << "SStory(EE): " << path << " is not a journal of this story\n";
+                return false;
+            }
+            std::uint32_t input = 0;
+            const char *good = at;
+            while (detail::getVarint(at, end, input))
+            {
+                inputs.push_back(input);
+                good = at;
+            }
+            valid = static_cast<std::size_t>(good - data.data());
+        }
+
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0)
+        {
+            std::cerr << "SStory(EE): cannot write " << path << '\n';
+            return false;
+        }
+        if (valid < data.size() && ftruncate(fd, static_cast<off_t>(valid)) != 0)
+        {
+            std::cerr << "SStory(EE): cannot repair " << path << '\n';
+            return false;
+        }
+        if (data.empty())
+        {
+            buffer.assign("SSJL");
+            detail::put32(buffer, JOURNAL_VERSION);
+            detail::put32(buffer, story);
+            flush();
+        }
+        return true;
+    }
+
+    void record(std::uint32_t input)
+    {
+        detail::putVarint(buffer, input);
+        flush();
+    }
+
+    void close()
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+  private:
+    void flush()
+    {
+        FdSink(fd).write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+};
+
+} // namespace SStory;
+
+#endif // SSave_h
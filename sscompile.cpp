@@ -0,0 +1,50 @@
+/* sscompile.cpp
+ * Compiles a story script into the binary format played by SStory::MappedStory.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ */
+
+#include <fstream>
+
+#include "sbinary.h"
+#include "sscript.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " story.txt story.ssb\n";
+        return 2;
+    }
+
+    std::ifstream in(argv[1]);
+    if (!in)
+    {
+        std::cerr << "Cannot read " << argv[1] << '\n';
+        return 1;
+    }
+
+    SStory::Story story;
+    SStory::ScriptReader reader(story);
+    if (!reader.read(in))
+        return 1;
+
+    const SStory::CompiledStory compiled = story.compile();
+    if (!compiled.undefinedLabels().empty())
+        return 1;
+    if (!SStory::save(compiled.graph(), argv[2]))
+    {
+        std::cerr << "Cannot write " << argv[2] << '\n';
+        return 1;
+    }
+    // The full check happens once here, ExGame only checks the header when it opens the story.
+    SStory::MappedStory written;
+    if (!written.open(argv[2]) || !written.verify())
+    {
+        std::cerr << "Invalid story written to " << argv[2] << '\n';
+        return 1;
+    }
+    story.memory().print(std::cout);
+    return 0;
+}
@@ -0,0 +1,328 @@
+/* sscript.h
+ * Plain text story scripts for SStory.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * A script is read line by line, empty lines and lines starting with # are skipped:
+ *
+ *   scene START
+ *   text Es poco después de las 12 de la noche.
+ *   sound driving
+ *   text ¿Cuál tomar?
+ *   sound howl right
+ *   choice CAM1 | El primer camino
+ *   choice CAM2 | El segundo camino | Decides alejarte del ruido.
+ *   when linterna > 0
+ *   set linterna -= 1; valiente = true
+ *
+ * Every text line starts a new ContentBody of the current scene, sound and choice
+ * lines apply to the last one. Inside text, \n is a new line and \\ a backslash, in
+ * choices \| is a literal |.
+ *
+ * when shows the last choice, or the last text if no choice followed it, only
+ * while its condition holds. set runs assignments when the last choice is taken.
+ * var NAME = VALUE, anywhere, gives a variable its initial value. See scode.h.
+ *
+ * timeout SECONDS takes the last choice by itself if the player has not answered
+ * in time, on front-ends with a clock (see sloop.h).
+ */
+
+#ifndef SScript_h
+#define SScript_h
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "sbinary.h"
+#include "sstory.h"
+
+namespace SStory
+{
+
+class ScriptReader
+{
+    //! Builds a Story out of a script, reporting errors with their line number.
+  private:
+    struct Pending
+    {
+        std::string text;
+        std::vector<Choice> choices;
+        SSound::Sample sample = SSound::Sample::attack;
+        SSound::Channel channel = SSound::Channel::center;
+        std::string condition;
+        bool withSound = false;
+        bool open = false;
+    };
+
+    Story *story;
+    std::string label;
+    std::vector<ContentBody> scene;
+    Pending block;
+    CodeBuilder check; // Compiles expressions as they are read, to report them with their line.
+    int line = 0;
+    int errors = 0;
+
+    void error(const std::string &message)
+    {
+        std::cerr << "Script(EE): line " << line << ": " << message << '\n';
+        ++errors;
+    }
+
+    static std::string unescape(const std::string &s)
+    {
+        std::string out;
+        for (std::size_t i = 0; i < s.size(); ++i)
+        {
+            if (s[i] == '\\' && i + 1 < s.size())
+            {
+                const char next = s[++i];
+                out += next == 'n' ? '\n' : next;
+            }
+            else
+            {
+                out += s[i];
+            }
+        }
+        return out;
+    }
+
+    //! Splits on unescaped |, resolving escapes and trimming spaces.
+    static std::vector<std::string> fields(const std::string &s)
+    {
+        std::vector<std::string> out;
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i <= s.size(); ++i)
+        {
+            if (i < s.size() && s[i] == '\\')
+            {
+                ++i;
+            }
+            else if (i == s.size() || s[i] == '|')
+            {
+                const std::size_t first = s.find_first_not_of(' ', begin);
+                const std::size_t last = s.find_last_not_of(' ', i - 1);
+                out.push_back(first >= i || last < first ? std::string() : unescape(s.substr(first, last - first + 1)));
+                begin = i + 1;
+            }
+        }
+        return out;
+    }
+
+    void flushBlock()
+    {
+        if (!block.open)
+            return;
+        if (block.withSound && !block.choices.empty())
+            scene.emplace_back(std::move(block.text), std::move(block.choices), block.sample, block.channel);
+        else if (block.withSound)
+            scene.emplace_back(std::move(block.text), block.sample, block.channel);
+        else if (!block.choices.empty())
+            scene.emplace_back(std::move(block.text), std::move(block.choices));
+        else
+            scene.emplace_back(std::move(block.text));
+        scene.back().when(std::move(block.condition));
+        block = Pending();
+    }
+
+    void flushScene()
+    {
+        flushBlock();
+        if (!label.empty())
+            addScene(std::move(label), std::move(scene));
+        label.clear();
+        scene.clear();
+    }
+
+    void command(const std::string &keyword, const std::string &rest)
+    {
+        if (keyword == "var")
+        {
+            std::istringstream words(rest);
+            std::string name, equals;
+            long long value = 0;
+            words >> name >> equals;
+            if (name.empty() || equals != "=" || !(words >> value) || value < INT32_MIN || value > INT32_MAX ||
+                (words >> std::ws, !words.eof()))
+                error("expected var NAME = NUMBER");
+            else
+                addVariable(name, static_cast<std::int32_t>(value));
+            return;
+        }
+        if (keyword == "scene")
+        {
+            flushScene();
+            label = rest;
+            if (label.empty())
+                error("scene without label");
+            return;
+        }
+        if (label.empty())
+        {
+            error("'" + keyword + "' outside of a scene");
+            return;
+        }
+        if (keyword == "text")
+        {
+            flushBlock();
+            block.text = unescape(rest);
+            block.open = true;
+        }
+        else if (!block.open)
+        {
+            error("'" + keyword + "' before any text");
+        }
+        else if (keyword == "sound")
+        {
+            std::istringstream words(rest);
+            std::string sample, channel;
+            words >> sample >> channel;
+            block.withSound = SSound::parse(sample, block.sample);
+            if (!block.withSound)
+                error("unknown sample '" + sample + "'");
+            if (!channel.empty() && !SSound::parse(channel, block.channel))
+                error("unknown channel '" + channel + "'");
+        }
+        else if (keyword == "choice")
+        {
+            const std::vector<std::string> parts = fields(rest);
+            if (parts.size() < 2 || parts.size() > 3 || parts[0].empty())
+                error("expected choice LABEL | text [| complement]");
+            else if (parts.size() == 2)
+                block.choices.emplace_back(parts[0], parts[1]);
+            else
+                block.choices.emplace_back(parts[0], parts[1], parts[2]);
+        }
+        else if (keyword == "when")
+        {
+            if (check.condition(rest) == NO_CODE)
+                error(check.error() + " in condition");
+            else if (block.choices.empty())
+                block.condition = rest;
+            else
+                block.choices.back().when(rest);
+        }
+        else if (keyword == "set")
+        {
+            if (block.choices.empty())
+                error("'set' before any choice");
+            else if (check.assignments(rest) == NO_CODE)
+                error(check.error() + " in assignments");
+            else
+                block.choices.back().then(rest);
+        }
+        else if (keyword == "timeout")
+        {
+            char *end = nullptr;
+            const double seconds = std::strtod(rest.c_str(), &end);
+            if (block.choices.empty())
+                error("'timeout' before any choice");
+            else if (end == rest.c_str() || !(seconds > 0 && seconds < 86400))
+                error("expected timeout SECONDS");
+            else
+                block.choices.back().after(static_cast<std::uint32_t>(seconds * 1000 + 0.5));
+        }
+        else
+        {
+            error("unknown keyword '" + keyword + "'");
+        }
+    }
+
+  protected:
+    //! Where the scenes and variables read go, the story by default.
+    virtual void addScene(std::string l, std::vector<ContentBody> blocks)
+    {
+        story->addScene(l, blocks);
+    }
+
+    virtual void addVariable(const std::string &name, std::int32_t value)
+    {
+        story->addVariable(name, value);
+    }
+
+    //! For readers that override both hooks.
+    ScriptReader()
+        : story(nullptr) {}
+
+  public:
+    ScriptReader(Story &s)
+        : story(&s) {}
+
+    virtual ~ScriptReader() {}
+
+    //! Adds every scene of the script to the story, returns false on any error.
+    //! Line numbers in errors count from firstLine + 1, for scripts read in pieces.
+    bool read(std::istream &in, int firstLine = 0)
+    {
+        line = firstLine;
+        std::string text;
+        while (std::getline(in, text))
+        {
+            ++line;
+            if (!text.empty() && text.back() == '\r')
+                text.pop_back();
+            const std::size_t first = text.find_first_not_of(" \t");
+            if (first == std::string::npos || text[first] == '#')
+                continue;
+            const std::size_t space = text.find(' ', first);
+            const std::string keyword = text.substr(first, space - first);
+            const std::string rest = space == std::string::npos ? std::string() : text.substr(space + 1);
+            command(keyword, rest);
+        }
+        flushScene();
+        return errors == 0;
+    }
+};
+
+class StoryFile
+{
+    //! Either a binary story, mapped as is, or a script compiled on load.
+    //! Lets tools take both kinds of files.
+  private:
+    MappedStory mapped;
+    CompiledStory compiled;
+
+  public:
+    bool open(const std::string &path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+        {
+            std::cerr << "SStory(EE): cannot open " << path << '\n';
+            return false;
+        }
+        char magic[4] = {0, 0, 0, 0};
+        in.read(magic, sizeof(magic));
+        if (std::memcmp(magic, "SSTB", 4) == 0)
+            return mapped.open(path) && mapped.verify();
+
+        in.clear();
+        in.seekg(0);
+        Story story;
+        ScriptReader reader(story);
+        if (!reader.read(in))
+            return false;
+        compiled = story.compile();
+        return true;
+    }
+
+    //! Labels the script referenced without defining them, binary stories have none.
+    const std::vector<std::string> &undefinedLabels() const
+    {
+        return compiled.undefinedLabels();
+    }
+
+    Graph graph() const
+    {
+        return mapped.isOpen() ? mapped.graph() : compiled.graph();
+    }
+};
+
+} // namespace SStory;
+
+#endif // SScript_h
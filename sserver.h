@@ -0,0 +1,653 @@
+/* sserver.h
+ * Serves one story to many players at once, over TCP or Unix domain sockets.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * Every connection is a Session over one shared, immutable Graph and talks
+ * like a telnet line client: the text of each step ends with its prompt, and
+ * the player answers one line at a time. Server runs one epoll loop per core.
+ * Every loop waits on the listening sockets with EPOLLEXCLUSIVE, so a single
+ * one wakes up per connection, and keeps the connections it accepted. A
+ * session never changes thread and workers share nothing but counters.
+ *
+ * Output is buffered per connection and sent as fast as the socket takes it.
+ * A client that leaves more than SERVER_OUTPUT_LIMIT bytes unread is not read
+ * until it catches up, so a player who never reads costs bounded memory.
+ * Timed choices expire on a timer heap of the worker.
+ */
+
+#ifndef SServer_h
+#define SServer_h
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "sstory.h"
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+namespace SStory
+{
+
+//! Longest answer accepted, longer lines close the connection.
+constexpr std::size_t SERVER_LINE_LIMIT = 1024;
+//! Bytes left unread by a client before its input stops being read.
+constexpr std::size_t SERVER_OUTPUT_LIMIT = 64 * 1024;
+constexpr int SERVER_BACKLOG = 4096;
+//! Ready descriptors handled per wait of a worker.
+constexpr int SERVER_EVENTS = 256;
+
+class TelnetSink : public Sink
+{
+    //! Appends to a string, with the "\r\n" line ends of network terminals.
+  public:
+    std::string *out = nullptr;
+
+    void write(const char *data, std::size_t size) override
+    {
+        const char *end = data + size;
+        while (data < end)
+        {
+            const char *newline = static_cast<const char *>(std::memchr(data, '\n', end - data));
+            out->append(data, (newline ? newline : end) - data);
+            if (newline == nullptr)
+                break;
+            out->append("\r\n", 2);
+            data = newline + 1;
+        }
+    }
+};
+
+//! Raises the limit of open descriptors to the hard limit, returns the limit now in place.
+inline std::size_t raiseFileLimit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+        return 0;
+    if (limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    return static_cast<std::size_t>(limit.rlim_cur);
+}
+
+//! Non blocking listening socket on "tcp:PORT", "tcp:HOST:PORT" or "unix:PATH", -1 on errors.
+//! A socket file left at PATH by a previous run is replaced.
+inline int listenOn(const std::string &address)
+{
+    int fd = -1;
+    if (address.compare(0, 5, "unix:") == 0 && address.size() > 5)
+    {
+        const std::string path = address.substr(5);
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            std::cerr << "SStory(EE): socket path too long " << path << '\n';
+            return -1;
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+            unlink(path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+                        ::listen(fd, SERVER_BACKLOG) != 0))
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    else if (address.compare(0, 4, "tcp:") == 0 && address.size() > 4)
+    {
+        const std::string rest = address.substr(4);
+        const std::size_t colon = rest.rfind(':');
+        const std::string host = colon == std::string::npos ? std::string() : rest.substr(0, colon);
+        const std::string port = colon == std::string::npos ? rest : rest.substr(colon + 1);
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo *found = nullptr;
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0)
+        {
+            std::cerr << "SStory(EE): cannot resolve " << address << '\n';
+            return -1;
+        }
+        for (addrinfo *ai = found; ai != nullptr && fd < 0; ai = ai->ai_next)
+        {
+            fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            const int one = 1;
+            if (fd >= 0 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+                            bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || ::listen(fd, SERVER_BACKLOG) != 0))
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(found);
+    }
+    else
+    {
+        std::cerr << "SStory(EE): expected tcp:[HOST:]PORT or unix:PATH, not " << address << '\n';
+        return -1;
+    }
+    if (fd < 0)
+        std::cerr << "SStory(EE): cannot listen on " << address << ": " << std::strerror(errno) << '\n';
+    return fd;
+}
+
+struct ServerStats
+{
+    //! Counters of a Server, since it started.
+    std::uint64_t accepted;
+    std::uint64_t open;     // Connections right now.
+    std::uint64_t answers;
+    std::uint64_t expired;  // Timed choices taken by themselves.
+    std::uint64_t finished; // Sessions that reached the end of the story.
+    std::uint64_t paused;   // Times a client was not read until it caught up.
+};
+
+class Server
+{
+    //! Plays a Graph to every connection of its listening sockets, see the top of the file.
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Connection
+    {
+        int fd;
+        Session session;
+        std::string input;
+        std::string output;
+        std::size_t sent = 0;     // Bytes of output already sent.
+        std::uint64_t step = 0;   // Changes on every step, stale timers do not match it.
+        std::uint32_t events = 0; // Registered with epoll.
+        std::uint8_t telnet = 0;  // Bytes left of a telnet command.
+        bool closing = false;     // Story or input over, closes once the output is out.
+    };
+
+    struct Timer
+    {
+        Clock::time_point when;
+        int fd;
+        std::uint64_t step;
+    };
+
+    class Worker
+    {
+        //! One epoll loop and the connections it accepted.
+      private:
+        Server &server;
+        const Graph &graph;
+        int epoll = -1;
+        std::vector<std::unique_ptr<Connection>> connections; // By descriptor.
+        std::vector<Timer> timers;                            // Heap, soonest first.
+        std::uint64_t steps = 0;
+        std::vector<Event> events;
+        TelnetSink sink;
+        Renderer renderer;
+        bool full = false; // Out of descriptors, not accepting until one closes.
+
+        static bool later(const Timer &a, const Timer &b)
+        {
+            return a.when > b.when;
+        }
+
+        bool listener(int fd) const
+        {
+            return std::find(server.listeners.begin(), server.listeners.end(), fd) != server.listeners.end();
+        }
+
+        void listen(bool on)
+        {
+            for (int fd : server.listeners)
+            {
+                epoll_event event;
+                event.events = EPOLLIN | EPOLLEXCLUSIVE;
+                event.data.fd = fd;
+                epoll_ctl(epoll, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, on ? &event : nullptr);
+            }
+        }
+
+        int timeout() const
+        {
+            if (timers.empty())
+                return -1;
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(timers.front().when - Clock::now());
+            return left.count() < 0 ? 0 : static_cast<int>(left.count()) + 1;
+        }
+
+        //! Renders the events of the last step to the connection, arming its timers.
+        void show(Connection &c)
+        {
+            c.step = ++steps;
+            sink.out = &c.output;
+            renderer.render(graph, events);
+            for (const auto &event : events)
+            {
+                if (event.kind == EventKind::timer)
+                {
+                    timers.push_back(Timer{Clock::now() + std::chrono::milliseconds(event.value), c.fd, c.step});
+                    std::push_heap(timers.begin(), timers.end(), later);
+                }
+            }
+            if (c.session.scene == END_SCENE && !c.closing)
+            {
+                c.closing = true;
+                ++server.finished;
+            }
+        }
+
+        void accept(int fd)
+        {
+            while (!full)
+            {
+                const int client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (client < 0)
+                {
+                    if (errno == EMFILE || errno == ENFILE)
+                    {
+                        std::cerr << "SStory(WW): out of descriptors, not accepting players for now\n";
+                        full = true;
+                        listen(false);
+                    }
+                    return; // EAGAIN: another worker took it.
+                }
+                const int one = 1;
+                setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails on Unix sockets.
+                if (static_cast<std::size_t>(client) >= connections.size())
+                    connections.resize(client + 1);
+                connections[client].reset(new Connection);
+                Connection &c = *connections[client];
+                c.fd = client;
+                c.session = graph.initialSession();
+                c.events = EPOLLIN;
+                epoll_event event;
+                event.events = c.events;
+                event.data.fd = client;
+                epoll_ctl(epoll, EPOLL_CTL_ADD, client, &event);
+                ++server.accepted;
+                ++server.open;
+
+                graph.resume(c.session, events);
+                show(c);
+                send(c);
+            }
+        }
+
+        void drop(Connection &c)
+        {
+            const int fd = c.fd;
+            ::close(fd); // Also leaves the epoll set.
+            connections[fd].reset();
+            --server.open;
+            if (full)
+            {
+                full = false;
+                listen(true);
+            }
+        }
+
+        //! Sends what the socket takes and registers for what is left.
+        //! Returns false if the connection was closed.
+        bool send(Connection &c)
+        {
+            while (c.sent < c.output.size())
+            {
+                const ssize_t n = ::send(c.fd, c.output.data() + c.sent, c.output.size() - c.sent, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                    break;
+                if (n <= 0)
+                {
+                    drop(c);
+                    return false;
+                }
+                c.sent += static_cast<std::size_t>(n);
+            }
+            if (c.sent == c.output.size())
+            {
+                c.output.clear();
+                c.sent = 0;
+                if (c.closing)
+                {
+                    drop(c);
+                    return false;
+                }
+            }
+            else if (c.sent >= SERVER_OUTPUT_LIMIT)
+            {
+                c.output.erase(0, c.sent);
+                c.sent = 0;
+            }
+
+            const bool writing = c.sent < c.output.size();
+            const bool reading = !c.closing && c.output.size() - c.sent <= SERVER_OUTPUT_LIMIT;
+            const std::uint32_t wanted = (reading ? EPOLLIN : 0u) | (writing ? EPOLLOUT : 0u);
+            if (wanted != c.events)
+            {
+                if ((c.events & EPOLLIN) && !reading)
+                    ++server.paused;
+                epoll_event event;
+                event.events = wanted;
+                event.data.fd = c.fd;
+                epoll_ctl(epoll, EPOLL_CTL_MOD, c.fd, &event);
+                c.events = wanted;
+            }
+            return true;
+        }
+
+        void answer(Connection &c, const char *line, std::size_t size)
+        {
+            const bool choice = graph.waitsChoice(c.session);
+            std::size_t blank = 0;
+            while (blank < size && (line[blank] == ' ' || line[blank] == '\t'))
+            {
+                ++blank;
+            }
+            if (choice && blank == size)
+                return;
+            // Lines end at the '\n' still in the input, atoi stops there.
+            const int number = choice ? std::atoi(line) : 0;
+            ++server.answers;
+            graph.step(c.session, number, events);
+            show(c);
+        }
+
+        //! Answers the whole lines received, while the client keeps up with the output.
+        void answerLines(Connection &c)
+        {
+            while (true)
+            {
+                std::size_t at = 0;
+                while (!c.closing && c.output.size() - c.sent <= SERVER_OUTPUT_LIMIT)
+                {
+                    const std::size_t newline = c.input.find('\n', at);
+                    if (newline == std::string::npos)
+                        break;
+                    const std::size_t end = newline > at && c.input[newline - 1] == '\r' ? newline - 1 : newline;
+                    answer(c, c.input.data() + at, end - at);
+                    at = newline + 1;
+                }
+                c.input.erase(0, at);
+                if (c.input.size() > SERVER_LINE_LIMIT && c.input.find('\n') == std::string::npos)
+                {
+                    drop(c);
+                    return;
+                }
+                // Lines left once the socket took the output would wait for input that may never come.
+                if (!send(c) || c.closing || c.output.size() - c.sent > SERVER_OUTPUT_LIMIT ||
+                    c.input.find('\n') == std::string::npos)
+                    return;
+            }
+        }
+
+        void receive(Connection &c)
+        {
+            char bytes[4096];
+            const ssize_t size = ::read(c.fd, bytes, sizeof(bytes));
+            if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                return;
+            if (size < 0)
+            {
+                drop(c);
+                return;
+            }
+            if (size == 0)
+            {
+                // The client is done talking, what it asked for is still sent.
+                c.closing = true;
+                send(c);
+                return;
+            }
+            for (ssize_t i = 0; i < size; ++i)
+            {
+                const unsigned char b = static_cast<unsigned char>(bytes[i]);
+                if (c.telnet > 0)
+                {
+                    // Option negotiation is not answered, clients fall back to line mode.
+                    --c.telnet;
+                    if (c.telnet == 1 && (b < 251 || b > 254))
+                        c.telnet = 0; // Two byte command.
+                }
+                else if (b == 255)
+                {
+                    c.telnet = 2;
+                }
+                else
+                {
+                    c.input += static_cast<char>(b);
+                }
+            }
+            answerLines(c);
+        }
+
+        void expire()
+        {
+            const Clock::time_point now = Clock::now();
+            while (!timers.empty() && timers.front().when <= now)
+            {
+                const Timer timer = timers.front();
+                std::pop_heap(timers.begin(), timers.end(), later);
+                timers.pop_back();
+                Connection *c = connections[timer.fd].get();
+                if (c == nullptr || c->step != timer.step || c->closing || graph.expire(c->session, events) == 0)
+                    continue;
+                ++server.expired;
+                c->input.clear();
+                show(*c);
+                send(*c);
+            }
+        }
+
+      public:
+        int wake = -1;
+
+        Worker(Server &s)
+            : server(s), graph(s.graph), renderer(sink)
+        {
+            renderer.translate(s.translation);
+            epoll = epoll_create1(EPOLL_CLOEXEC);
+            wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = wake;
+            epoll_ctl(epoll, EPOLL_CTL_ADD, wake, &event);
+            listen(true);
+        }
+
+        Worker(const Worker &) = delete;
+        Worker &operator=(const Worker &) = delete;
+
+        ~Worker()
+        {
+            for (auto &c : connections)
+            {
+                if (c)
+                    ::close(c->fd);
+            }
+            ::close(wake);
+            ::close(epoll);
+        }
+
+        void run()
+        {
+            epoll_event ready[SERVER_EVENTS];
+            while (!server.stopping)
+            {
+                const int n = epoll_wait(epoll, ready, SERVER_EVENTS, timeout());
+                for (int i = 0; i < n && !server.stopping; ++i)
+                {
+                    const int fd = ready[i].data.fd;
+                    if (fd == wake)
+                        continue;
+                    if (listener(fd))
+                    {
+                        accept(fd);
+                        continue;
+                    }
+                    Connection *c = static_cast<std::size_t>(fd) < connections.size() ? connections[fd].get() : nullptr;
+                    if (c == nullptr)
+                        continue;
+                    if (ready[i].events & EPOLLERR)
+                        drop(*c);
+                    else if (ready[i].events & EPOLLOUT)
+                    {
+                        if (send(*c))
+                            answerLines(*c); // Lines left while it was not read.
+                    }
+                    else
+                    {
+                        receive(*c);
+                    }
+                }
+                expire();
+            }
+        }
+    };
+
+    const Graph graph;
+    const Translation *translation;
+    std::vector<int> listeners;
+    std::vector<std::string> paths; // Of Unix sockets, removed at the end.
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex lock;
+    std::atomic<bool> stopping{false};
+    std::atomic<std::uint64_t> accepted{0};
+    std::atomic<std::uint64_t> open{0};
+    std::atomic<std::uint64_t> answers{0};
+    std::atomic<std::uint64_t> expired{0};
+    std::atomic<std::uint64_t> finished{0};
+    std::atomic<std::uint64_t> paused{0};
+
+  public:
+    //! Texts are looked up in the translation first, when there is one. It is shared by every worker.
+    Server(const Graph &g, const Translation *t = nullptr)
+        : graph(g), translation(t) {}
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    ~Server()
+    {
+        for (int fd : listeners)
+        {
+            ::close(fd);
+        }
+        for (const auto &path : paths)
+        {
+            unlink(path.c_str());
+        }
+    }
+
+    //! Accepts players on the address, see listenOn(). Call it before run().
+    bool listen(const std::string &address)
+    {
+        const int fd = listenOn(address);
+        if (fd < 0)
+            return false;
+        listeners.push_back(fd);
+        if (address.compare(0, 5, "unix:") == 0)
+            paths.push_back(address.substr(5));
+        return true;
+    }
+
+    //! Serves on that many threads, one per core with 0, until stop().
+    void run(unsigned count = 0)
+    {
+        if (count == 0)
+            count = std::max(1u, std::thread::hardware_concurrency());
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping)
+                return;
+            for (unsigned i = 0; i < count; ++i)
+            {
+                workers.emplace_back(new Worker(*this));
+            }
+        }
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < count; ++i)
+        {
+            threads.emplace_back(&Worker::run, workers[i].get());
+        }
+        workers[0]->run();
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        workers.clear();
+    }
+
+    //! Serves until SIGINT or SIGTERM, which are blocked in every thread of the server.
+    void runUntilSignal(unsigned count = 0)
+    {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        std::thread serving(&Server::run, this, count);
+        int signal = 0;
+        sigwait(&signals, &signal);
+        stop();
+        serving.join();
+    }
+
+    //! Makes run() return, from any thread. Open connections are closed.
+    void stop()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        const std::uint64_t one = 1;
+        for (const auto &worker : workers)
+        {
+            if (::write(worker->wake, &one, sizeof(one)) < 0)
+                std::cerr << "SStory(EE): cannot wake a server worker\n";
+        }
+    }
+
+    ServerStats stats() const
+    {
+        return ServerStats{accepted, open, answers, expired, finished, paused};
+    }
+};
+
+} // namespace SStory;
+
+#endif // SServer_h
@@ -3,17 +3,53 @@
  * 
  * Author: Santiago Quintero
  * Released under The MIT License
+ *
+ * Sounds go through SSound::MASTER to one Backend, chosen at runtime:
+ *
+ *   openal        the sound device, through OpenAL and ALUT (the default).
+ *   null          plays nothing, records what would have played.
+ *   capture:PATH  plays nothing, writes one line per sound to PATH.
+ *
+ * The program picks one with MASTER.select() or MASTER.use(), otherwise the
+ * SSOUND_BACKEND environment variable does. Nothing is created before the
+ * first sound, a process that never plays one never probes the device.
+ * Building with SSOUND_NO_OPENAL leaves OpenAL out, and null is the default.
+ *
+ * Samples come from SSound::ASSETS: sounds.sspk next to the executable (see
+ * spack.h), or the pack in SSOUND_PACK, played straight from its mapping.
+ * Samples not in a pack are read from the sounds directory next to the
+ * executable. SSOUND_DIR names another directory, and then only the pack in
+ * SSOUND_PACK, if any, is looked at.
  */
 
 #ifndef SSound_h
 #define SSound_h
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <unistd.h>
+
+#include "spack.h"
+#include "strace.h"
+
+#ifndef SSOUND_NO_OPENAL
 // OpenAl libraries
 #include <AL/alut.h>
+#endif // SSOUND_NO_OPENAL
 
 namespace SSound
 {
@@ -26,17 +62,484 @@ constexpr bool show_errors = true;
 
 struct Point
 {
-    ALfloat x;
-    ALfloat y;
-    ALfloat z;
+    float x;
+    float y;
+    float z;
+};
+
+struct Wave
+{
+    //! PCM data decoded from a WAV file, without touching OpenAL.
+    //! Safe to build from any thread.
+    int channels = 0;
+    int bits = 0;
+    int frequency = 0;
+    std::vector<char> data;
+
+    //! Reads an uncompressed 8 or 16 bits, mono or stereo, WAV file.
+    //! Returns false for anything else, ALUT can still decode those.
+    bool load(const std::string &path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::uint32_t size = 0;
+        if (!header(in, size))
+            return false;
+        data.resize(size);
+        return static_cast<bool>(in.read(data.data(), size));
+    }
+
+    WaveView view() const
+    {
+        WaveView v;
+        v.channels = channels;
+        v.bits = bits;
+        v.frequency = frequency;
+        v.data = data.data();
+        v.size = data.size();
+        return v;
+    }
+
+    //! Parses the chunks up to the sample data, leaving the stream right at it.
+    bool header(std::istream &in, std::uint32_t &dataSize)
+    {
+        char riff[12];
+        if (!in.read(riff, sizeof(riff)) || std::memcmp(riff, "RIFF", 4) != 0 || std::memcmp(riff + 8, "WAVE", 4) != 0)
+            return false;
+
+        char header[8];
+        while (in.read(header, sizeof(header)))
+        {
+            const std::uint32_t size = le32(header + 4);
+            if (std::memcmp(header, "fmt ", 4) == 0)
+            {
+                char fmt[16];
+                if (size < sizeof(fmt) || !in.read(fmt, sizeof(fmt)) || le16(fmt) != 1)
+                    return false;
+                channels = le16(fmt + 2);
+                frequency = static_cast<int>(le32(fmt + 4));
+                bits = le16(fmt + 14);
+                in.seekg(size - sizeof(fmt) + (size & 1), std::ios::cur);
+            }
+            else if (std::memcmp(header, "data", 4) == 0)
+            {
+                if ((channels != 1 && channels != 2) || (bits != 8 && bits != 16))
+                    return false;
+                dataSize = size;
+                return true;
+            }
+            else
+            {
+                in.seekg(size + (size & 1), std::ios::cur);
+            }
+        }
+        return false;
+    }
+
+  private:
+    static std::uint32_t le16(const char *p)
+    {
+        const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+        return b[0] | (b[1] << 8);
+    }
+
+    static std::uint32_t le32(const char *p)
+    {
+        const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+        return b[0] | (b[1] << 8) | (b[2] << 16) | (static_cast<std::uint32_t>(b[3]) << 24);
+    }
+};
+
+enum class Channel
+{
+    background,
+    right,
+    left,
+    center
+};
+
+enum class Sample
+{
+    attack,
+    birds,
+    driving,
+    engine_off,
+    engine_on,
+    forest,
+    growl,
+    gun,
+    howl,
+    piano,
+    river,
+    walking,
+    wolf,
+    carby
+};
+
+constexpr int SAMPLE_COUNT = static_cast<int>(Sample::carby) + 1;
+constexpr int CHANNEL_COUNT = static_cast<int>(Channel::center) + 1;
+
+//! Name of the sample as written in story scripts.
+inline const char *name(Sample sample)
+{
+    static const char *const names[] = {
+        "attack", "birds", "driving", "engine_off", "engine_on", "forest", "growl",
+        "gun", "howl", "piano", "river", "walking", "wolf", "carby"};
+    return names[static_cast<int>(sample)];
+}
+
+//! Name of the channel as written in story scripts.
+inline const char *name(Channel channel)
+{
+    static const char *const names[] = {"background", "right", "left", "center"};
+    return names[static_cast<int>(channel)];
+}
+
+//! File of the sample, relative to the sounds directory.
+inline const char *file(Sample sound)
+{
+    static const char *const files[] = {
+        "attack.wav",
+        "birds.wav",
+        "driving.wav",
+        "engine_off.wav",
+        "engine_on.wav",
+        "forest.wav",
+        "growl.wav",
+        "gun1.wav",
+        "howl.wav",
+        "piano.wav",
+        "river.wav",
+        "walking.wav",
+        "wolf.wav",
+        "win_car_by.wav"};
+    return files[static_cast<int>(sound)];
+}
+
+//! Directory of the running executable, with a trailing slash. Empty if unknown.
+inline std::string executableDirectory()
+{
+    char path[4096];
+    const ssize_t size = readlink("/proc/self/exe", path, sizeof(path));
+    if (size <= 0 || static_cast<std::size_t>(size) == sizeof(path))
+        return std::string();
+    const std::string exe(path, size);
+    return exe.substr(0, exe.rfind('/') + 1);
+}
+
+class Assets
+{
+    //! Where the samples come from: a sound pack if there is one, WAV files in a
+    //! directory for those it lacks. Nothing is looked for before the first sound.
+    //! Only the playing thread may call it before that.
+  private:
+    SoundPack pack;
+    int ids[SAMPLE_COUNT];
+    std::string directory;
+    bool ready = false;
+
+    void init()
+    {
+        if (ready)
+            return;
+        ready = true;
+        const std::string here = executableDirectory();
+        const char *path = std::getenv("SSOUND_PACK");
+        if (path)
+            open(path);
+        else if (!std::getenv("SSOUND_DIR") && access((here + "sounds.sspk").c_str(), R_OK) == 0)
+            open(here + "sounds.sspk");
+        else
+            index();
+    }
+
+    void index()
+    {
+        for (int i = 0; i < SAMPLE_COUNT; ++i)
+        {
+            ids[i] = pack.find(name(static_cast<Sample>(i)));
+        }
+    }
+
+  public:
+    Assets() {}
+    Assets(const Assets &) = delete;
+    Assets &operator=(const Assets &) = delete;
+
+    //! Plays the samples of the pack, returns false and keeps none on errors.
+    //! Call it before the first sound, samples already loaded stay.
+    bool open(const std::string &path)
+    {
+        ready = true;
+        const bool opened = pack.open(path);
+        index();
+        return opened;
+    }
+
+    //! Directory of the samples missing from the pack.
+    void setDirectory(const std::string &path)
+    {
+        directory = path.empty() || path.back() == '/' ? path : path + '/';
+    }
+
+    //! Every sample of the pack, by id or by name, including those outside the Sample enum.
+    const SoundPack &samples()
+    {
+        init();
+        return pack;
+    }
+
+    //! PCM of the sample, valid for the life of the program. False if it is not packed.
+    bool packed(Sample sound, WaveView &wave)
+    {
+        init();
+        const int id = ids[static_cast<int>(sound)];
+        if (id < 0)
+            return false;
+        wave = pack.wave(static_cast<std::uint32_t>(id));
+        return true;
+    }
+
+    //! Asks the kernel to read a packed sample ahead, returns false if it is not packed.
+    bool willNeed(Sample sound)
+    {
+        init();
+        const int id = ids[static_cast<int>(sound)];
+        if (id >= 0)
+            pack.willNeed(static_cast<std::uint32_t>(id));
+        return id >= 0;
+    }
+
+    //! File of a sample that is not packed.
+    std::string path(Sample sound)
+    {
+        if (directory.empty())
+        {
+            const char *dir = std::getenv("SSOUND_DIR");
+            setDirectory(dir ? dir : executableDirectory() + "sounds/");
+        }
+        return directory + file(sound);
+    }
+};
+
+static Assets ASSETS;
+
+inline bool parse(const std::string &text, Sample &out)
+{
+    for (int i = 0; i < SAMPLE_COUNT; ++i)
+    {
+        if (text == name(static_cast<Sample>(i)))
+        {
+            out = static_cast<Sample>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool parse(const std::string &text, Channel &out)
+{
+    for (int i = 0; i < CHANNEL_COUNT; ++i)
+    {
+        if (text == name(static_cast<Channel>(i)))
+        {
+            out = static_cast<Channel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct PlayOptions
+{
+    //! How a sample is played on a voice of the SoundMaster pool.
+    Point position;
+    float gain;
+    int priority; // When the pool is full, the lowest priority, then the oldest, voice is stolen.
+    bool loop;
+    int group;    // Voices of the same group >= 0 replace each other, -1 to always overlap.
+    bool stream;  // Read from disk while playing instead of decoding it whole, for long tracks.
+};
+
+//! The channels are presets: background music loops and replaces itself, effects overlap.
+inline PlayOptions preset(Channel channel)
+{
+    switch (channel)
+    {
+    case Channel::background:
+        return PlayOptions{{0.0, 0.0, 0.0}, 1.0f, 2, true, 0, true};
+    case Channel::right:
+        return PlayOptions{{1.0, 1.0, 0.0}, 1.0f, 1, false, -1, false};
+    case Channel::left:
+        return PlayOptions{{-1.0, 1.0, 0.0}, 1.0f, 1, false, -1, false};
+    case Channel::center:
+    default:
+        return PlayOptions{{0.0, 0.0, 0.0}, 1.0f, 1, false, -1, false};
+    }
+}
+
+struct CacheStats
+{
+    //! Counters of the SoundMaster sample cache.
+    std::size_t hits;
+    std::size_t misses;
+    std::size_t evictions;
+    std::size_t prefetched; // Decoded in background before being needed.
+    std::size_t bytes;      // Currently resident.
 };
 
+class Backend
+{
+    //! Where SoundMaster sends the sounds. Nothing is opened before the first call.
+  public:
+    virtual ~Backend() {}
+
+    //! Returns the voice playing the sample, or -1 if none does.
+    virtual int play(Sample sound, const PlayOptions &options) = 0;
+    virtual void stop(int voice) = 0;
+
+    //! Hints that the sample will be played soon.
+    virtual void prefetch(Sample) {}
+
+    //! Runs on the playing thread between sounds.
+    virtual void pump() {}
+};
+
+enum class SoundEventKind
+{
+    play,
+    stop
+};
+
+struct SoundEvent
+{
+    //! One call received by a NullBackend.
+    SoundEventKind kind;
+    Sample sample;       // Only for play.
+    PlayOptions options; // Only for play.
+    int voice;
+};
+
+class NullBackend : public Backend
+{
+    //! Plays nothing and keeps what it was asked to play, for headless runs and tests.
+    //! Once limit events are kept the next ones are only counted.
+  private:
+    std::size_t limit;
+    std::uint64_t voices = 0;
+
+  public:
+    std::vector<SoundEvent> events;
+    std::uint64_t plays = 0;
+
+    explicit NullBackend(std::size_t max = 65536)
+        : limit(max) {}
+
+    int play(Sample sound, const PlayOptions &options) override
+    {
+        const int voice = options.stream ? -1 : static_cast<int>(voices++ % 1024);
+        ++plays;
+        if (events.size() < limit)
+            events.push_back(SoundEvent{SoundEventKind::play, sound, options, voice});
+        return voice;
+    }
+
+    void stop(int voice) override
+    {
+        if (events.size() < limit)
+            events.push_back(SoundEvent{SoundEventKind::stop, Sample::attack, PlayOptions(), voice});
+    }
+};
+
+class CaptureBackend : public Backend
+{
+    //! Plays nothing and writes every sound to a file, one line each:
+    //!   0.000 play driving voice 0 gain 1 loop 0 stream 0 at 0 0 0
+    //!   2.317 stop voice 0
+    //! Seconds count from the first sound. The file is created by the first sound.
+  private:
+    std::string path;
+    std::ofstream out;
+    std::chrono::steady_clock::time_point start;
+    std::uint64_t plays = 0;
+    std::uint64_t voices = 0;
+
+    bool open()
+    {
+        if (!out.is_open())
+        {
+            out.open(path, std::ios::trunc);
+            start = std::chrono::steady_clock::now();
+            if (!out)
+                std::cerr << "SSound(EE): cannot write " << path << '\n';
+        }
+        return static_cast<bool>(out);
+    }
+
+    double seconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+  public:
+    explicit CaptureBackend(std::string file)
+        : path(std::move(file)) {}
+
+    int play(Sample sound, const PlayOptions &options) override
+    {
+        const int voice = options.stream ? -1 : static_cast<int>(voices++ % 1024);
+        ++plays;
+        if (open())
+        {
+            out << std::fixed;
+            out.precision(3);
+            out << seconds() << " play " << name(sound) << " voice " << voice;
+            out.unsetf(std::ios::floatfield);
+            out << " gain " << options.gain << " loop " << options.loop << " stream " << options.stream << " at "
+                << options.position.x << ' ' << options.position.y << ' ' << options.position.z << std::endl;
+        }
+        return voice;
+    }
+
+    void stop(int voice) override
+    {
+        if (open())
+        {
+            out << std::fixed;
+            out.precision(3);
+            out << seconds() << " stop voice " << voice << std::endl;
+        }
+    }
+};
+
+#ifndef SSOUND_NO_OPENAL
+
+//! OpenAL format of the PCM data of a Wave.
+inline ALenum alFormat(const WaveView &wave)
+{
+    if (wave.channels == 1)
+        return wave.bits == 8 ? AL_FORMAT_MONO8 : AL_FORMAT_MONO16;
+    return wave.bits == 8 ? AL_FORMAT_STEREO8 : AL_FORMAT_STEREO16;
+}
+
 class Buffer
 {
   public:
     // Buffer to hold sound data
     ALuint buffer;
 
+    //! Uploads already decoded data, must run on the thread owning the context.
+    Buffer(const WaveView &wave)
+    {
+        alGenBuffers(1, &buffer);
+        alBufferData(buffer, alFormat(wave), wave.data, static_cast<ALsizei>(wave.size),
+                     static_cast<ALsizei>(wave.frequency));
+        const ALenum error = alGetError();
+        if (show_errors && error != AL_NO_ERROR)
+        {
+            std::cerr << "AL(EE): alBufferData failed with " << error << '\n';
+        }
+    }
+
     Buffer(const std::string &path)
     {
         // Load wav data into buffer.
@@ -47,6 +550,14 @@ class Buffer
             std::cerr << "ALUT(EE): " << alutGetErrorString(error) << " for file: " << path << '\n';
         }
     }
+
+    //! Bytes of sound data held by the buffer.
+    std::size_t size() const
+    {
+        ALint bytes = 0;
+        alGetBufferi(buffer, AL_SIZE, &bytes);
+        return static_cast<std::size_t>(bytes);
+    }
 };
 
 class Source
@@ -74,9 +585,9 @@ class Source
             alSourcei(source, AL_LOOPING, AL_FALSE);
     }
 
-    ALboolean addBuffer(const Buffer &sbuffer) const
+    ALboolean addBuffer(ALuint sbuffer) const
     {
-        alSourcei(source, AL_BUFFER, sbuffer.buffer);
+        alSourcei(source, AL_BUFFER, sbuffer);
 
         // Do another error check and return.
         if (alGetError() != AL_NO_ERROR)
@@ -89,6 +600,22 @@ class Source
         alSourcei(source, AL_BUFFER, 0);
     }
 
+    void place(Point position)
+    {
+        pos = position;
+        alSource3f(source, AL_POSITION, pos.x, pos.y, pos.z);
+    }
+
+    void setGain(ALfloat gain) const
+    {
+        alSourcef(source, AL_GAIN, gain);
+    }
+
+    void setLooping(bool loop) const
+    {
+        alSourcei(source, AL_LOOPING, loop ? AL_TRUE : AL_FALSE);
+    }
+
     void stop() const
     {
         alSourceStop(source);
@@ -98,6 +625,13 @@ class Source
     {
         alSourcePlay(source);
     }
+
+    ALint state() const
+    {
+        ALint value = AL_STOPPED;
+        alGetSourcei(source, AL_SOURCE_STATE, &value);
+        return value;
+    }
 };
 
 class Listener
@@ -117,101 +651,926 @@ class Listener
     }
 };
 
-enum class Channel
+class Streamer
 {
-    background,
-    right,
-    left,
-    center
-};
+    //! Plays long tracks straight from disk through a small ring of queued buffers.
+    //! A worker thread opens files, refills and requeues buffers and crossfades
+    //! between two decks, so switching tracks never blocks the caller.
+    //!
+    //! The worker uploads with alBufferData() itself, on purpose. alutInit() makes
+    //! the context current for the whole process, not per thread, and OpenAL Soft
+    //! and Apple's OpenAL lock the context and the buffer list on every call, so
+    //! calls from two threads are serialized. The worker only touches its two
+    //! sources and their RING buffers, created in init() before it starts and
+    //! deleted in shutdown() after it joins, and never checks alGetError(), so it
+    //! cannot take an error raised by the game thread. Uploading from pump()
+    //! instead would starve the music whenever the front-end blocks on std::cin
+    //! between pumps, as Graph::play() and LiveStory::play() do.
+  private:
+    static const int RING = 4;
+    static const std::size_t CHUNK = 32 * 1024;
 
-enum class Sample
-{
-    attack,
-    birds,
-    driving,
-    engine_off,
-    engine_on,
-    forest,
-    growl,
-    gun,
-    howl,
-    piano,
-    river,
-    walking,
-    wolf,
-    carby
+    struct Deck
+    {
+        ALuint source = 0;
+        ALuint buffers[RING];
+        std::ifstream file;
+        const char *memory = nullptr; // Packed samples play from the mapping instead of file.
+        std::streamoff dataStart = 0;
+        std::uint32_t dataSize = 0;
+        std::uint32_t remaining = 0;
+        ALenum format = 0;
+        ALsizei frequency = 0;
+        std::size_t frame = 1; // Bytes per frame, chunks are cut at whole frames.
+        bool active = false;
+        bool loop = false;
+        ALfloat from = 0.0f;
+        ALfloat to = 0.0f;
+        std::chrono::steady_clock::time_point fadeStart;
+    };
+
+    struct Request
+    {
+        std::string path;
+        WaveView wave; // Without data the track is read from path.
+        PlayOptions options;
+        bool stop;
+    };
+
+    Deck decks[2];
+    int current = 0;
+    std::vector<char> chunk;
+    std::atomic<float> crossfade{1.5f};
+    bool ready = false;
+
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::list<Request> requests; // A list, unlike a deque, allocates nothing until used.
+    bool stopping = false;
+
+    //! Fills one buffer, wrapping around at the end of looping tracks. False once drained.
+    bool fill(Deck &deck, ALuint buffer)
+    {
+        if (deck.memory != nullptr)
+        {
+            if (deck.remaining == 0 && deck.loop)
+                deck.remaining = deck.dataSize;
+            std::size_t size = deck.remaining < CHUNK ? deck.remaining : CHUNK;
+            size -= size % deck.frame;
+            if (size == 0)
+            {
+                deck.remaining = 0;
+                return false;
+            }
+            alBufferData(buffer, deck.format, deck.memory + (deck.dataSize - deck.remaining), static_cast<ALsizei>(size),
+                         deck.frequency);
+            deck.remaining -= static_cast<std::uint32_t>(size);
+            return true;
+        }
+        std::size_t size = 0;
+        while (size < CHUNK)
+        {
+            if (deck.remaining == 0)
+            {
+                if (!deck.loop || deck.dataSize == 0)
+                    break;
+                deck.file.clear();
+                deck.file.seekg(deck.dataStart);
+                deck.remaining = deck.dataSize;
+            }
+            const std::size_t wanted = std::min<std::size_t>(CHUNK - size, deck.remaining);
+            deck.file.read(chunk.data() + size, wanted);
+            const std::size_t got = static_cast<std::size_t>(deck.file.gcount());
+            size += got;
+            deck.remaining -= static_cast<std::uint32_t>(got);
+            if (got < wanted)
+                deck.remaining = 0;
+        }
+        // A torn last frame would make alBufferData() fail.
+        size -= size % deck.frame;
+        if (size == 0)
+            return false;
+        alBufferData(buffer, deck.format, chunk.data(), static_cast<ALsizei>(size), deck.frequency);
+        return true;
+    }
+
+    void fade(Deck &deck, ALfloat to)
+    {
+        deck.from = currentGain(deck);
+        deck.to = to;
+        deck.fadeStart = std::chrono::steady_clock::now();
+    }
+
+    ALfloat currentGain(const Deck &deck) const
+    {
+        const float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - deck.fadeStart).count();
+        const float seconds = crossfade;
+        const float t = seconds > 0.0f ? std::min(1.0f, elapsed / seconds) : 1.0f;
+        return deck.from + (deck.to - deck.from) * t;
+    }
+
+    void halt(Deck &deck)
+    {
+        alSourceStop(deck.source);
+        alSourcei(deck.source, AL_BUFFER, 0);
+        deck.file.close();
+        deck.memory = nullptr;
+        deck.active = false;
+    }
+
+    void start(const Request &request)
+    {
+        Deck &old = decks[current];
+        if (request.stop)
+        {
+            if (old.active)
+                fade(old, 0.0f);
+            return;
+        }
+
+        current = 1 - current;
+        Deck &deck = decks[current];
+        if (deck.active)
+            halt(deck);
+        WaveView view = request.wave;
+        if (view.data != nullptr)
+        {
+            deck.memory = view.data;
+            deck.dataSize = static_cast<std::uint32_t>(view.size);
+        }
+        else
+        {
+            deck.file.open(request.path, std::ios::binary);
+            Wave wave;
+            if (!wave.header(deck.file, deck.dataSize))
+            {
+                if (show_errors)
+                    std::cerr << "SSound(EE): cannot stream " << request.path << '\n';
+                deck.file.close();
+                current = 1 - current;
+                return;
+            }
+            deck.dataStart = deck.file.tellg();
+            view = wave.view();
+        }
+        deck.remaining = deck.dataSize;
+        deck.format = alFormat(view);
+        deck.frequency = static_cast<ALsizei>(view.frequency);
+        deck.frame = std::max<std::size_t>(1, view.channels * view.bits / 8);
+        deck.loop = request.options.loop;
+        deck.active = true;
+
+        int queued = 0;
+        while (queued < RING && fill(deck, deck.buffers[queued]))
+        {
+            ++queued;
+        }
+        alSourceQueueBuffers(deck.source, queued, deck.buffers);
+        alSource3f(deck.source, AL_POSITION, request.options.position.x, request.options.position.y, request.options.position.z);
+        deck.from = deck.to = old.active ? 0.0f : request.options.gain;
+        if (old.active)
+        {
+            fade(deck, request.options.gain);
+            fade(old, 0.0f);
+        }
+        alSourcef(deck.source, AL_GAIN, deck.from);
+        alSourcePlay(deck.source);
+    }
+
+    void service(Deck &deck)
+    {
+        ALint processed = 0;
+        alGetSourcei(deck.source, AL_BUFFERS_PROCESSED, &processed);
+        while (processed-- > 0)
+        {
+            ALuint buffer = 0;
+            alSourceUnqueueBuffers(deck.source, 1, &buffer);
+            if (fill(deck, buffer))
+                alSourceQueueBuffers(deck.source, 1, &buffer);
+        }
+
+        const ALfloat gain = currentGain(deck);
+        alSourcef(deck.source, AL_GAIN, gain);
+        if (deck.to == 0.0f && gain == 0.0f)
+        {
+            halt(deck);
+            return;
+        }
+
+        ALint queued = 0;
+        ALint state = AL_STOPPED;
+        alGetSourcei(deck.source, AL_BUFFERS_QUEUED, &queued);
+        alGetSourcei(deck.source, AL_SOURCE_STATE, &state);
+        if (queued == 0)
+            halt(deck);
+        else if (state != AL_PLAYING)
+            alSourcePlay(deck.source); // Recover from an underrun.
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stopping)
+        {
+            while (!requests.empty())
+            {
+                const Request request = requests.front();
+                requests.pop_front();
+                guard.unlock();
+                start(request);
+                guard.lock();
+            }
+            guard.unlock();
+            for (auto &deck : decks)
+            {
+                if (deck.active)
+                    service(deck);
+            }
+            guard.lock();
+            wake.wait_for(guard, std::chrono::milliseconds(10), [this] { return stopping || !requests.empty(); });
+        }
+    }
+
+  public:
+    Streamer() {}
+    Streamer(const Streamer &) = delete;
+    Streamer &operator=(const Streamer &) = delete;
+
+    //! Seconds it takes the new track to replace the old one.
+    void setCrossfade(float seconds)
+    {
+        crossfade = seconds;
+    }
+
+    //! Creates the sources and buffers, call it from the thread owning the context.
+    void init()
+    {
+        if (ready)
+            return;
+        for (auto &deck : decks)
+        {
+            alGenSources(1, &deck.source);
+            alGenBuffers(RING, deck.buffers);
+        }
+        chunk.resize(CHUNK);
+        ready = true;
+        worker = std::thread(&Streamer::run, this);
+    }
+
+    void play(const std::string &path, const PlayOptions &options)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        requests.push_back(Request{path, WaveView(), options, false});
+        wake.notify_one();
+    }
+
+    //! Plays PCM data that stays valid while it plays, like a packed sample.
+    void play(const WaveView &wave, const PlayOptions &options)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        requests.push_back(Request{std::string(), wave, options, false});
+        wake.notify_one();
+    }
+
+    void stop()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        requests.push_back(Request{std::string(), WaveView(), PlayOptions(), true});
+        wake.notify_one();
+    }
+
+    void shutdown()
+    {
+        if (!ready)
+            return;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+        for (auto &deck : decks)
+        {
+            if (deck.active)
+                halt(deck);
+            alDeleteSources(1, &deck.source);
+            alDeleteBuffers(RING, deck.buffers);
+        }
+        ready = false;
+    }
+
+    ~Streamer()
+    {
+        shutdown();
+    }
 };
 
-class SoundMaster
+class OpenALBackend : public Backend
 {
+    //! Owner of the OpenAL context, the sources and a LRU cache of sample buffers.
+    //! Nothing touches the sound device until the first sound is played.
   private:
-    std::vector<Source> sources;
-    std::vector<Buffer> buffers;
-    Listener listener;
-    const std::string base_path = "sounds/"; // Relative to the executable.
+    struct Entry
+    {
+        ALuint buffer = 0;
+        std::size_t bytes = 0;
+        bool loaded = false;
+        std::list<int>::iterator use;
+    };
 
-  public:
-    SoundMaster()
-        : listener({0.0, 0.0, 0.0}, {0.0, 0.0, 0.0})
+    struct Voice
+    {
+        Source source;
+        int sample;   // Attached sample, -1 if none.
+        int priority;
+        int group;
+        std::uint64_t started;
+    };
+
+    std::vector<Voice> voices;
+    std::size_t voiceCount = 16;
+    Streamer streamer;
+    std::uint64_t plays = 0;
+    Entry entries[SAMPLE_COUNT];
+    std::list<int> lru;     // Most recently used sample first.
+    std::size_t budget = 32 * 1024 * 1024;
+    CacheStats counters = {0, 0, 0, 0, 0};
+    bool ready = false;
+
+    // Background loader, everything below is guarded by lock.
+    std::thread loader;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::list<int> pending;    // Samples waiting to be decoded.
+    char requested[SAMPLE_COUNT] = {}; // Queued or decoded, but not uploaded yet.
+    std::string paths[SAMPLE_COUNT];   // Of the queued samples.
+    std::vector<std::pair<int, std::unique_ptr<Wave>>> decoded;
+    bool stopping = false;
+
+    struct Deferred
+    {
+        int sample;
+        PlayOptions options;
+    };
+    std::vector<Deferred> deferred; // Plays waiting for their sample to be decoded, see setDeferMisses().
+    bool deferMisses = false;
+
+    void init()
     {
         alutInit(NULL, NULL);
         alutGetError();
+        Listener({0.0, 0.0, 0.0}, {0.0, 0.0, 0.0});
+        ready = true;
+        resizePool();
+    }
 
-        // Create some sources for later use
-        sources = {
-            Source({0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, true), // Center for bg music
-            Source({1.0, 1.0, 0.0}, {0.0, 0.0, 0.0}),       // Right
-            Source({-1.0, 1.0, 0.0}, {0.0, 0.0, 0.0}),      // Left
-            Source({0.0, 0.0, 0.0}, {0.0, 0.0, 0.0})};      // Center
+    void resizePool()
+    {
+        while (voices.size() > voiceCount)
+        {
+            voices.back().source.stop();
+            alDeleteSources(1, &voices.back().source.source);
+            voices.pop_back();
+        }
+        while (voices.size() < voiceCount)
+        {
+            voices.push_back(Voice{Source({0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}), -1, 0, -1, 0});
+        }
+    }
+
+    bool busy(const Voice &voice) const
+    {
+        return voice.sample >= 0 && voice.source.state() == AL_PLAYING;
+    }
+
+    //! Picks the voice for a new sound: one of the same group, a finished one,
+    //! or the lowest priority and oldest one. Returns -1 if every voice outranks it.
+    int allocate(const PlayOptions &options) const
+    {
+        int victim = -1;
+        for (std::size_t i = 0; i < voices.size(); ++i)
+        {
+            const Voice &voice = voices[i];
+            if (options.group >= 0 && voice.group == options.group && voice.sample >= 0)
+                return static_cast<int>(i);
+        }
+        for (std::size_t i = 0; i < voices.size(); ++i)
+        {
+            const Voice &voice = voices[i];
+            if (!busy(voice))
+                return static_cast<int>(i);
+            if (victim < 0 || voice.priority < voices[victim].priority ||
+                (voice.priority == voices[victim].priority && voice.started < voices[victim].started))
+                victim = static_cast<int>(i);
+        }
+        if (victim >= 0 && voices[victim].priority > options.priority)
+            return -1;
+        return victim;
+    }
+
+    bool playing(int sample) const
+    {
+        for (const auto &voice : voices)
+        {
+            if (voice.sample == sample && busy(voice))
+                return true;
+        }
+        return false;
+    }
 
-        // Load all buffers
-        buffers = {
-            Buffer(base_path + "attack.wav"),
-            Buffer(base_path + "birds.wav"),
-            Buffer(base_path + "driving.wav"),
-            Buffer(base_path + "engine_off.wav"),
-            Buffer(base_path + "engine_on.wav"),
-            Buffer(base_path + "forest.wav"),
-            Buffer(base_path + "growl.wav"),
-            Buffer(base_path + "gun1.wav"),
-            Buffer(base_path + "howl.wav"),
-            Buffer(base_path + "piano.wav"),
-            Buffer(base_path + "river.wav"),
-            Buffer(base_path + "walking.wav"),
-            Buffer(base_path + "wolf.wav"),
-            Buffer(base_path + "win_car_by.wav")};
+    void evict(int sample)
+    {
+        Entry &entry = entries[sample];
+        for (auto &voice : voices)
+        {
+            if (voice.sample == sample)
+            {
+                voice.source.removeBuffer();
+                voice.sample = -1;
+            }
+        }
+        alDeleteBuffers(1, &entry.buffer);
+        lru.erase(entry.use);
+        counters.bytes -= entry.bytes;
+        ++counters.evictions;
+        entry = Entry();
     }
 
-    std::string path(std::string song)
+    void store(int sample, const Buffer &loaded)
     {
-        return base_path + song;
+        Entry &entry = entries[sample];
+        entry.buffer = loaded.buffer;
+        entry.bytes = loaded.size();
+        entry.loaded = true;
+        lru.push_front(sample);
+        entry.use = lru.begin();
+        counters.bytes += entry.bytes;
+        trim(sample);
     }
 
-    void play(Sample sound, Channel channel) const
+    //! Loader thread: decodes queued samples, never calls into OpenAL.
+    void run()
     {
-        const int source = static_cast<int>(channel);
-        const int buffer = static_cast<int>(sound);
+        std::unique_lock<std::mutex> guard(lock);
+        while (true)
+        {
+            wake.wait(guard, [this] { return stopping || !pending.empty(); });
+            if (stopping)
+                return;
+            const int sample = pending.front();
+            pending.pop_front();
+            const std::string path = paths[sample];
+            guard.unlock();
+
+            std::unique_ptr<Wave> wave(new Wave);
+            {
+                STRACE_SCOPE("decode", file(static_cast<Sample>(sample)));
+                if (!wave->load(path))
+                    wave.reset();
+            }
 
-        sources[source].stop();
-        sources[source].addBuffer(buffers[buffer]);
-        sources[source].play();
+            guard.lock();
+            decoded.emplace_back(sample, std::move(wave));
+            done.notify_all();
+        }
     }
 
-    ~SoundMaster()
+    bool isDecoded(int sample) const
     {
-        for (const auto &source : sources)
+        for (const auto &item : decoded)
         {
-            alDeleteSources(1, &(source.source));
+            if (item.first == sample)
+                return true;
         }
-        for (const auto &buffer : buffers)
+        return false;
+    }
+
+    //! Drops the coldest samples not playing right now until the budget is met.
+    void trim(int keep)
+    {
+        auto it = lru.end();
+        while (counters.bytes > budget && it != lru.begin())
         {
-            alDeleteBuffers(1, &(buffer.buffer));
+            const int sample = *--it;
+            if (sample == keep || playing(sample))
+                continue;
+            ++it;
+            evict(sample);
+        }
+    }
+
+  public:
+    OpenALBackend() {}
+
+    //! Maximum bytes of decoded samples kept around, the sample being played always stays.
+    void setBudget(std::size_t bytes)
+    {
+        budget = bytes;
+        if (ready)
+            trim(-1);
+    }
+
+    const CacheStats &stats() const
+    {
+        return counters;
+    }
+
+    //! Asks the loader thread to decode the sample ahead of time.
+    //! Packed samples need no decoding, the kernel reads them ahead instead.
+    void prefetch(Sample sound) override
+    {
+        const int sample = static_cast<int>(sound);
+        if (entries[sample].loaded || ASSETS.willNeed(sound))
+            return;
+        const std::string path = ASSETS.path(sound);
+        std::lock_guard<std::mutex> guard(lock);
+        if (requested[sample])
+            return;
+        requested[sample] = 1;
+        paths[sample] = path;
+        pending.push_back(sample);
+        if (!loader.joinable())
+            loader = std::thread(&OpenALBackend::run, this);
+        wake.notify_one();
+    }
+
+    //! Uploads the samples decoded in background, must run on the thread owning the context.
+    void pump() override
+    {
+        std::vector<std::pair<int, std::unique_ptr<Wave>>> ready_waves;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (decoded.empty())
+                return;
+            ready_waves.swap(decoded);
+        }
+        if (!ready)
+            init();
+        for (const auto &item : ready_waves)
+        {
+            if (!entries[item.first].loaded)
+            {
+                STRACE_SCOPE("upload", file(static_cast<Sample>(item.first)));
+                if (item.second)
+                    store(item.first, Buffer(item.second->view()));
+                else
+                    store(item.first, Buffer(ASSETS.path(static_cast<Sample>(item.first))));
+                ++counters.prefetched;
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            requested[item.first] = 0;
+        }
+        std::vector<Deferred> waiting;
+        waiting.swap(deferred);
+        for (const auto &play : waiting)
+        {
+            if (entries[play.sample].loaded)
+            {
+                start(play.sample, play.options);
+                continue;
+            }
+            // Evicted again by the samples uploaded with it.
+            prefetch(static_cast<Sample>(play.sample));
+            deferred.push_back(play);
+        }
+    }
+
+    //! Returns the buffer for the sample, loading it on a miss.
+    ALuint acquire(Sample sound)
+    {
+        if (!ready)
+            init();
+        pump();
+        const int sample = static_cast<int>(sound);
+        Entry &entry = entries[sample];
+        if (entry.loaded)
+        {
+            ++counters.hits;
+            lru.splice(lru.begin(), lru, entry.use);
+            return entry.buffer;
+        }
+        ++counters.misses;
+        {
+            // A decode already in flight is cheaper to wait for than to repeat.
+            std::unique_lock<std::mutex> guard(lock);
+            if (requested[sample])
+            {
+                auto queued = std::find(pending.begin(), pending.end(), sample);
+                if (queued != pending.end())
+                {
+                    pending.erase(queued);
+                    requested[sample] = 0;
+                }
+                else
+                {
+                    done.wait(guard, [&] { return isDecoded(sample); });
+                }
+            }
+        }
+        pump();
+        WaveView packed;
+        if (!entry.loaded && ASSETS.packed(sound, packed))
+        {
+            STRACE_SCOPE("upload", file(sound));
+            store(sample, Buffer(packed));
+        }
+        else if (!entry.loaded)
+        {
+            STRACE_SCOPE("miss", file(sound));
+            Wave wave;
+            if (wave.load(ASSETS.path(sound)))
+                store(sample, Buffer(wave.view()));
+            else
+                store(sample, Buffer(ASSETS.path(sound)));
+        }
+        return entry.buffer;
+    }
+
+    //! Number of OpenAL sources shared by every sound.
+    void setVoices(std::size_t count)
+    {
+        voiceCount = count > 0 ? count : 1;
+        if (ready)
+            resizePool();
+    }
+
+    //! Seconds of crossfade between streamed tracks.
+    void setCrossfade(float seconds)
+    {
+        streamer.setCrossfade(seconds);
+    }
+
+    //! Plays the sample on a voice of the pool, returns the voice or -1 if it was dropped.
+    //! Streamed samples use no voice of the pool and also return -1.
+    int play(Sample sound, const PlayOptions &options) override
+    {
+        if (options.stream)
+        {
+            if (!ready)
+                init();
+            streamer.init();
+            for (const auto &voice : voices)
+            {
+                // A buffered track of the same group would play on top of the stream.
+                if (options.group >= 0 && voice.group == options.group && voice.sample >= 0)
+                    voice.source.stop();
+            }
+            WaveView packed;
+            if (ASSETS.packed(sound, packed))
+                streamer.play(packed, options);
+            else
+                streamer.play(ASSETS.path(sound), options);
+            return -1;
+        }
+        const int sample = static_cast<int>(sound);
+        WaveView packed;
+        if (deferMisses && !entries[sample].loaded && !ASSETS.packed(sound, packed))
+        {
+            if (!ready)
+                init();
+            ++counters.misses;
+            STRACE(STrace::TRACE.mark("defer", file(sound)));
+            // A later track of the same group replaces one still waiting.
+            deferred.erase(std::remove_if(deferred.begin(), deferred.end(),
+                                          [&options](const Deferred &play) {
+                                              return options.group >= 0 && play.options.group == options.group;
+                                          }),
+                           deferred.end());
+            deferred.push_back(Deferred{sample, options});
+            prefetch(sound);
+            return -1;
+        }
+        acquire(sound);
+        return start(sample, options);
+    }
+
+    //! Plays without waiting on a miss: the play returns -1 and starts from pump() once the
+    //! sample is decoded. Only for front-ends that call pump() every few milliseconds.
+    void setDeferMisses(bool on)
+    {
+        deferMisses = on;
+    }
+
+    void stop(int voice) override
+    {
+        if (voice >= 0 && static_cast<std::size_t>(voice) < voices.size())
+            voices[voice].source.stop();
+    }
+
+  private:
+    //! Puts a loaded sample on a voice of the pool.
+    int start(int sample, const PlayOptions &options)
+    {
+        const int index = allocate(options);
+        if (index < 0)
+            return -1;
+
+        Voice &voice = voices[index];
+        voice.source.stop();
+        voice.source.place(options.position);
+        voice.source.setGain(options.gain);
+        voice.source.setLooping(options.loop);
+        voice.source.addBuffer(entries[sample].buffer);
+        voice.sample = sample;
+        voice.priority = options.priority;
+        voice.group = options.group;
+        voice.started = ++plays;
+        voice.source.play();
+        return index;
+    }
+
+  public:
+    ~OpenALBackend()
+    {
+        streamer.shutdown();
+        if (loader.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            loader.join();
+        }
+        if (!ready)
+            return;
+        for (const auto &voice : voices)
+        {
+            alDeleteSources(1, &(voice.source.source));
+        }
+        for (const auto &entry : entries)
+        {
+            if (entry.loaded)
+                alDeleteBuffers(1, &(entry.buffer));
         }
         alutExit();
     }
 };
 
+#endif // SSOUND_NO_OPENAL
+
+class SoundMaster
+{
+    //! Front of the active Backend, created by the first sound when nobody chose one.
+    //! Cache, voice and crossfade settings are kept for the OpenAL backend.
+  private:
+    std::unique_ptr<Backend> backend;
+    std::size_t budget = 32 * 1024 * 1024;
+    std::size_t voiceCount = 16;
+    float crossfade = 1.5f;
+    bool deferMisses = false;
+#ifndef SSOUND_NO_OPENAL
+    OpenALBackend *openal = nullptr; // The backend, when it is the OpenAL one.
+#endif
+
+    Backend &active()
+    {
+        if (!backend)
+        {
+            const char *name = std::getenv("SSOUND_BACKEND");
+            if (!name || !select(name))
+#ifndef SSOUND_NO_OPENAL
+                select("openal");
+#else
+                select("null");
+#endif
+        }
+        return *backend;
+    }
+
+  public:
+    //! Allocates nothing, a static SoundMaster costs nothing until used.
+    SoundMaster() {}
+
+    //! Replaces the backend, the previous one is shut down.
+    void use(std::unique_ptr<Backend> next)
+    {
+        backend = std::move(next);
+#ifndef SSOUND_NO_OPENAL
+        openal = dynamic_cast<OpenALBackend *>(backend.get());
+        if (openal)
+        {
+            openal->setBudget(budget);
+            openal->setVoices(voiceCount);
+            openal->setCrossfade(crossfade);
+            openal->setDeferMisses(deferMisses);
+        }
+#endif
+    }
+
+    //! Backend by name: openal, null or capture:PATH. Returns false if there is no such backend.
+    bool select(const std::string &name)
+    {
+        if (name == "null")
+        {
+            use(std::unique_ptr<Backend>(new NullBackend()));
+            return true;
+        }
+        if (name.compare(0, 8, "capture:") == 0 && name.size() > 8)
+        {
+            use(std::unique_ptr<Backend>(new CaptureBackend(name.substr(8))));
+            return true;
+        }
+#ifndef SSOUND_NO_OPENAL
+        if (name == "openal")
+        {
+            use(std::unique_ptr<Backend>(new OpenALBackend()));
+            return true;
+        }
+#endif
+        std::cerr << "SSound(EE): no sound backend " << name << '\n';
+        return false;
+    }
+
+    //! Maximum bytes of decoded samples kept around, the sample being played always stays.
+    void setBudget(std::size_t bytes)
+    {
+        budget = bytes;
+#ifndef SSOUND_NO_OPENAL
+        if (openal)
+            openal->setBudget(bytes);
+#endif
+    }
+
+    //! Number of OpenAL sources shared by every sound.
+    void setVoices(std::size_t count)
+    {
+        voiceCount = count;
+#ifndef SSOUND_NO_OPENAL
+        if (openal)
+            openal->setVoices(count);
+#endif
+    }
+
+    //! Seconds of crossfade between streamed tracks.
+    void setCrossfade(float seconds)
+    {
+        crossfade = seconds;
+#ifndef SSOUND_NO_OPENAL
+        if (openal)
+            openal->setCrossfade(seconds);
+#endif
+    }
+
+    //! Plays of samples not decoded yet start from pump() instead of waiting for them.
+    //! Only for front-ends that call pump() every few milliseconds, like Console.
+    void setDeferMisses(bool on)
+    {
+        deferMisses = on;
+#ifndef SSOUND_NO_OPENAL
+        if (openal)
+            openal->setDeferMisses(on);
+#endif
+    }
+
+    //! Counters of the sample cache, all zero unless OpenAL plays the sounds.
+    CacheStats stats() const
+    {
+#ifndef SSOUND_NO_OPENAL
+        if (openal)
+            return openal->stats();
+#endif
+        return CacheStats{0, 0, 0, 0, 0};
+    }
+
+    //! Samples streamed on that channel are skipped, they never get decoded whole.
+    void prefetch(Sample sound, Channel channel)
+    {
+        if (!preset(channel).stream)
+            prefetch(sound);
+    }
+
+    void prefetch(Sample sound)
+    {
+        active().prefetch(sound);
+    }
+
+    void pump()
+    {
+        if (backend)
+            backend->pump();
+    }
+
+    //! Returns the voice playing the sample or -1, see Backend::play().
+    int play(Sample sound, const PlayOptions &options)
+    {
+        return active().play(sound, options);
+    }
+
+    void play(Sample sound, Channel channel)
+    {
+        play(sound, preset(channel));
+    }
+
+    void stop(int voice)
+    {
+        if (backend)
+            backend->stop(voice);
+    }
+};
+
 static SoundMaster MASTER;
 
 class Sound
@@ -224,6 +1583,17 @@ class Sound
   public:
     Sound(Sample sample, Channel channel = Channel::center)
         : sound_type(sample), channel(channel) {}
+
+    Sample sample() const
+    {
+        return sound_type;
+    }
+
+    Channel output() const
+    {
+        return channel;
+    }
+
     void play() const
     {
         MASTER.play(sound_type, channel);
@@ -0,0 +1,288 @@
+/* sstatic.h
+ * Stories declared at compile time, played straight from read-only tables.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * A story is a macro listing its scenes, in the same order a script would:
+ *
+ *   #define MY_STORY(SCENE, TEXT, SOUND, CHOICE, REPLY)                  \
+ *       SCENE(START)                                                     \
+ *       SOUND("Es poco después de las 12 de la noche.", driving, center) \
+ *       TEXT("¿Cuál tomar?")                                             \
+ *       CHOICE(CAM1, "El primer camino")                                 \
+ *       REPLY(END, "Volver", "Decides volver al carro.")                 \
+ *       SCENE(CAM1)                                                      \
+ *       TEXT("Te adentras en el camino.")
+ *
+ *   SSTORY_STATIC(MyStory, MY_STORY)
+ *
+ * TEXT and SOUND start a new ContentBody, CHOICE and REPLY add a choice to the
+ * last one. Labels are enumerators of MyStory, so a choice pointing at a scene
+ * that does not exist, a scene defined twice or a story without START do not
+ * build. MyStory::graph() is a Graph over constexpr arrays: nothing is built
+ * nor allocated before the story is played. These stories have no variables,
+ * conditions and assignments need a Story or a script.
+ */
+
+#ifndef SStatic_h
+#define SStatic_h
+
+#include <cstdint>
+
+#include "sstory.h"
+
+namespace SStory
+{
+
+namespace detail
+{
+
+enum class ItemKind : std::uint8_t
+{
+    scene,
+    block,
+    choice
+};
+
+struct StaticItem
+{
+    //! One line of a static story, its texts are the next one or two pieces of the pool.
+    ItemKind kind;
+    SceneId target;
+    std::int16_t sample;
+    std::int16_t channel;
+    std::uint32_t size;
+    std::uint32_t complement; // NO_TEXT when the choice has none.
+};
+
+template <std::uint32_t... I>
+struct Indices
+{
+};
+
+template <class A, class B>
+struct Concat;
+
+template <std::uint32_t... A, std::uint32_t... B>
+struct Concat<Indices<A...>, Indices<B...>>
+{
+    typedef Indices<A..., (sizeof...(A) + B)...> type;
+};
+
+//! 0 ... N-1, built in halves so long stories stay far from the instantiation depth limit.
+template <std::uint32_t N>
+struct MakeIndices
+{
+    typedef typename Concat<typename MakeIndices<N / 2>::type, typename MakeIndices<N - N / 2>::type>::type type;
+};
+
+template <>
+struct MakeIndices<0>
+{
+    typedef Indices<> type;
+};
+
+template <>
+struct MakeIndices<1>
+{
+    typedef Indices<0> type;
+};
+
+// C++11 constexpr functions are a single return: everything below splits its
+// range in halves, so the recursion is as deep as the log of the story size.
+
+constexpr std::uint32_t countOf(const StaticItem *items, std::uint32_t lo, std::uint32_t hi, ItemKind kind)
+{
+    return hi - lo == 0   ? 0
+           : hi - lo == 1 ? (items[lo].kind == kind ? 1 : 0)
+                          : countOf(items, lo, lo + (hi - lo) / 2, kind) + countOf(items, lo + (hi - lo) / 2, hi, kind);
+}
+
+//! Bytes of pool used by the items in [lo, hi).
+constexpr std::uint32_t textOf(const StaticItem *items, std::uint32_t lo, std::uint32_t hi)
+{
+    return hi - lo == 0   ? 0
+           : hi - lo == 1 ? items[lo].size + (items[lo].complement == NO_TEXT ? 0 : items[lo].complement)
+                          : textOf(items, lo, lo + (hi - lo) / 2) + textOf(items, lo + (hi - lo) / 2, hi);
+}
+
+//! Index of the k-th item of the kind in [lo, hi).
+constexpr std::uint32_t nth(const StaticItem *items, std::uint32_t lo, std::uint32_t hi, ItemKind kind, std::uint32_t k)
+{
+    return hi - lo == 1 ? lo
+           : k < countOf(items, lo, lo + (hi - lo) / 2, kind)
+               ? nth(items, lo, lo + (hi - lo) / 2, kind, k)
+               : nth(items, lo + (hi - lo) / 2, hi, kind, k - countOf(items, lo, lo + (hi - lo) / 2, kind));
+}
+
+//! Choices right after item i, the ones of its ContentBody.
+constexpr std::uint32_t choicesAfter(const StaticItem *items, std::uint32_t n, std::uint32_t i)
+{
+    return i + 1 < n && items[i + 1].kind == ItemKind::choice ? 1 + choicesAfter(items, n, i + 1) : 0;
+}
+
+//! Starts with a scene and every choice follows a text.
+constexpr bool wellFormed(const StaticItem *items, std::uint32_t lo, std::uint32_t hi)
+{
+    return hi - lo == 0   ? true
+           : hi - lo == 1 ? (lo == 0 ? items[0].kind == ItemKind::scene
+                                     : items[lo].kind != ItemKind::choice || items[lo - 1].kind != ItemKind::scene)
+                          : wellFormed(items, lo, lo + (hi - lo) / 2) && wellFormed(items, lo + (hi - lo) / 2, hi);
+}
+
+constexpr SceneEntry sceneEntry(const StaticItem *items, std::uint32_t i, std::uint32_t next)
+{
+    return SceneEntry{TextRef{textOf(items, 0, i), items[i].size}, countOf(items, 0, i, ItemKind::block),
+                      countOf(items, i, next, ItemKind::block)};
+}
+
+constexpr SceneEntry sceneAt(const StaticItem *items, std::uint32_t n, std::uint32_t k)
+{
+    return sceneEntry(items, nth(items, 0, n, ItemKind::scene, k),
+                      k + 1 < countOf(items, 0, n, ItemKind::scene) ? nth(items, 0, n, ItemKind::scene, k + 1) : n);
+}
+
+constexpr BlockEntry blockEntry(const StaticItem *items, std::uint32_t n, std::uint32_t i)
+{
+    return BlockEntry{TextRef{textOf(items, 0, i), items[i].size}, countOf(items, 0, i, ItemKind::choice),
+                      choicesAfter(items, n, i), items[i].sample, items[i].channel, NO_CODE, 0, 0};
+}
+
+constexpr BlockEntry blockAt(const StaticItem *items, std::uint32_t n, std::uint32_t k)
+{
+    return blockEntry(items, n, nth(items, 0, n, ItemKind::block, k));
+}
+
+constexpr ChoiceEntry choiceEntry(const StaticItem *items, std::uint32_t i)
+{
+    return ChoiceEntry{items[i].target, TextRef{textOf(items, 0, i), items[i].size},
+                       items[i].complement == NO_TEXT
+                           ? NO_REF
+                           : TextRef{textOf(items, 0, i) + items[i].size, items[i].complement},
+                       NO_CODE, NO_CODE};
+}
+
+constexpr ChoiceEntry choiceAt(const StaticItem *items, std::uint32_t n, std::uint32_t k)
+{
+    return choiceEntry(items, nth(items, 0, n, ItemKind::choice, k));
+}
+
+// Tables are one entry longer than needed, a story without choices still has a valid array.
+
+template <class Story, class = typename MakeIndices<countOf(Story::items, 0, Story::size, ItemKind::scene)>::type>
+struct SceneTable;
+
+template <class Story, std::uint32_t... I>
+struct SceneTable<Story, Indices<I...>>
+{
+    static constexpr std::uint32_t size = sizeof...(I);
+    static constexpr SceneEntry table[sizeof...(I) + 1] = {sceneAt(Story::items, Story::size, I)..., SceneEntry{}};
+};
+
+template <class Story, std::uint32_t... I>
+constexpr SceneEntry SceneTable<Story, Indices<I...>>::table[sizeof...(I) + 1];
+
+template <class Story, class = typename MakeIndices<countOf(Story::items, 0, Story::size, ItemKind::block)>::type>
+struct BlockTable;
+
+template <class Story, std::uint32_t... I>
+struct BlockTable<Story, Indices<I...>>
+{
+    static constexpr std::uint32_t size = sizeof...(I);
+    static constexpr BlockEntry table[sizeof...(I) + 1] = {blockAt(Story::items, Story::size, I)..., BlockEntry{}};
+};
+
+template <class Story, std::uint32_t... I>
+constexpr BlockEntry BlockTable<Story, Indices<I...>>::table[sizeof...(I) + 1];
+
+template <class Story, class = typename MakeIndices<countOf(Story::items, 0, Story::size, ItemKind::choice)>::type>
+struct ChoiceTable;
+
+template <class Story, std::uint32_t... I>
+struct ChoiceTable<Story, Indices<I...>>
+{
+    static constexpr std::uint32_t size = sizeof...(I);
+    static constexpr ChoiceEntry table[sizeof...(I) + 1] = {choiceAt(Story::items, Story::size, I)..., ChoiceEntry{}};
+};
+
+template <class Story, std::uint32_t... I>
+constexpr ChoiceEntry ChoiceTable<Story, Indices<I...>>::table[sizeof...(I) + 1];
+
+//! View over the tables of a static story, the only code run at launch.
+template <class Story>
+inline Graph staticGraph(SceneId start)
+{
+    Graph g;
+    g.scenes = SceneTable<Story>::table;
+    g.blocks = BlockTable<Story>::table;
+    g.choices = ChoiceTable<Story>::table;
+    g.pool = Story::pool;
+    g.nScenes = SceneTable<Story>::size;
+    g.nBlocks = BlockTable<Story>::size;
+    g.nChoices = ChoiceTable<Story>::size;
+    g.poolSize = sizeof(Story::pool) - 1;
+    g.start = start;
+    return g;
+}
+
+} // namespace detail
+
+} // namespace SStory;
+
+// Every line of the story list is expanded once per table, each time with other meanings.
+
+#define SSTORY_LABEL_(label) label,
+#define SSTORY_NONE1_(a)
+#define SSTORY_NONE2_(a, b)
+#define SSTORY_NONE3_(a, b, c)
+
+#define SSTORY_ITEM_SCENE_(label) \
+    {SStory::detail::ItemKind::scene, label, -1, 0, sizeof(#label) - 1, SStory::NO_TEXT},
+#define SSTORY_ITEM_TEXT_(text) \
+    {SStory::detail::ItemKind::block, SStory::END_SCENE, -1, 0, sizeof(text) - 1, SStory::NO_TEXT},
+#define SSTORY_ITEM_SOUND_(text, sample, channel)                                                  \
+    {SStory::detail::ItemKind::block, SStory::END_SCENE, static_cast<std::int16_t>(SSound::Sample::sample), \
+     static_cast<std::int16_t>(SSound::Channel::channel), sizeof(text) - 1, SStory::NO_TEXT},
+#define SSTORY_ITEM_CHOICE_(target, text) \
+    {SStory::detail::ItemKind::choice, target, -1, 0, sizeof(text) - 1, SStory::NO_TEXT},
+#define SSTORY_ITEM_REPLY_(target, text, complement) \
+    {SStory::detail::ItemKind::choice, target, -1, 0, sizeof(text) - 1, sizeof(complement) - 1},
+
+#define SSTORY_POOL_SCENE_(label) #label
+#define SSTORY_POOL_TEXT_(text) text
+#define SSTORY_POOL_SOUND_(text, sample, channel) text
+#define SSTORY_POOL_CHOICE_(target, text) text
+#define SSTORY_POOL_REPLY_(target, text, complement) text complement
+
+//! Declares namespace Name with the labels of the story, its tables and graph().
+#define SSTORY_STATIC(Name, STORY)                                                                               \
+    namespace Name                                                                                               \
+    {                                                                                                            \
+    enum Label : SStory::SceneId                                                                                 \
+    {                                                                                                            \
+        STORY(SSTORY_LABEL_, SSTORY_NONE1_, SSTORY_NONE3_, SSTORY_NONE2_, SSTORY_NONE3_) END = SStory::END_SCENE \
+    };                                                                                                           \
+    template <class = void>                                                                                      \
+    struct Data                                                                                                  \
+    {                                                                                                            \
+        static constexpr SStory::detail::StaticItem items[] = {STORY(SSTORY_ITEM_SCENE_, SSTORY_ITEM_TEXT_,      \
+                                                                     SSTORY_ITEM_SOUND_, SSTORY_ITEM_CHOICE_,    \
+                                                                     SSTORY_ITEM_REPLY_)};                       \
+        static constexpr std::uint32_t size = sizeof(items) / sizeof(items[0]);                                  \
+        static constexpr char pool[] = STORY(SSTORY_POOL_SCENE_, SSTORY_POOL_TEXT_, SSTORY_POOL_SOUND_,          \
+                                             SSTORY_POOL_CHOICE_, SSTORY_POOL_REPLY_);                           \
+    };                                                                                                           \
+    template <class T>                                                                                           \
+    constexpr SStory::detail::StaticItem Data<T>::items[];                                                       \
+    template <class T>                                                                                           \
+    constexpr char Data<T>::pool[];                                                                              \
+    static_assert(SStory::detail::wellFormed(Data<>::items, 0, Data<>::size),                                    \
+                  #Name ": a story starts with a SCENE and every CHOICE follows a TEXT or SOUND");               \
+    inline SStory::Graph graph()                                                                                 \
+    {                                                                                                            \
+        return SStory::detail::staticGraph<Data<>>(START);                                                       \
+    }                                                                                                            \
+    } // namespace Name
+
+#endif // SStatic_h
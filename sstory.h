@@ -8,22 +8,62 @@
 #ifndef SStory_h
 #define SStory_h
 
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <limits>
+#include <memory>
 #include <utility>
+#include <algorithm>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "scode.h"
 // Sound handling with OpenAl
 #include "ssound.h"
+#include "strace.h"
 
 namespace SStory
 {
 
+//! Index of a scene inside a compiled story.
+typedef std::uint32_t SceneId;
+//! Target of every choice that finishes the story.
+constexpr SceneId END_SCENE = 0xFFFFFFFF;
+//! Offset of a missing text, like the complement of a plain Choice.
+constexpr std::uint32_t NO_TEXT = 0xFFFFFFFF;
+
+//! Utility to validated user input and avoid undefined behaviour.
+inline int read_choice(int max)
+{
+    int uInput = 0;
+    while (true)
+    {
+        std::cout << "> ";
+        if (std::cin >> uInput)
+        {
+            if (uInput > 0 && uInput <= max)
+                return uInput - 1;
+        }
+        else
+        {
+            std::cin.clear();
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+    }
+}
+
 class Text
 {
     //! Basic String Wrapper
+    friend class Story;
+
   protected:
     std::string body;
 
@@ -37,33 +77,38 @@ class Text
     //! Prints the body text in standar output
     void print() const
     {
-        std::cout << body << std::endl;
+        std::cout << body << '\n';
     }
 
     void pprint(const std::string &prepend) const
     {
-        std::cout << prepend << " : " << body << std::endl;
+        std::cout << prepend << " : " << body << '\n';
     }
 
     void pprint(const Text &prepend) const
     {
-        std::cout << prepend.body << " : " << body << std::endl;
+        std::cout << prepend.body << " : " << body << '\n';
     }
 
     void pprint(int prepend) const
     {
-        std::cout << prepend << " : " << body << std::endl;
+        std::cout << prepend << " : " << body << '\n';
     }
 };
 
 class Choice
 {
     //! Abstraction for the notion of multiple choices in a text adventure game.
+    friend class Story;
+
   protected:
     std::string label;
     Text displayText;
     Text complement;
     bool withComplement;
+    std::string condition; // Empty when always shown.
+    std::string effect;    // Assignments run when taken, see scode.h.
+    std::uint32_t timeout = 0;
 
   public:
     Choice(std::string l, Text dt, Text c)
@@ -72,12 +117,33 @@ class Choice
     Choice(std::string l, Text dt)
         : label(std::move(l)), displayText(std::move(dt)), complement(""), withComplement(false) {}
 
+    //! Only shown while the condition holds.
+    Choice &when(std::string c)
+    {
+        condition = std::move(c);
+        return *this;
+    }
+
+    //! Assignments to run when the choice is taken.
+    Choice &then(std::string e)
+    {
+        effect = std::move(e);
+        return *this;
+    }
+
+    //! Taken by itself when the player does not answer in the given milliseconds.
+    Choice &after(std::uint32_t milliseconds)
+    {
+        timeout = milliseconds;
+        return *this;
+    }
+
     void print(int n) const
     {
         displayText.pprint(n);
     }
 
-    std::string execute() const
+    const std::string &execute() const
     {
         if (withComplement)
         {
@@ -94,34 +160,44 @@ class Choice
 class ContentBody
 {
     //! The basic structure of a Sub Scene
+    friend class Story;
+
   protected:
     Text body;
-    std::vector<Choice> choices;
-    SSound::Sound sound;
-    bool withSound;
-    bool withChoices;
+    std::vector<Choice> choices; // Empty when the block has none.
+    std::int16_t sample;         // -1 when the block has no sound.
+    std::int16_t channel;
+    std::string condition;       // Empty when always shown.
 
   public:
     ContentBody(Text b, std::vector<Choice> c, SSound::Sample s, SSound::Channel ch = SSound::Channel::center)
-        : body(std::move(b)), choices(std::move(c)), sound(s, ch), withSound(true), withChoices(true) {}
+        : body(std::move(b)), choices(std::move(c)), sample(static_cast<std::int16_t>(s)), channel(static_cast<std::int16_t>(ch)) {}
 
     ContentBody(Text b, SSound::Sample s, SSound::Channel ch = SSound::Channel::center)
-        : body(std::move(b)), sound(s, ch), withSound(true), withChoices(false) {}
+        : body(std::move(b)), sample(static_cast<std::int16_t>(s)), channel(static_cast<std::int16_t>(ch)) {}
 
     ContentBody(Text b, std::vector<Choice> c)
-        : body(std::move(b)), choices(std::move(c)), sound(SSound::Sample::attack), withSound(false), withChoices(true) {}
+        : body(std::move(b)), choices(std::move(c)), sample(-1), channel(0) {}
 
     ContentBody(Text b)
-        : body(std::move(b)), sound(SSound::Sample::attack), withSound(false), withChoices(false) {}
+        : body(std::move(b)), sample(-1), channel(0) {}
+
+    //! Only shown while the condition holds, skipped otherwise.
+    ContentBody &when(std::string c)
+    {
+        condition = std::move(c);
+        return *this;
+    }
 
-    std::string play() const
+    const std::string &play() const
     {
+        static const std::string endLabel = "END";
         body.print();
-        if (withSound)
+        if (sample >= 0)
         {
-            sound.play();
+            SSound::Sound(static_cast<SSound::Sample>(sample), static_cast<SSound::Channel>(channel)).play();
         }
-        if (withChoices)
+        if (!choices.empty())
         {
             int nChoices = 0;
             for (const auto &choice : choices)
@@ -139,64 +215,1180 @@ class ContentBody
             std::cout << "...";
             std::cin.ignore();
         }
-        return "END";
+        return endLabel;
     }
+};
+
+struct TextRef
+{
+    //! Slice of the string pool of a compiled story.
+    std::uint32_t offset;
+    std::uint32_t size;
+};
 
+constexpr TextRef NO_REF = {NO_TEXT, 0};
+
+//! Largest chunk a TextPool allocates, longer texts get a chunk of their own.
+constexpr std::size_t TEXT_CHUNK = 1 << 20;
+
+class TextPool
+{
+    //! Arena holding every text of a story once, equal texts share the same bytes.
+    //! It grows by chunks, so adding text never moves what is already there.
+    //! Texts are handed out as ids, their TextRef is where join() puts them.
   private:
-    //! Utility to validated user input and avoid undefined behaviour.
-    int read_choice(int max) const
+    struct Chunk
+    {
+        std::unique_ptr<char[]> bytes;
+        std::size_t used;
+        std::size_t capacity;
+    };
+
+    std::vector<Chunk> chunks;
+    std::vector<TextRef> refs;         // By id, in the order they were first added.
+    std::vector<const char *> texts;   // By id, where the bytes are.
+    std::vector<std::uint64_t> slots;  // Open addressing, hash << 32 | id + 1, 0 when empty.
+    std::size_t size = 0;              // Bytes of every distinct text.
+    std::size_t added = 0;             // Texts handed to intern(), repeated ones too.
+    std::size_t addedBytes = 0;
+
+    static std::uint32_t hash(const char *s, std::size_t size)
+    {
+        std::uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+        for (; size >= 8; s += 8, size -= 8)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, s, 8);
+            h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+            h ^= h >> 32;
+        }
+        std::uint64_t tail = 0;
+        std::memcpy(&tail, s, size);
+        h = (h ^ tail) * 0xC4CEB9FE1A85EC53ull;
+        return static_cast<std::uint32_t>(h ^ (h >> 29));
+    }
+
+    std::size_t slot(const char *s, std::size_t size, std::uint32_t h) const
+    {
+        const std::size_t mask = slots.size() - 1;
+        for (std::size_t i = h & mask;; i = (i + 1) & mask)
+        {
+            if (slots[i] == 0)
+                return i;
+            const std::uint32_t id = static_cast<std::uint32_t>(slots[i]) - 1;
+            if (slots[i] >> 32 == h && refs[id].size == size && std::memcmp(texts[id], s, size) == 0)
+                return i;
+        }
+    }
+
+    void grow()
+    {
+        std::vector<std::uint64_t> old(std::max<std::size_t>(64, slots.size() * 2), 0);
+        old.swap(slots);
+        const std::size_t mask = slots.size() - 1;
+        for (const std::uint64_t entry : old)
+        {
+            if (entry == 0)
+                continue;
+            std::size_t i = (entry >> 32) & mask;
+            while (slots[i] != 0)
+            {
+                i = (i + 1) & mask;
+            }
+            slots[i] = entry;
+        }
+    }
+
+    char *allocate(std::size_t n)
+    {
+        if (chunks.empty() || chunks.back().capacity - chunks.back().used < n)
+        {
+            // Small stories stay small, chunks double up to TEXT_CHUNK.
+            const std::size_t next = chunks.empty() ? 4096 : std::min<std::size_t>(TEXT_CHUNK, 2 * chunks.back().capacity);
+            const std::size_t capacity = std::max(n, next);
+            chunks.push_back(Chunk{std::unique_ptr<char[]>(new char[capacity]), 0, capacity});
+        }
+        Chunk &chunk = chunks.back();
+        char *at = chunk.bytes.get() + chunk.used;
+        chunk.used += n;
+        return at;
+    }
+
+  public:
+    //! Id of the text, copied into the pool the first time it is seen.
+    std::uint32_t intern(const char *s, std::size_t n)
+    {
+        ++added;
+        addedBytes += n;
+        if (2 * (refs.size() + 1) > slots.size())
+            grow();
+        const std::uint32_t h = hash(s, n);
+        const std::size_t i = slot(s, n, h);
+        if (slots[i] != 0)
+            return static_cast<std::uint32_t>(slots[i]) - 1;
+        char *at = allocate(n);
+        std::memcpy(at, s, n);
+        refs.push_back(TextRef{static_cast<std::uint32_t>(size), static_cast<std::uint32_t>(n)});
+        texts.push_back(at);
+        size += n;
+        slots[i] = static_cast<std::uint64_t>(h) << 32 | refs.size();
+        return static_cast<std::uint32_t>(refs.size()) - 1;
+    }
+
+    std::uint32_t intern(const std::string &s)
+    {
+        return intern(s.data(), s.size());
+    }
+
+    //! Id of the text if it is in the pool, NO_TEXT otherwise.
+    std::uint32_t find(const std::string &s) const
+    {
+        if (slots.empty())
+            return NO_TEXT;
+        const std::uint64_t entry = slots[slot(s.data(), s.size(), hash(s.data(), s.size()))];
+        return entry == 0 ? NO_TEXT : static_cast<std::uint32_t>(entry) - 1;
+    }
+
+    TextRef ref(std::uint32_t id) const
+    {
+        return refs[id];
+    }
+
+    std::string str(std::uint32_t id) const
+    {
+        return std::string(texts[id], refs[id].size);
+    }
+
+    std::uint32_t count() const
+    {
+        return static_cast<std::uint32_t>(refs.size());
+    }
+
+    //! Every distinct text back to back, in the order they were added.
+    std::string join() const
+    {
+        std::string out;
+        out.reserve(size);
+        for (const auto &chunk : chunks)
+        {
+            out.append(chunk.bytes.get(), chunk.used);
+        }
+        return out;
+    }
+
+    std::size_t requested() const
+    {
+        return added;
+    }
+
+    //! Bytes not stored because the text was already in the pool.
+    std::size_t saved() const
+    {
+        return addedBytes - size;
+    }
+
+    std::size_t textBytes() const
+    {
+        std::size_t total = 0;
+        for (const auto &chunk : chunks)
+        {
+            total += chunk.capacity;
+        }
+        return total;
+    }
+
+    //! Heap used by the index, the bytes themselves excluded.
+    std::size_t indexBytes() const
+    {
+        return chunks.capacity() * sizeof(Chunk) + refs.capacity() * sizeof(TextRef) +
+               texts.capacity() * sizeof(const char *) + slots.capacity() * sizeof(std::uint64_t);
+    }
+};
+
+struct SceneEntry
+{
+    //! Compiled scene: a run of consecutive blocks.
+    TextRef label;
+    std::uint32_t firstBlock;
+    std::uint32_t nBlocks;
+};
+
+struct BlockEntry
+{
+    //! Compiled ContentBody, sample is -1 when it has no sound.
+    TextRef body;
+    std::uint32_t firstChoice;
+    std::uint32_t nChoices;
+    std::int16_t sample;
+    std::int16_t channel;
+    std::uint32_t condition; // Offset in the code, NO_CODE when always shown.
+    std::uint32_t timeout;   // Milliseconds to answer, 0 when there is no limit.
+    std::uint32_t fallback;  // Choice of the block taken when time runs out.
+};
+
+struct ChoiceEntry
+{
+    //! Compiled Choice pointing straight at the target scene.
+    SceneId target;
+    TextRef displayText;
+    TextRef complement;
+    std::uint32_t condition; // Offset in the code, NO_CODE when always shown.
+    std::uint32_t effect;    // Offset in the code, NO_CODE when it assigns nothing.
+};
+
+class Sink
+{
+    //! Destination of rendered text.
+  public:
+    virtual ~Sink() {}
+    virtual void write(const char *data, std::size_t size) = 0;
+};
+
+class FdSink : public Sink
+{
+    //! Writes straight to a file descriptor, the terminal by default.
+  protected:
+    int fd;
+
+  public:
+    FdSink(int descriptor = STDOUT_FILENO)
+        : fd(descriptor) {}
+
+    void write(const char *data, std::size_t size) override
+    {
+        while (size > 0)
+        {
+            const ssize_t written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return;
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+    }
+};
+
+class FileSink : public FdSink
+{
+    //! Appends to a file, for transcripts.
+  public:
+    FileSink(const std::string &path)
+        : FdSink(::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644)) {}
+    FileSink(const FileSink &) = delete;
+    FileSink &operator=(const FileSink &) = delete;
+
+    bool isOpen() const
+    {
+        return fd >= 0;
+    }
+
+    ~FileSink()
+    {
+        if (fd >= 0)
+            ::close(fd);
+    }
+};
+
+class MemorySink : public Sink
+{
+    //! Keeps everything in memory, handy for tests.
+  public:
+    std::string data;
+
+    void write(const char *d, std::size_t size) override
+    {
+        data.append(d, size);
+    }
+};
+
+struct Session
+{
+    //! Where one player is: the block of a scene waiting for input, and the
+    //! values of the story variables. Stories without variables never allocate.
+    SceneId scene;
+    std::uint32_t block;
+    std::vector<std::int32_t> vars;
+};
+
+enum class EventKind : std::uint8_t
+{
+    scene,   // Entered scene value, labelled text.
+    text,    // Body of a block.
+    sound,   // Sample value on channel.
+    choice,  // Choice number value with text.
+    prompt,  // Waiting for a choice between 1 and value.
+    pause,   // Waiting for any input.
+    chosen,  // Choice value was taken: text and optional complement.
+    timer,   // The next prompt is answered by itself after value milliseconds.
+    expired, // Nobody answered in time, the events after it take the default choice.
+    end      // The story is over.
+};
+
+struct Event
+{
+    //! Something to render, produced by Graph::step().
+    EventKind kind;
+    std::uint32_t value;
+    std::int16_t channel;
+    TextRef text;
+    TextRef complement;
+};
+
+struct Graph;
+
+class Translation
+{
+    //! Other texts for the texts of a Graph, used when rendering. See slocale.h.
+  public:
+    virtual ~Translation() {}
+
+    //! Points data to the text that replaces t, returns false to keep t.
+    virtual bool find(const Graph &g, TextRef t, const char *&data, std::uint32_t &size) const = 0;
+};
+
+class TextLayout
+{
+    //! Breaks rendered texts in lines, see slayout.h.
+  public:
+    virtual ~TextLayout() {}
+
+    //! Appends the text to out, which ends with the start of its first line.
+    //! Hanging texts continue their next lines where the first one started.
+    virtual void append(std::string &out, const char *data, std::size_t size, bool hanging) = 0;
+};
+
+struct Graph
+{
+    //! Read-only, index based view of a compiled story.
+    const SceneEntry *scenes;
+    const BlockEntry *blocks;
+    const ChoiceEntry *choices;
+    const char *pool;
+    std::uint32_t nScenes;
+    std::uint32_t nBlocks;
+    std::uint32_t nChoices;
+    std::uint32_t poolSize;
+    SceneId start;
+    unsigned prefetchDepth = 2; // Scenes ahead whose samples are decoded in background.
+    const std::uint8_t *code = nullptr; // Conditions and assignments, see scode.h.
+    std::uint32_t codeSize = 0;
+    const std::int32_t *initial = nullptr; // Value of every variable when a session begins.
+    std::uint32_t nVariables = 0;
+
+    const char *data(TextRef t) const
+    {
+        return pool + t.offset;
+    }
+
+    std::string str(TextRef t) const
+    {
+        return std::string(pool + t.offset, t.size);
+    }
+
+    //! Linear search, only meant for tools and resuming, never for playing.
+    SceneId find(const std::string &label) const
+    {
+        if (label == "END")
+            return END_SCENE;
+        for (SceneId id = 0; id < nScenes; ++id)
+        {
+            const TextRef l = scenes[id].label;
+            if (l.size == label.size() && label.compare(0, l.size, pool + l.offset, l.size) == 0)
+                return id;
+        }
+        return END_SCENE;
+    }
+
+    //! Choices deciding where a scene goes: those of its last block.
+    //! A scene without them leads to the end of the story.
+    const ChoiceEntry *exits(SceneId id, std::uint32_t &count) const
+    {
+        const SceneEntry &scene = scenes[id];
+        if (scene.nBlocks == 0)
+        {
+            count = 0;
+            return choices;
+        }
+        const BlockEntry &last = blocks[scene.firstBlock + scene.nBlocks - 1];
+        count = last.nChoices;
+        return choices + last.firstChoice;
+    }
+
+    //! Scenes reachable from the given one in at most depth choices, nearest first.
+    std::vector<SceneId> around(SceneId from, unsigned depth) const
+    {
+        std::vector<SceneId> found;
+        if (from == END_SCENE)
+            return found;
+        found.push_back(from);
+        std::size_t level = 0;
+        for (unsigned hop = 0; hop < depth; ++hop)
+        {
+            const std::size_t levelEnd = found.size();
+            for (; level < levelEnd; ++level)
+            {
+                std::uint32_t count = 0;
+                const ChoiceEntry *first = exits(found[level], count);
+                for (std::uint32_t c = 0; c < count; ++c)
+                {
+                    const SceneId target = first[c].target;
+                    if (target != END_SCENE && std::find(found.begin(), found.end(), target) == found.end())
+                        found.push_back(target);
+                }
+            }
+        }
+        return found;
+    }
+
+    //! Queues the samples of the scenes around the given one in the background loader.
+    void prefetch(SceneId from) const
+    {
+        for (const SceneId id : around(from, prefetchDepth))
+        {
+            const SceneEntry &scene = scenes[id];
+            for (std::uint32_t b = scene.firstBlock; b < scene.firstBlock + scene.nBlocks; ++b)
+            {
+                if (blocks[b].sample >= 0)
+                    SSound::MASTER.prefetch(static_cast<SSound::Sample>(blocks[b].sample),
+                                            static_cast<SSound::Channel>(blocks[b].channel));
+            }
+        }
+    }
+
+    //! A session at the start of the story, every variable at its initial value.
+    Session initialSession() const
+    {
+        return Session{start, 0, std::vector<std::int32_t>(initial, initial + nVariables)};
+    }
+
+    //! Puts a new player on the first block of the story.
+    Session begin(std::vector<Event> &events) const
+    {
+        Session session = initialSession();
+        resume(session, events);
+        return session;
+    }
+
+    //! Same as begin() for a session already in use, its variables keep their memory.
+    void restart(Session &session, std::vector<Event> &events) const
+    {
+        session.scene = start;
+        session.block = 0;
+        session.vars.assign(initial, initial + nVariables);
+        resume(session, events);
+    }
+
+    //! Presents again the block a restored session waits on.
+    void resume(Session &session, std::vector<Event> &events) const
+    {
+        events.clear();
+        enter(session, events);
+    }
+
+    //! Whether the condition holds for the session, true when there is none.
+    bool holds(const Session &session, std::uint32_t condition) const
+    {
+        return condition == NO_CODE || run(code, condition, session.vars.data()) != 0;
+    }
+
+    //! Choices shown by the block the session waits on, hidden ones are not counted.
+    std::uint32_t choiceCount(const Session &session) const
+    {
+        if (session.scene == END_SCENE)
+            return 0;
+        const BlockEntry &block = blocks[scenes[session.scene].firstBlock + session.block];
+        if (codeSize == 0)
+            return block.nChoices;
+        std::uint32_t count = 0;
+        for (std::uint32_t i = 0; i < block.nChoices; ++i)
+        {
+            count += holds(session, choices[block.firstChoice + i].condition);
+        }
+        return count;
+    }
+
+    //! Whether step() would move the session forward with this input.
+    bool accepts(const Session &session, int input) const
+    {
+        if (session.scene == END_SCENE)
+            return false;
+        const std::uint32_t count = choiceCount(session);
+        return count == 0 || (input >= 1 && static_cast<std::uint32_t>(input) <= count);
+    }
+
+    //! Answers the block the session waits on and presents the next one.
+    //! Input is the 1 based number of a shown choice, ignored on blocks without choices.
+    //! Does no I/O at all, the events tell what to render.
+    bool step(Session &session, int input, std::vector<Event> &events) const
     {
-        int uInput = 0;
-        while (true)
+        events.clear();
+        if (session.scene == END_SCENE)
+            return false;
+        const SceneEntry &scene = scenes[session.scene];
+        const BlockEntry &block = blocks[scene.firstBlock + session.block];
+        SceneId next = END_SCENE;
+        // One pass over the conditions finds how many choices are shown and which one was taken.
+        std::uint32_t count = block.nChoices;
+        std::uint32_t taken = static_cast<std::uint32_t>(input - 1);
+        if (codeSize != 0)
         {
-            std::cout << "> ";
-            if (std::cin >> uInput)
+            count = 0;
+            for (std::uint32_t i = 0; i < block.nChoices; ++i)
             {
-                if (uInput > 0 && uInput <= max)
-                    return uInput - 1;
+                if (holds(session, choices[block.firstChoice + i].condition) && ++count == static_cast<std::uint32_t>(input))
+                    taken = i;
             }
-            else
+        }
+        if (count > 0)
+        {
+            if (input < 1 || static_cast<std::uint32_t>(input) > count)
             {
-                std::cin.clear();
-                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+                events.push_back(Event{EventKind::prompt, count, 0, NO_REF, NO_REF});
+                return true;
             }
+            const ChoiceEntry &choice = choices[block.firstChoice + taken];
+            events.push_back(Event{EventKind::chosen, static_cast<std::uint32_t>(input), 0, choice.displayText, choice.complement});
+            if (choice.effect != NO_CODE)
+                run(code, choice.effect, session.vars.data(), session.vars.data());
+            next = choice.target;
+        }
+
+        // The last block shown of a scene decides where the story goes.
+        if (++session.block < scene.nBlocks && skipHidden(session))
+        {
+            present(session, events);
+            return true;
+        }
+        session.scene = next;
+        session.block = 0;
+        enter(session, events);
+        return session.scene != END_SCENE;
+    }
+
+    //! Console front-end: blocking reads on std::cin, one write per prompt to the sink.
+    //! Every accepted input is handed to the callback, to journal it.
+    //! Texts are looked up in the translation first, when there is one.
+    void play(Sink &sink, Session session, const std::function<void(int)> &accepted,
+              const Translation *translation = nullptr) const;
+    void play(Sink &sink) const;
+    void play() const;
+
+    bool waitsChoice(const Session &session) const
+    {
+        return choiceCount(session) > 0;
+    }
+
+    //! Takes the default choice of a timed block, as step() would with its number.
+    //! Returns that number, to journal it, or 0 without stepping if the block has no timer.
+    int expire(Session &session, std::vector<Event> &events) const
+    {
+        if (session.scene == END_SCENE)
+            return 0;
+        const BlockEntry &block = blocks[scenes[session.scene].firstBlock + session.block];
+        if (block.timeout == 0 || !holds(session, choices[block.firstChoice + block.fallback].condition))
+            return 0;
+        int input = 1;
+        for (std::uint32_t i = 0; i < block.fallback; ++i)
+        {
+            input += holds(session, choices[block.firstChoice + i].condition);
+        }
+        step(session, input, events);
+        events.insert(events.begin(), Event{EventKind::expired, 0, 0, NO_REF, NO_REF});
+        return input;
+    }
+
+  private:
+    //! Moves session.block to the first block shown from there on, false if none is left.
+    bool skipHidden(Session &session) const
+    {
+        const SceneEntry &scene = scenes[session.scene];
+        while (session.block < scene.nBlocks && !holds(session, blocks[scene.firstBlock + session.block].condition))
+        {
+            ++session.block;
+        }
+        return session.block < scene.nBlocks;
+    }
+
+    //! Moves into session.scene, skipping scenes without a block to show.
+    void enter(Session &session, std::vector<Event> &events) const
+    {
+        if (session.scene != END_SCENE && !skipHidden(session))
+            session.scene = END_SCENE;
+        if (session.scene == END_SCENE)
+        {
+            events.push_back(Event{EventKind::end, 0, 0, NO_REF, NO_REF});
+            return;
+        }
+        events.push_back(Event{EventKind::scene, session.scene, 0, scenes[session.scene].label, NO_REF});
+        present(session, events);
+    }
+
+    void present(const Session &session, std::vector<Event> &events) const
+    {
+        const BlockEntry &block = blocks[scenes[session.scene].firstBlock + session.block];
+        events.push_back(Event{EventKind::text, 0, 0, block.body, NO_REF});
+        if (block.sample >= 0)
+        {
+            events.push_back(Event{EventKind::sound, static_cast<std::uint32_t>(block.sample), block.channel, NO_REF, NO_REF});
+        }
+        const ChoiceEntry *first = choices + block.firstChoice;
+        std::uint32_t shown = 0;
+        for (std::uint32_t i = 0; i < block.nChoices; ++i)
+        {
+            if (holds(session, first[i].condition))
+                events.push_back(Event{EventKind::choice, ++shown, 0, first[i].displayText, NO_REF});
+        }
+        if (shown == 0)
+        {
+            events.push_back(Event{EventKind::pause, 0, 0, NO_REF, NO_REF});
+            return;
+        }
+        if (block.timeout != 0 && holds(session, first[block.fallback].condition))
+            events.push_back(Event{EventKind::timer, block.timeout, 0, NO_REF, NO_REF});
+        events.push_back(Event{EventKind::prompt, shown, 0, NO_REF, NO_REF});
+    }
+};
+
+class Renderer
+{
+    //! Formats events into one reusable buffer, written to the sink in a single call
+    //! whenever the story waits for input or ends.
+  private:
+    Sink &sink;
+    std::string buffer;
+    const Translation *translation = nullptr;
+    TextLayout *layout = nullptr;
+
+    void append(const Graph &g, TextRef t, bool hanging = false)
+    {
+        const char *data = g.data(t);
+        std::uint32_t size = t.size;
+        if (translation != nullptr)
+            translation->find(g, t, data, size);
+        if (layout != nullptr)
+            layout->append(buffer, data, size, hanging);
+        else
+            buffer.append(data, size);
+    }
+
+    void append(std::uint32_t n)
+    {
+        char digits[10];
+        int i = 0;
+        do
+        {
+            digits[i++] = static_cast<char>('0' + n % 10);
+            n /= 10;
+        } while (n > 0);
+        while (i > 0)
+        {
+            buffer += digits[--i];
+        }
+    }
+
+  public:
+    Renderer(Sink &s)
+        : sink(s) {}
+
+    //! Texts to render instead of the ones of the story, nullptr for none.
+    //! Can change between any two renders, the session does not notice.
+    void translate(const Translation *t)
+    {
+        translation = t;
+    }
+
+    //! Lays texts out in lines, nullptr to write them as they are.
+    void wrap(TextLayout *l)
+    {
+        layout = l;
+    }
+
+    //! Text events only, sound and scene events are left to the front-end.
+    void render(const Graph &g, const std::vector<Event> &events)
+    {
+        for (const auto &event : events)
+        {
+            switch (event.kind)
+            {
+            case EventKind::scene:
+            case EventKind::sound:
+                break;
+            case EventKind::text:
+                append(g, event.text);
+                buffer += '\n';
+                break;
+            case EventKind::choice:
+                append(event.value);
+                buffer += " : ";
+                append(g, event.text, true);
+                buffer += '\n';
+                break;
+            case EventKind::timer:
+                buffer += '(';
+                append((event.value + 999) / 1000);
+                buffer += " s) ";
+                break;
+            case EventKind::expired:
+                buffer += '\n';
+                break;
+            case EventKind::prompt:
+                buffer += "> ";
+                flush();
+                break;
+            case EventKind::pause:
+                buffer += "...";
+                flush();
+                break;
+            case EventKind::chosen:
+                append(g, event.text);
+                if (event.complement.offset != NO_TEXT)
+                {
+                    buffer += " : ";
+                    append(g, event.complement);
+                }
+                buffer += '\n';
+                break;
+            case EventKind::end:
+                buffer += "The End.\n";
+                flush();
+                break;
+            }
+        }
+    }
+
+    void flush()
+    {
+        if (buffer.empty())
+            return;
+        sink.write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+};
+
+//! Reads the answer to a prompt from std::cin: a number when choice is true, a line otherwise.
+//! Anything else reads as 0. Returns false once the input is over.
+inline bool readInput(bool choice, int &input)
+{
+    input = 0;
+    if (choice && !(std::cin >> input))
+    {
+        if (std::cin.eof())
+            return false;
+        input = 0;
+        std::cin.clear();
+        std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    else
+    {
+        // Ignore the never read newline character.
+        std::cin.ignore();
+    }
+    return true;
+}
+
+//! Plays the sounds of the events and queues the samples of the scenes entered.
+inline void playSounds(const Graph &g, const std::vector<Event> &events)
+{
+    for (const auto &event : events)
+    {
+        if (event.kind == EventKind::scene)
+            g.prefetch(event.value);
+        else if (event.kind == EventKind::sound)
+            SSound::MASTER.play(static_cast<SSound::Sample>(event.value), static_cast<SSound::Channel>(event.channel));
+    }
+}
+
+#ifdef SSTORY_TRACE
+//! Label of the scene the session is on, to name traced events.
+inline std::string traceLabel(const Graph &g, const Session &session)
+{
+    return session.scene == END_SCENE ? std::string("END") : g.str(g.scenes[session.scene].label);
+}
+
+//! Counts the scenes entered.
+inline void traceVisits(const Graph &g, const std::vector<Event> &events)
+{
+    for (const auto &event : events)
+    {
+        if (event.kind == EventKind::scene)
+            STrace::TRACE.mark("visit", g.data(event.text), event.text.size);
+    }
+}
+
+//! Counts the answer given to the block the session waits on.
+inline void traceAnswer(const Graph &g, const Session &session, int input)
+{
+    if (!g.accepts(session, input))
+        STrace::TRACE.mark("invalid", traceLabel(g, session));
+    else if (g.waitsChoice(session))
+        STrace::TRACE.mark("choice", traceLabel(g, session) + " #" + std::to_string(input));
+}
+#endif // SSTORY_TRACE
+
+inline void Graph::play(Sink &sink, Session session, const std::function<void(int)> &accepted,
+                        const Translation *translation) const
+{
+    Renderer renderer(sink);
+    renderer.translate(translation);
+    std::vector<Event> events;
+    resume(session, events);
+    while (true)
+    {
+        STRACE(const std::string label = traceLabel(*this, session));
+        {
+            STRACE_SCOPE("scene", label);
+            playSounds(*this, events);
+            renderer.render(*this, events);
         }
+        STRACE(traceVisits(*this, events));
+        if (session.scene == END_SCENE || !std::cin)
+            break;
+
+        int input = 0;
+        bool answered = false;
+        {
+            STRACE_SCOPE("input", label);
+            answered = readInput(waitsChoice(session), input);
+        }
+        if (!answered)
+        {
+            STRACE(STrace::TRACE.mark("quit", label));
+            break;
+        }
+        STRACE(traceAnswer(*this, session, input));
+        if (accepted && accepts(session, input))
+            accepted(input);
+        step(session, input, events);
+    }
+    renderer.flush();
+}
+
+inline void Graph::play(Sink &sink) const
+{
+    play(sink, initialSession(), nullptr);
+}
+
+inline void Graph::play() const
+{
+    // Whatever is pending in std::cout goes before the first write of the sink.
+    std::cout.flush();
+    FdSink out(STDOUT_FILENO);
+    play(out);
+}
+
+class CompiledStory
+{
+    //! Owner of the flat tables behind a Graph, built by Story::compile().
+    friend class Story;
+
+  protected:
+    std::vector<SceneEntry> scenes;
+    std::vector<BlockEntry> blocks;
+    std::vector<ChoiceEntry> choices;
+    std::string pool;
+    std::vector<std::uint8_t> code;
+    std::vector<std::int32_t> initial;
+    std::vector<std::string> variables; // Names, by index.
+    std::vector<std::string> undefined;
+    SceneId start = END_SCENE;
+
+  public:
+    Graph graph() const
+    {
+        Graph g;
+        g.scenes = scenes.data();
+        g.blocks = blocks.data();
+        g.choices = choices.data();
+        g.pool = pool.data();
+        g.nScenes = static_cast<std::uint32_t>(scenes.size());
+        g.nBlocks = static_cast<std::uint32_t>(blocks.size());
+        g.nChoices = static_cast<std::uint32_t>(choices.size());
+        g.poolSize = static_cast<std::uint32_t>(pool.size());
+        g.start = start;
+        g.code = code.data();
+        g.codeSize = static_cast<std::uint32_t>(code.size());
+        g.initial = initial.data();
+        g.nVariables = static_cast<std::uint32_t>(initial.size());
+        return g;
+    }
+
+    //! Labels used by some Choice (or START) without a matching scene.
+    const std::vector<std::string> &undefinedLabels() const
+    {
+        return undefined;
+    }
+
+    //! Name of every story variable, by index.
+    const std::vector<std::string> &variableNames() const
+    {
+        return variables;
+    }
+
+    void play() const
+    {
+        graph().play();
+    }
+};
+
+struct MemoryReport
+{
+    //! Heap held by a Story, see Story::memory().
+    std::size_t text;   // Pool bytes, every distinct text once.
+    std::size_t index;  // Interning table.
+    std::size_t tables; // Scene, block and choice records, and the code of the conditions.
+    std::size_t texts;  // Texts added, repeated ones too.
+    std::size_t unique; // Distinct texts kept.
+    std::size_t saved;  // Bytes repeated texts would have taken.
+
+    std::size_t total() const
+    {
+        return text + index + tables;
+    }
+
+    void print(std::ostream &out) const
+    {
+        out << "Text: " << text << " bytes, " << unique << " of " << texts << " texts, " << saved
+            << " bytes shared\nIndex: " << index << " bytes\nTables: " << tables << " bytes\nTotal: " << total()
+            << " bytes\n";
     }
 };
 
 class Story
 {
+    //! Scenes are flattened into tables as they are added, every text goes to one
+    //! interned pool. compile() only has to resolve the labels of the choices.
   protected:
-    std::unordered_map<std::string, std::vector<ContentBody>> scenes;
+    TextPool pool;
+    std::vector<SceneEntry> scenes;   // In the order they were added.
+    std::vector<BlockEntry> blocks;
+    std::vector<ChoiceEntry> choices; // target is the text id of the label until compiled.
+    std::vector<SceneId> sceneOf;     // Scene of every text id used as a label, END_SCENE if none.
+    SceneId current = END_SCENE;      // Scene the blocks are added to.
+    CodeBuilder program;              // Conditions, assignments and variables.
+    bool lastIsChoice = false;        // Whether a condition goes to the last choice or the last block.
+
+    bool invalid(const std::string &expression)
+    {
+        std::cerr << "SStory(EE): " << program.error() << " in '" << expression << "'" << std::endl;
+        return false;
+    }
 
   public:
     Story() {}
 
-    void addScene(std::string l, std::vector<ContentBody> scene)
+    //! Starts a scene, or starts it over if the label was already added.
+    //! The blocks and choices added next belong to it.
+    void beginScene(const std::string &label)
     {
-        scenes[l] = std::move(scene);
+        const std::uint32_t id = pool.intern(label);
+        if (id >= sceneOf.size())
+            sceneOf.resize(pool.count(), END_SCENE);
+        if (sceneOf[id] == END_SCENE)
+        {
+            sceneOf[id] = static_cast<SceneId>(scenes.size());
+            scenes.push_back(SceneEntry{pool.ref(id), 0, 0});
+        }
+        // A scene started over keeps its place, its old blocks are left unused.
+        current = sceneOf[id];
+        scenes[current].firstBlock = static_cast<std::uint32_t>(blocks.size());
+        scenes[current].nBlocks = 0;
+        lastIsChoice = false;
     }
 
-    void play()
+    //! Adds a block to the current scene, the same as a ContentBody.
+    void addText(const char *body, std::size_t size, std::int16_t sample = -1, std::int16_t channel = 0)
     {
-        std::string currentLabel = "START";
-        const std::string endLabel = "END";
-        while (currentLabel.compare(endLabel) != 0)
+        if (current == END_SCENE)
         {
-            if (scenes.count(currentLabel) < 1)
+            std::cerr << "SStory(EE): text outside of a scene" << std::endl;
+            return;
+        }
+        blocks.push_back(BlockEntry{pool.ref(pool.intern(body, size)), static_cast<std::uint32_t>(choices.size()), 0,
+                                    sample, channel, NO_CODE, 0, 0});
+        ++scenes[current].nBlocks;
+        lastIsChoice = false;
+    }
+
+    void addText(const std::string &body)
+    {
+        addText(body.data(), body.size());
+    }
+
+    void addText(const std::string &body, SSound::Sample s, SSound::Channel ch = SSound::Channel::center)
+    {
+        addText(body.data(), body.size(), static_cast<std::int16_t>(s), static_cast<std::int16_t>(ch));
+    }
+
+    //! Adds a choice to the last block, complement may be null.
+    void addChoice(const std::string &label, const char *display, std::size_t size, const char *complement = nullptr,
+                   std::size_t complementSize = 0)
+    {
+        if (current == END_SCENE || scenes[current].nBlocks == 0)
+        {
+            std::cerr << "SStory(EE): choice before any text" << std::endl;
+            return;
+        }
+        choices.push_back(ChoiceEntry{pool.intern(label), pool.ref(pool.intern(display, size)),
+                                      complement ? pool.ref(pool.intern(complement, complementSize)) : NO_REF, NO_CODE,
+                                      NO_CODE});
+        ++blocks.back().nChoices;
+        lastIsChoice = true;
+    }
+
+    void addChoice(const std::string &label, const std::string &display)
+    {
+        addChoice(label, display.data(), display.size());
+    }
+
+    void addChoice(const std::string &label, const std::string &display, const std::string &complement)
+    {
+        addChoice(label, display.data(), display.size(), complement.data(), complement.size());
+    }
+
+    //! Declares a story variable with its initial value. Variables only used in
+    //! conditions and assignments start at 0.
+    void addVariable(const std::string &name, std::int32_t initial)
+    {
+        program.variable(name, initial);
+    }
+
+    //! Shows the last choice, or the last block if no choice came after it, only while
+    //! the condition holds. Returns false and reports it if it does not compile.
+    bool addCondition(const std::string &condition)
+    {
+        if (current == END_SCENE || scenes[current].nBlocks == 0)
+        {
+            std::cerr << "SStory(EE): condition before any text" << std::endl;
+            return false;
+        }
+        const std::uint32_t at = program.condition(condition);
+        if (at == NO_CODE)
+            return invalid(condition);
+        (lastIsChoice ? choices.back().condition : blocks.back().condition) = at;
+        return true;
+    }
+
+    //! Takes the last choice by itself when the player does not answer in time.
+    bool addTimeout(std::uint32_t milliseconds)
+    {
+        if (!lastIsChoice || current == END_SCENE || scenes[current].nBlocks == 0)
+        {
+            std::cerr << "SStory(EE): timeout before any choice" << std::endl;
+            return false;
+        }
+        blocks.back().timeout = milliseconds;
+        blocks.back().fallback = blocks.back().nChoices - 1;
+        return true;
+    }
+
+    //! Assignments, separated by ;, run when the last choice is taken.
+    bool addEffect(const std::string &assignments)
+    {
+        if (!lastIsChoice || current == END_SCENE || scenes[current].nBlocks == 0)
+        {
+            std::cerr << "SStory(EE): assignments before any choice" << std::endl;
+            return false;
+        }
+        const std::uint32_t at = program.assignments(assignments);
+        if (at == NO_CODE)
+            return invalid(assignments);
+        choices.back().effect = at;
+        return true;
+    }
+
+    void addScene(const std::string &l, const std::vector<ContentBody> &scene)
+    {
+        beginScene(l);
+        for (const auto &content : scene)
+        {
+            const std::string &body = content.body.body;
+            addText(body.data(), body.size(), content.sample, content.channel);
+            if (!content.condition.empty())
+                addCondition(content.condition);
+            for (const auto &choice : content.choices)
             {
-                std::cout << "You must define an scene with label " << currentLabel << std::endl;
+                const std::string &display = choice.displayText.body;
+                const std::string &complement = choice.complement.body;
+                addChoice(choice.label, display.data(), display.size(),
+                          choice.withComplement ? complement.data() : nullptr, complement.size());
+                if (!choice.condition.empty())
+                    addCondition(choice.condition);
+                if (!choice.effect.empty())
+                    addEffect(choice.effect);
+                if (choice.timeout != 0)
+                    addTimeout(choice.timeout);
             }
-            else
+        }
+    }
+
+    //! Copies the tables, pointing every choice straight at its scene.
+    //! Undefined labels are reported here, once, and lead to the end of the story.
+    CompiledStory compile() const
+    {
+        CompiledStory out;
+        const std::uint32_t endId = pool.find("END");
+        std::vector<bool> reported(pool.count(), false);
+        auto undefined = [&](const std::string &label) {
+            out.undefined.push_back(label);
+            std::cout << "You must define an scene with label " << label << std::endl;
+        };
+        auto resolve = [&](std::uint32_t id) -> SceneId {
+            if (id == endId)
+                return END_SCENE;
+            if (id < sceneOf.size() && sceneOf[id] != END_SCENE)
+                return sceneOf[id];
+            if (!reported[id])
+            {
+                reported[id] = true;
+                undefined(pool.str(id));
+            }
+            return END_SCENE;
+        };
+
+        out.pool = pool.join();
+        out.code = program.code;
+        out.initial = program.initial;
+        out.variables = program.names;
+        out.scenes.reserve(scenes.size());
+        out.blocks.reserve(blocks.size());
+        out.choices.reserve(choices.size());
+        for (const auto &scene : scenes)
+        {
+            out.scenes.push_back(SceneEntry{scene.label, static_cast<std::uint32_t>(out.blocks.size()), scene.nBlocks});
+            for (std::uint32_t b = scene.firstBlock; b < scene.firstBlock + scene.nBlocks; ++b)
             {
-                const std::vector<ContentBody> currentScene = scenes[currentLabel];
-                for (const auto &content : currentScene)
+                BlockEntry block = blocks[b];
+                block.firstChoice = static_cast<std::uint32_t>(out.choices.size());
+                for (std::uint32_t c = blocks[b].firstChoice; c < blocks[b].firstChoice + block.nChoices; ++c)
                 {
-                    currentLabel = content.play();
+                    ChoiceEntry choice = choices[c];
+                    choice.target = resolve(choice.target);
+                    out.choices.push_back(choice);
                 }
+                out.blocks.push_back(block);
             }
         }
-        std::cout << "The End." << std::endl;
+        const std::uint32_t startId = pool.find("START");
+        if (startId == NO_TEXT)
+            undefined("START");
+        out.start = startId == NO_TEXT ? END_SCENE : resolve(startId);
+        return out;
+    }
+
+    //! Where the memory of the story goes, before compiling it.
+    MemoryReport memory() const
+    {
+        return MemoryReport{pool.textBytes(), pool.indexBytes() + sceneOf.capacity() * sizeof(SceneId),
+                            scenes.capacity() * sizeof(SceneEntry) + blocks.capacity() * sizeof(BlockEntry) +
+                                choices.capacity() * sizeof(ChoiceEntry) + program.code.capacity() +
+                                program.initial.capacity() * sizeof(std::int32_t),
+                            pool.requested(), pool.count(), pool.saved()};
+    }
+
+    void play()
+    {
+        compile().play();
     }
 };
 } // namespace SStory;
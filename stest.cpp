@@ -0,0 +1,491 @@
+/* stest.cpp
+ * Behaviour tests of the headers, run by make check.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * Every CHECK that fails prints where it is, the exit status is 1 if any did.
+ * It also leaves synthetic sounds in stest.sounds/, the same bytes on every
+ * host, for make check to render example.story with.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include "example.h"
+#include "sanalysis.h"
+#include "sbench.h"
+#include "scode.h"
+#include "sindex.h"
+#include "slayout.h"
+#include "smixer.h"
+#include "ssave.h"
+#include "sscript.h"
+
+static int checks = 0;
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(bool ok, const char *what, int line)
+{
+    ++checks;
+    if (ok)
+        return;
+    ++failures;
+    std::cerr << "stest.cpp:" << line << ": failed " << what << '\n';
+}
+
+//! Compiles a script written inline, the story is empty if it has errors.
+static SStory::CompiledStory compile(const std::string &script)
+{
+    SStory::Story story;
+    SStory::ScriptReader reader(story);
+    std::istringstream in(script);
+    CHECK(reader.read(in));
+    return story.compile();
+}
+
+static const char *const SHOP = "var gold = -5\n"
+                                "var key = 0\n"
+                                "scene START\n"
+                                "text A shop.\n"
+                                "choice START | Work | You earn 300.\n"
+                                "set gold += 300\n"
+                                "choice DOOR | Leave\n"
+                                "scene DOOR\n"
+                                "text A door.\n"
+                                "choice END | Open it\n"
+                                "when key\n"
+                                "choice START | Back\n";
+
+static bool same(const SStory::Session &a, const SStory::Session &b)
+{
+    return a.scene == b.scene && a.block == b.block && a.vars == b.vars;
+}
+
+static void snapshotRoundTrip()
+{
+    const SStory::CompiledStory shop = compile(SHOP);
+    const SStory::Graph graph = shop.graph();
+    // Works twice, with a look at the locked door in between.
+    const std::vector<std::uint32_t> inputs = {1, 2, 1, 1};
+    SStory::Session session;
+    CHECK(SStory::replay(graph, inputs, session));
+    CHECK(session.vars == std::vector<std::int32_t>({595, 0}));
+
+    const SStory::Snapshot saved = SStory::Snapshot::of(graph, session, inputs);
+    const std::string data = saved.encode();
+    SStory::Snapshot loaded;
+    CHECK(loaded.decode(data.data(), data.size()));
+    CHECK(loaded.story == SStory::fingerprint(graph));
+    CHECK(same(loaded.session, session));
+    CHECK(loaded.history == inputs);
+    CHECK(loaded.fits(graph));
+    CHECK(!loaded.fits(Example::graph()));
+
+    // Replaying the history of a save gets to the same place.
+    SStory::Session replayed;
+    CHECK(SStory::replay(graph, loaded.history, replayed));
+    CHECK(same(replayed, session));
+
+    // Negative and large values survive the zigzag varints.
+    SStory::Snapshot extremes = saved;
+    extremes.session.vars = {INT32_MIN, INT32_MAX};
+    extremes.history = {0, 127, 128, 0xFFFFFFFFu};
+    const std::string wide = extremes.encode();
+    CHECK(loaded.decode(wide.data(), wide.size()));
+    CHECK(loaded.session.vars == extremes.session.vars);
+    CHECK(loaded.history == extremes.history);
+}
+
+static void snapshotRejects()
+{
+    const SStory::Graph graph = Example::graph();
+    const std::string data = SStory::Snapshot::of(graph, graph.initialSession(), {1, 2, 3}).encode();
+    SStory::Snapshot loaded;
+    for (std::size_t size = 0; size < data.size(); ++size)
+    {
+        CHECK(!loaded.decode(data.data(), size));
+    }
+    std::string other = data;
+    other[4] = static_cast<char>(SStory::SNAPSHOT_VERSION + 1);
+    CHECK(!loaded.decode(other.data(), other.size()));
+    other = data;
+    other[0] = 'X';
+    CHECK(!loaded.decode(other.data(), other.size()));
+}
+
+static void journalRoundTrip()
+{
+    const std::string path = "stest.journal";
+    std::remove(path.c_str());
+    const SStory::CompiledStory shop = compile(SHOP);
+    const SStory::Graph graph = shop.graph();
+    const std::vector<std::uint32_t> inputs = {0, 1, 300, 2};
+    {
+        SStory::Journal journal;
+        CHECK(journal.open(path, graph));
+        CHECK(journal.inputs.empty());
+        for (const std::uint32_t input : inputs)
+        {
+            journal.record(input);
+        }
+    }
+    {
+        SStory::Journal journal;
+        CHECK(journal.open(path, graph));
+        CHECK(journal.inputs == inputs);
+    }
+
+    // A torn last input is dropped, and the journal goes on after the good ones.
+    {
+        std::ofstream torn(path, std::ios::binary | std::ios::app);
+        torn.put(static_cast<char>(0x80));
+    }
+    {
+        SStory::Journal journal;
+        CHECK(journal.open(path, graph));
+        CHECK(journal.inputs == inputs);
+        journal.record(7);
+    }
+    {
+        SStory::Journal journal;
+        CHECK(journal.open(path, graph));
+        CHECK(journal.inputs.size() == inputs.size() + 1 && journal.inputs.back() == 7);
+        journal.close();
+        CHECK(!journal.open(path, Example::graph()));
+    }
+
+    // Too short to even hold the magic.
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << "SS";
+    }
+    SStory::Journal journal;
+    CHECK(!journal.open(path, graph));
+    std::remove(path.c_str());
+}
+
+//! Value of a condition over the variables, compiled on its own.
+static std::int32_t evaluate(SStory::CodeBuilder &builder, const std::string &text,
+                             const std::vector<std::int32_t> &vars = {})
+{
+    const std::uint32_t at = builder.condition(text);
+    CHECK(at != SStory::NO_CODE);
+    std::vector<std::int32_t> all(vars);
+    all.resize(builder.names.size());
+    return at == SStory::NO_CODE ? 0 : SStory::run(builder.code.data(), at, all.data());
+}
+
+static void bytecode()
+{
+    SStory::CodeBuilder builder;
+    CHECK(evaluate(builder, "1 + 2 * 3 == 7 && !0") == 1);
+    CHECK(evaluate(builder, "(1 + 2) * 3") == 9);
+    CHECK(evaluate(builder, "-7 / 2") == -3);
+    CHECK(evaluate(builder, "-7 % 2") == -1);
+    CHECK(evaluate(builder, "2 < 1 || 3 >= 3") == 1);
+
+    // The whole range of literals, and overflow wrapping around.
+    CHECK(evaluate(builder, "-2147483648") == INT32_MIN);
+    CHECK(evaluate(builder, "2147483647") == INT32_MAX);
+    CHECK(evaluate(builder, "2147483647 + 1") == INT32_MIN);
+    CHECK(evaluate(builder, "-2147483648 - 1") == INT32_MAX);
+    CHECK(builder.condition("2147483648") == SStory::NO_CODE && builder.error() == "number too large");
+    CHECK(builder.condition("-2147483649") == SStory::NO_CODE && builder.error() == "number too large");
+
+    // Division by zero gives 0, the one division that overflows wraps.
+    const std::uint32_t x = builder.variable("x");
+    std::vector<std::int32_t> vars(x + 1, 0);
+    vars[x] = 7;
+    CHECK(evaluate(builder, "x / 0", vars) == 0);
+    CHECK(evaluate(builder, "x % 0", vars) == 0);
+    vars[x] = INT32_MIN;
+    CHECK(evaluate(builder, "x / -1", vars) == INT32_MIN);
+    CHECK(evaluate(builder, "x % -1", vars) == 0);
+    CHECK(evaluate(builder, "-x", vars) == INT32_MIN);
+    CHECK(evaluate(builder, "x * -1", vars) == INT32_MIN);
+
+    // Assignments store in order, each one sees the ones before.
+    const std::uint32_t assign = builder.assignments("a = 5; b = a * 2; a -= 1");
+    CHECK(assign != SStory::NO_CODE);
+    std::vector<std::int32_t> state(builder.names.size(), 0);
+    SStory::run(builder.code.data(), assign, state.data(), state.data());
+    CHECK(state[builder.variable("a")] == 4 && state[builder.variable("b")] == 10);
+
+    // A failed expression leaves no code nor variables behind.
+    const std::size_t names = builder.names.size();
+    const std::size_t size = builder.code.size();
+    CHECK(builder.condition("fresh + (other") == SStory::NO_CODE && builder.error() == "missing )");
+    CHECK(builder.assignments("fresh = 1; other = ") == SStory::NO_CODE);
+    CHECK(builder.names.size() == names && builder.initial.size() == names && builder.code.size() == size);
+    CHECK(builder.variable("fresh") == names);
+
+    std::string deep = "1";
+    for (int i = 0; i < SStory::CODE_STACK + 1; ++i)
+    {
+        deep = "1 + (" + deep + ")";
+    }
+    CHECK(builder.condition(deep) == SStory::NO_CODE && builder.error() == "expression too deep");
+}
+
+typedef std::vector<std::string> Lines;
+
+static const char *const FOREST = "scene START\n"
+                                  "text Es poco después de las doce. El camino sigue.\n"
+                                  "sound driving\n"
+                                  "text ¿Cuál tomar?\n"
+                                  "choice RIO | El camino del río | Bajas hacia el agua.\n"
+                                  "choice CASA | Volver a casa\n"
+                                  "scene RIO\n"
+                                  "text El río brilla. Un lobo aúlla.\n"
+                                  "sound wolf\n"
+                                  "choice END | Cruzar el río\n"
+                                  "choice START | Regresar al camino\n"
+                                  "scene CASA\n"
+                                  "text Después de todo, la casa.\n";
+
+//! Texts of the fields at the postings, in order.
+static Lines texts(const SStory::StoryIndex &index, const std::vector<SStory::Posting> &places)
+{
+    Lines out;
+    for (const auto &place : places)
+    {
+        out.push_back(index.text(place.field));
+    }
+    return out;
+}
+
+static Lines texts(const SStory::StoryIndex &index, const std::vector<std::uint32_t> &fields)
+{
+    Lines out;
+    for (const std::uint32_t field : fields)
+    {
+        out.push_back(index.text(field));
+    }
+    return out;
+}
+
+static void storyIndex()
+{
+    const SStory::CompiledStory forest = compile(FOREST);
+    const SStory::Graph graph = forest.graph();
+    for (unsigned threads = 1; threads <= 4; threads *= 4)
+    {
+        const SStory::StoryIndex index = SStory::StoryIndex::build(graph, threads);
+
+        // Words are found without case nor accents, whichever way they are asked for.
+        const SStory::PostingRange river = index.find("rio");
+        CHECK(river.size() == 3);
+        CHECK(index.find("RÍO").size() == 3);
+        CHECK(index.find("despues").size() == 2);
+        CHECK(index.find("cual").size() == 1 && index.text(index.find("cual").begin()->field) == "¿Cuál tomar?");
+        CHECK(index.find("lobos").empty());
+        CHECK(index.find("el camino").empty());
+        CHECK(index.find("agua").size() == 1 &&
+              index.field(index.find("agua").begin()->field).kind == SStory::FieldKind::complement);
+
+        // The place of a word points at its bytes in the original text.
+        const SStory::Posting &first = *index.find("aulla").begin();
+        const std::pair<std::size_t, std::size_t> bytes = index.locate(first);
+        CHECK(index.text(first.field).substr(bytes.first, bytes.second - bytes.first) == "aúlla");
+        CHECK(index.field(first.field).kind == SStory::FieldKind::body);
+        CHECK(index.field(first.field).scene == index.scene("RIO"));
+
+        CHECK(texts(index, index.phrase("el camino")) ==
+              Lines({"Es poco después de las doce. El camino sigue.", "El camino del río"}));
+        CHECK(texts(index, index.phrase("camino del RIO")) == Lines({"El camino del río"}));
+        CHECK(index.phrase("camino el").empty());
+        CHECK(index.phrase("el rio brilla un lobo").size() == 1);
+
+        // Prefixes merge the places of every word, in story order.
+        CHECK(texts(index, index.prefix("ca")) == Lines({"Es poco después de las doce. El camino sigue.",
+                                                         "El camino del río", "Volver a casa",
+                                                         "Regresar al camino", "Después de todo, la casa."}));
+        CHECK(index.prefix("zz").empty());
+
+        CHECK(texts(index, index.linksTo(index.scene("RIO"))) == Lines({"El camino del río"}));
+        CHECK(texts(index, index.linksTo(index.scene("START"))) == Lines({"Regresar al camino"}));
+        CHECK(texts(index, index.linksTo(SStory::END_SCENE)) == Lines({"Cruzar el río", "Después de todo, la casa."}));
+        CHECK(index.scene("NOWHERE") == SStory::END_SCENE);
+        CHECK(texts(index, index.playing(SSound::Sample::wolf)) == Lines({"El río brilla. Un lobo aúlla."}));
+        CHECK(index.playing(SSound::Sample::gun).empty());
+    }
+}
+
+static std::size_t width(const std::string &text)
+{
+    return SStory::textWidth(text.data(), text.size());
+}
+
+//! The lines of the text wrapped to width, from column 0.
+static std::vector<std::string> wrapped(const std::string &text, std::size_t width, std::size_t column = 0,
+                                        std::size_t indent = 0)
+{
+    std::vector<SStory::LineSpan> spans;
+    SStory::wrap(text.data(), text.size(), width, column, indent, spans);
+    std::vector<std::string> lines;
+    for (const auto &span : spans)
+    {
+        lines.push_back(text.substr(span.offset, span.size));
+    }
+    return lines;
+}
+
+static void utf8Width()
+{
+    CHECK(width("") == 0);
+    CHECK(width("camino") == 6);
+    CHECK(width("ñandú") == 5);
+    CHECK(width("e\xCC\x81") == 1); // e and a combining acute accent.
+    CHECK(width("日本語") == 6);
+    CHECK(width("\xF0\x9F\x98\x80") == 2); // An emoji.
+    // Longer than 16 bytes, counted by blocks where SSE2 is on.
+    CHECK(width("Después de las doce, la canción") == 31);
+    CHECK(width("áéíóúáéíóúáéíóúáéíóú") == 20);
+    CHECK(width("áéíóúáéíóú日本áéíóú") == 19);
+    // A broken sequence takes one column per byte.
+    CHECK(width("a\xC3") == 2);
+}
+
+static void utf8Wrap()
+{
+    CHECK(wrapped("the quick brown fox", 10) == Lines({"the quick", "brown fox"}));
+    CHECK(wrapped("año über niño", 8) == Lines({"año über", "niño"}));
+    CHECK(wrapped("line one\nline two", 80) == Lines({"line one", "line two"}));
+    // Words longer than a line are split between characters, never inside one.
+    CHECK(wrapped("ééééé", 3) == Lines({"ééé", "éé"}));
+    CHECK(wrapped("日本語です", 4) == Lines({"日本", "語で", "す"}));
+    CHECK(wrapped("日本語", 1) == Lines({"日", "本", "語"}));
+    // A word that fits a fresh line moves there instead of being split.
+    CHECK(wrapped("caminando", 10, 5) == Lines({"", "caminando"}));
+    CHECK(wrapped("uno dos tres", 9, 0, 4) == Lines({"uno dos", "tres"}));
+}
+
+static void layoutCache()
+{
+    SStory::Layout layout(10);
+    char text[] = "the quick brown fox";
+    std::uint32_t count = 0;
+    layout.lines(text, sizeof(text) - 1, 0, 0, count);
+    CHECK(count == 2);
+    layout.lines(text, sizeof(text) - 1, 0, 0, count);
+    CHECK(layout.hits == 1 && layout.misses == 1);
+
+    // Other bytes at the same address are wrapped again.
+    std::memcpy(text, "a b c d e f g h i j", sizeof(text));
+    const SStory::LineSpan *line = layout.lines(text, sizeof(text) - 1, 0, 0, count);
+    CHECK(layout.misses == 2 && count == 2 && line[0].size == 9);
+
+    // Margins past 16 bits are not mistaken for small ones.
+    layout.lines(text, 2, 2, 0, count);
+    CHECK(count == 1);
+    line = layout.lines(text, 2, 65536 + 2, 0, count);
+    CHECK(count == 2 && line[0].size == 0);
+}
+
+//! The parallel search finds Tarjan's components, in an order the longest paths can use.
+static void stronglyConnected()
+{
+    for (std::uint32_t branching = 1; branching <= 3; ++branching)
+    {
+        SStory::StoryShape shape;
+        shape.scenes = 3000;
+        shape.branching = branching;
+        shape.textLength = 8;
+        shape.endings = 0.2;
+        SStory::Story story;
+        SStory::generate(story, shape);
+        const SStory::CompiledStory compiled = story.compile();
+        const SStory::Adjacency adj = SStory::Adjacency::forward(compiled.graph());
+
+        std::uint32_t count = 0;
+        const std::vector<std::uint32_t> tarjan = SStory::components(adj, count);
+        for (unsigned threads = 2; threads <= 8; threads *= 2)
+        {
+            std::uint32_t parallelCount = 0;
+            const std::vector<std::uint32_t> parallel = SStory::components(adj, parallelCount, threads);
+            CHECK(parallelCount == count);
+            std::vector<std::uint32_t> same(count, SStory::UNREACHED);
+            bool matches = true;
+            bool ordered = true;
+            for (SStory::SceneId v = 0; v < adj.size(); ++v)
+            {
+                if (same[tarjan[v]] == SStory::UNREACHED)
+                    same[tarjan[v]] = parallel[v];
+                matches = matches && parallel[v] < count && same[tarjan[v]] == parallel[v];
+                for (std::uint32_t e = adj.offsets[v]; e < adj.offsets[v + 1]; ++e)
+                {
+                    ordered = ordered && parallel[adj.targets[e]] <= parallel[v];
+                }
+            }
+            CHECK(matches);
+            CHECK(ordered);
+        }
+
+        const SStory::Analysis one = SStory::Analysis::run(compiled.graph(), 1);
+        const SStory::Analysis many = SStory::Analysis::run(compiled.graph(), 4);
+        CHECK(one.loops == many.loops);
+        bool endings = one.endings.size() == many.endings.size();
+        for (std::size_t i = 0; endings && i < one.endings.size(); ++i)
+        {
+            endings = one.endings[i].scene == many.endings[i].scene &&
+                      one.endings[i].shortest == many.endings[i].shortest &&
+                      one.endings[i].longest == many.endings[i].longest;
+        }
+        CHECK(endings);
+    }
+}
+
+//! Triangle waves, a different pitch, length and rate for every sample.
+static void testSounds()
+{
+    const std::string dir = "stest.sounds/";
+    mkdir(dir.c_str(), 0755);
+    const int rates[] = {22050, 44100, 48000};
+    for (int i = 0; i < SSound::SAMPLE_COUNT; ++i)
+    {
+        const SSound::Sample sample = static_cast<SSound::Sample>(i);
+        const int rate = rates[i % 3];
+        const std::size_t count = static_cast<std::size_t>(rate / 4 * (i % 4 + 1));
+        const int period = 40 + 12 * i;
+        std::vector<std::int16_t> frames(2 * count);
+        for (std::size_t f = 0; f < count; ++f)
+        {
+            const int left = static_cast<int>(f % period);
+            const int right = static_cast<int>((f + period / 3) % period);
+            frames[2 * f] = static_cast<std::int16_t>((std::abs(2 * left - period) * 16000) / period - 8000);
+            frames[2 * f + 1] = static_cast<std::int16_t>((std::abs(2 * right - period) * 16000) / period - 8000);
+        }
+        const std::string path = dir + SSound::file(sample);
+        SSound::WavWriter wav;
+        CHECK(wav.open(path, rate));
+        wav.write(frames.data(), count);
+        CHECK(wav.close());
+
+        SSound::Wave read;
+        CHECK(read.load(path));
+        CHECK(read.channels == 2 && read.bits == 16 && read.frequency == rate);
+        CHECK(read.data.size() == 4 * count && std::memcmp(read.data.data(), frames.data(), 4 * count) == 0);
+    }
+}
+
+int main()
+{
+    snapshotRoundTrip();
+    snapshotRejects();
+    journalRoundTrip();
+    bytecode();
+    storyIndex();
+    utf8Width();
+    utf8Wrap();
+    layoutCache();
+    stronglyConnected();
+    testSounds();
+
+    std::cout << checks << " checks, " << failures << " failed\n";
+    return failures == 0 ? 0 : 1;
+}
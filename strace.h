@@ -0,0 +1,623 @@
+/* strace.h
+ * Timings and counters of a playthrough, exported as a Chrome trace.
+ *
+ * Author: Santiago Quintero
+ * Released under The MIT License
+ *
+ * Only built with -DSSTORY_TRACE, otherwise every STRACE macro expands to
+ * nothing and this header declares nothing. When built in, STrace::TRACE
+ * records:
+ *
+ *   scene   time to render each scene, and its visits
+ *   input   time waiting for the player, per scene
+ *   choice  choices taken, as "SCENE #n"
+ *   invalid answers that were not a shown choice, per scene
+ *   quit    scene the player was on when the input ended
+ *   timeout scene where the player let a timed choice run out
+ *   decode  time to read and decode each sample
+ *   upload  time to hand each decoded sample to OpenAL
+ *   miss    time the player waited for a sample not decoded ahead
+ *   defer   sounds started late by pump(), their sample was not decoded yet
+ *
+ * SSTORY_TRACE=trace.json writes every event when the program ends, or is
+ * interrupted, for chrome://tracing or Perfetto. SSTORY_METRICS=metrics.txt
+ * rewrites a table of count, total and maximum time per name every
+ * SSTORY_METRICS_PERIOD seconds (10). Names longer than 39 bytes are cut.
+ */
+
+#ifndef STrace_h
+#define STrace_h
+
+#ifdef SSTORY_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace STrace
+{
+
+//! Events each thread keeps for the trace, later ones only go into the metrics.
+constexpr std::size_t MAX_EVENTS = 1 << 20;
+//! Distinct category and name pairs, later ones are all counted as "trace other".
+constexpr std::size_t MAX_NAMES = 4096;
+//! Threads that can record, events of later ones are lost.
+constexpr std::size_t MAX_THREADS = 256;
+//! Bytes of a name, terminator included. Longer names are cut at a character.
+constexpr std::size_t NAME_SIZE = 40;
+
+struct Record
+{
+    //! One event of the trace, duration is 0 for counted ones.
+    std::uint32_t name; // Interned category and name.
+    std::uint64_t begin; // Nanoseconds since the recorder started.
+    std::uint64_t duration;
+};
+
+struct Stats
+{
+    //! Aggregate of every event with the same category and name.
+    std::uint64_t count = 0;
+    std::uint64_t total = 0; // Nanoseconds.
+    std::uint64_t max = 0;
+};
+
+//! Length of the name cut to fit a Record, never in the middle of a UTF-8 character.
+inline std::size_t fit(const char *name, std::size_t size)
+{
+    if (size < NAME_SIZE)
+        return size;
+    size = NAME_SIZE - 1;
+    while (size > 0 && (static_cast<unsigned char>(name[size]) & 0xC0) == 0x80)
+    {
+        --size;
+    }
+    return size;
+}
+
+namespace detail
+{
+
+class Output
+{
+    //! Buffered writes to a file with nothing but open() and write(), safe in a signal handler.
+  private:
+    int fd;
+    char buffer[4096];
+    std::size_t used = 0;
+
+  public:
+    explicit Output(const char *path)
+        : fd(::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) {}
+    Output(const Output &) = delete;
+    Output &operator=(const Output &) = delete;
+
+    ~Output()
+    {
+        flush();
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    void flush()
+    {
+        for (std::size_t done = 0; fd >= 0 && done < used;)
+        {
+            const ssize_t n = ::write(fd, buffer + done, used - done);
+            if (n <= 0)
+                break;
+            done += static_cast<std::size_t>(n);
+        }
+        used = 0;
+    }
+
+    Output &put(char c)
+    {
+        if (used == sizeof(buffer))
+            flush();
+        buffer[used++] = c;
+        return *this;
+    }
+
+    Output &put(const char *s)
+    {
+        for (; *s; ++s)
+        {
+            put(*s);
+        }
+        return *this;
+    }
+
+    //! Left aligned in width columns.
+    Output &put(const char *s, std::size_t width)
+    {
+        const std::size_t size = std::strlen(s);
+        put(s);
+        for (std::size_t i = size; i < width; ++i)
+        {
+            put(' ');
+        }
+        return *this;
+    }
+
+    //! Right aligned in width columns.
+    Output &number(std::uint64_t v, std::size_t width = 0)
+    {
+        char digits[24];
+        std::size_t n = 0;
+        do
+        {
+            digits[n++] = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v > 0);
+        for (std::size_t i = n; i < width; ++i)
+        {
+            put(' ');
+        }
+        while (n > 0)
+        {
+            put(digits[--n]);
+        }
+        return *this;
+    }
+
+    //! v / unit with three decimals, right aligned in width columns.
+    Output &decimal(std::uint64_t v, std::uint64_t unit, std::size_t width = 0)
+    {
+        const std::uint64_t thousandths = v / (unit / 1000) % 1000;
+        number(v / unit, width > 4 ? width - 4 : 0).put('.');
+        return put(static_cast<char>('0' + thousandths / 100))
+            .put(static_cast<char>('0' + thousandths / 10 % 10))
+            .put(static_cast<char>('0' + thousandths % 10));
+    }
+
+    Output &json(const char *s)
+    {
+        put('"');
+        for (; *s; ++s)
+        {
+            const unsigned char c = static_cast<unsigned char>(*s);
+            if (c == '"' || c == '\\')
+                put('\\').put(*s);
+            else if (c < 0x20)
+                put(' ');
+            else
+                put(*s);
+        }
+        return put('"');
+    }
+};
+
+} // namespace detail
+
+class Recorder
+{
+    //! Sink of every traced event. Each thread appends to its own buffer without
+    //! locking, names are interned once per thread. One Recorder per program.
+  private:
+    struct Name
+    {
+        const char *category;
+        char name[NAME_SIZE];
+        std::size_t size;
+    };
+
+    struct Counter
+    {
+        //! Only written by the thread owning it, read by the writers of the files.
+        std::atomic<std::uint64_t> count{0};
+        std::atomic<std::uint64_t> total{0};
+        std::atomic<std::uint64_t> max{0};
+    };
+
+    struct Slot
+    {
+        //! An interned name cached by one thread, empty without category.
+        const char *category = nullptr;
+        std::uint64_t hash = 0;
+        std::uint32_t id = 0;
+    };
+
+    static constexpr std::size_t CHUNK = 4096; // Records allocated at a time.
+    static constexpr std::size_t CACHE = 1024; // Slots of the cache of every thread.
+
+    struct Buffer
+    {
+        //! Events and counters of one thread, never freed: threads may trace while the program exits.
+        std::uint32_t thread;
+        std::atomic<std::size_t> size{0}; // Records published.
+        std::atomic<Record *> chunks[MAX_EVENTS / CHUNK];
+        Counter stats[MAX_NAMES];
+        std::atomic<std::uint64_t> dropped{0};
+        Slot cache[CACHE];
+        std::size_t cached = 0;
+
+        explicit Buffer(std::uint32_t id)
+            : thread(id)
+        {
+            for (auto &chunk : chunks)
+            {
+                chunk.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::mutex lock; // Taken by the first event of a thread and the first use of a name.
+    Name names[MAX_NAMES];
+    std::atomic<std::uint32_t> nNames{0};
+    std::unordered_map<std::string, std::uint32_t> ids; // By category, '\0' and name.
+    Buffer *buffers[MAX_THREADS];
+    std::atomic<std::uint32_t> nBuffers{0};
+
+    std::string tracePath;
+    std::string metricsPath;
+    std::thread dumper;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static std::uint64_t hash(const char *category, const char *name, std::size_t size)
+    {
+        std::uint64_t h = 14695981039346656037ull ^ reinterpret_cast<std::uintptr_t>(category);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            h = (h ^ static_cast<unsigned char>(name[i])) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    //! Buffer of the calling thread, created by its first event.
+    Buffer *local()
+    {
+        static thread_local Buffer *mine = nullptr;
+        static thread_local bool full = false;
+        if (mine || full)
+            return mine;
+        std::lock_guard<std::mutex> guard(lock);
+        const std::uint32_t n = nBuffers.load(std::memory_order_relaxed);
+        if (n == MAX_THREADS)
+        {
+            full = true;
+            return nullptr;
+        }
+        mine = new Buffer(n + 1);
+        buffers[n] = mine;
+        nBuffers.store(n + 1, std::memory_order_release);
+        return mine;
+    }
+
+    std::uint32_t internSlow(const char *category, const char *name, std::size_t size)
+    {
+        std::string key(category);
+        key += '\0';
+        key.append(name, size);
+        std::lock_guard<std::mutex> guard(lock);
+        const auto found = ids.find(key);
+        if (found != ids.end())
+            return found->second;
+        const std::uint32_t id = nNames.load(std::memory_order_relaxed);
+        if (id == MAX_NAMES)
+            return 0;
+        Name &entry = names[id];
+        entry.category = category;
+        std::memcpy(entry.name, name, size);
+        entry.name[size] = '\0';
+        entry.size = size;
+        ids.emplace(std::move(key), id);
+        nNames.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    Stats sum(std::uint32_t id) const
+    {
+        Stats s;
+        const std::uint32_t threads = nBuffers.load(std::memory_order_acquire);
+        for (std::uint32_t t = 0; t < threads; ++t)
+        {
+            const Counter &c = buffers[t]->stats[id];
+            s.count += c.count.load(std::memory_order_relaxed);
+            s.total += c.total.load(std::memory_order_relaxed);
+            s.max = std::max(s.max, c.max.load(std::memory_order_relaxed));
+        }
+        return s;
+    }
+
+    std::uint64_t dropped() const
+    {
+        std::uint64_t n = 0;
+        const std::uint32_t threads = nBuffers.load(std::memory_order_acquire);
+        for (std::uint32_t t = 0; t < threads; ++t)
+        {
+            n += buffers[t]->dropped.load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    void dumpEvery(unsigned seconds)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        while (!wake.wait_for(guard, std::chrono::seconds(seconds), [this] { return stopping; }))
+        {
+            guard.unlock();
+            detail::Output out(metricsPath.c_str());
+            writeMetrics(out);
+            guard.lock();
+        }
+    }
+
+    static void onSignal(int signal);
+
+  public:
+    Recorder()
+    {
+        // Index 0 takes the names that do not fit.
+        names[0].category = "trace";
+        std::memcpy(names[0].name, "other", 6);
+        names[0].size = 5;
+        nNames.store(1, std::memory_order_relaxed);
+
+        const char *trace = std::getenv("SSTORY_TRACE");
+        const char *metrics = std::getenv("SSTORY_METRICS");
+        const char *period = std::getenv("SSTORY_METRICS_PERIOD");
+        if (trace)
+            tracePath = trace;
+        if (metrics)
+        {
+            metricsPath = metrics;
+            const int seconds = period ? std::atoi(period) : 10;
+            dumper = std::thread(&Recorder::dumpEvery, this, seconds > 0 ? seconds : 10);
+        }
+        // Interrupted programs still leave their files, sloop.h flushes them too when it takes the signals over.
+        if (trace || metrics)
+        {
+            std::signal(SIGINT, onSignal);
+            std::signal(SIGTERM, onSignal);
+            std::signal(SIGHUP, onSignal);
+        }
+    }
+
+    ~Recorder()
+    {
+        if (dumper.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            dumper.join();
+        }
+        flush();
+    }
+
+    std::uint64_t now() const
+    {
+        return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count());
+    }
+
+    //! Id of the category, a string literal, and name, which does not need to be terminated.
+    std::uint32_t intern(const char *category, const char *name, std::size_t size)
+    {
+        size = fit(name, size);
+        const std::uint64_t h = hash(category, name, size);
+        Buffer *b = local();
+        Slot *empty = nullptr;
+        if (b)
+        {
+            for (std::size_t i = h % CACHE;; i = (i + 1) % CACHE)
+            {
+                const Slot &slot = b->cache[i];
+                if (!slot.category)
+                {
+                    empty = &b->cache[i];
+                    break;
+                }
+                const Name &known = names[slot.id];
+                if (slot.hash == h && slot.category == category && known.size == size &&
+                    std::memcmp(known.name, name, size) == 0)
+                    return slot.id;
+            }
+        }
+        const std::uint32_t id = internSlow(category, name, size);
+        // Half full at most, so probing always ends at an empty slot.
+        if (empty && id != 0 && b->cached < CACHE / 2)
+        {
+            empty->category = category;
+            empty->hash = h;
+            empty->id = id;
+            ++b->cached;
+        }
+        return id;
+    }
+
+    //! Adds an event of an interned name.
+    void add(std::uint32_t name, std::uint64_t begin, std::uint64_t duration)
+    {
+        Buffer *b = local();
+        if (!b)
+            return;
+        Counter &c = b->stats[name];
+        c.count.store(c.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        c.total.store(c.total.load(std::memory_order_relaxed) + duration, std::memory_order_relaxed);
+        if (duration > c.max.load(std::memory_order_relaxed))
+            c.max.store(duration, std::memory_order_relaxed);
+
+        const std::size_t n = b->size.load(std::memory_order_relaxed);
+        if (n == MAX_EVENTS)
+        {
+            b->dropped.store(b->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        Record *chunk = b->chunks[n / CHUNK].load(std::memory_order_relaxed);
+        if (!chunk)
+        {
+            chunk = new Record[CHUNK];
+            b->chunks[n / CHUNK].store(chunk, std::memory_order_release);
+        }
+        chunk[n % CHUNK] = Record{name, begin, duration};
+        b->size.store(n + 1, std::memory_order_release);
+    }
+
+    //! Adds an event, name does not need to be terminated.
+    void add(const char *category, const char *name, std::size_t size, std::uint64_t begin, std::uint64_t duration)
+    {
+        add(intern(category, name, size), begin, duration);
+    }
+
+    //! Counts an event without duration.
+    void mark(const char *category, const char *name, std::size_t size)
+    {
+        add(category, name, size, now(), 0);
+    }
+
+    void mark(const char *category, const std::string &name)
+    {
+        mark(category, name.data(), name.size());
+    }
+
+    //! Chrome trace event format, complete events for timings and instant ones for counts.
+    void writeTrace(detail::Output &out) const
+    {
+        out.put("{\"traceEvents\":[");
+        bool first = true;
+        const std::uint32_t threads = nBuffers.load(std::memory_order_acquire);
+        for (std::uint32_t t = 0; t < threads; ++t)
+        {
+            const Buffer &b = *buffers[t];
+            const std::size_t size = b.size.load(std::memory_order_acquire);
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                const Record &r = b.chunks[i / CHUNK].load(std::memory_order_acquire)[i % CHUNK];
+                const Name &name = names[r.name];
+                out.put(first ? "\n" : ",\n").put("{\"name\":").json(name.name).put(",\"cat\":").json(name.category);
+                out.put(",\"pid\":1,\"tid\":").number(b.thread).put(",\"ts\":").decimal(r.begin, 1000);
+                if (r.duration > 0)
+                    out.put(",\"ph\":\"X\",\"dur\":").decimal(r.duration, 1000).put('}');
+                else
+                    out.put(",\"ph\":\"i\",\"s\":\"t\"}");
+                first = false;
+            }
+        }
+        out.put("\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":").number(dropped()).put("}}\n");
+    }
+
+    //! One line per category and name: count, total and maximum milliseconds.
+    void writeMetrics(detail::Output &out) const
+    {
+        out.put("# ").decimal(now(), 1000000000).put(" s, ").number(dropped()).put(" events dropped\n");
+        out.put("category", 9).put("name", 41).put("     count").put("     total ms").put("     max ms\n");
+        std::uint32_t order[MAX_NAMES];
+        const std::uint32_t n = nNames.load(std::memory_order_acquire);
+        for (std::uint32_t i = 0; i < n; ++i)
+        {
+            order[i] = i;
+        }
+        std::sort(order, order + n, [this](std::uint32_t a, std::uint32_t b) {
+            const int category = std::strcmp(names[a].category, names[b].category);
+            return category != 0 ? category < 0 : std::strcmp(names[a].name, names[b].name) < 0;
+        });
+        for (std::uint32_t i = 0; i < n; ++i)
+        {
+            const Name &name = names[order[i]];
+            const Stats s = sum(order[i]);
+            if (s.count == 0)
+                continue;
+            out.put(name.category, 8).put(' ').put(name.name, 40).put(' ').number(s.count, 10).put(' ');
+            out.decimal(s.total, 1000000, 12).put(' ').decimal(s.max, 1000000, 10).put('\n');
+        }
+    }
+
+    //! Writes the files asked for with what was recorded so far, also from a signal handler.
+    void flush() const
+    {
+        if (!metricsPath.empty())
+        {
+            detail::Output out(metricsPath.c_str());
+            writeMetrics(out);
+        }
+        if (!tracePath.empty())
+        {
+            detail::Output out(tracePath.c_str());
+            writeTrace(out);
+        }
+    }
+
+    //! Aggregate for one category and name, zero if never seen.
+    Stats get(const std::string &category, const std::string &name)
+    {
+        std::uint32_t id = 0;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            const auto found = ids.find(category + '\0' + name.substr(0, fit(name.data(), name.size())));
+            if (found == ids.end())
+                return Stats();
+            id = found->second;
+        }
+        return sum(id);
+    }
+};
+
+static Recorder TRACE;
+
+inline void Recorder::onSignal(int signal)
+{
+    TRACE.flush();
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+class Scope
+{
+    //! Times the enclosing block.
+  private:
+    std::uint32_t name;
+    std::uint64_t begin;
+
+  public:
+    Scope(const char *category, const char *n, std::size_t size)
+        : name(TRACE.intern(category, n, size)), begin(TRACE.now()) {}
+    Scope(const char *category, const std::string &n)
+        : Scope(category, n.data(), n.size()) {}
+    Scope(const char *category, const char *n)
+        : Scope(category, n, std::strlen(n)) {}
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+    ~Scope()
+    {
+        const std::uint64_t end = TRACE.now();
+        // A zero duration would read as a count.
+        TRACE.add(name, begin, end > begin ? end - begin : 1);
+    }
+};
+
+} // namespace STrace;
+
+#define STRACE_CONCAT2(a, b) a##b
+#define STRACE_CONCAT(a, b) STRACE_CONCAT2(a, b)
+//! Times the rest of the enclosing block under category and name.
+#define STRACE_SCOPE(...) STrace::Scope STRACE_CONCAT(strace_scope_, __LINE__)(__VA_ARGS__)
+//! Runs the statement only in traced builds.
+#define STRACE(...) __VA_ARGS__
+
+#else
+
+#define STRACE_SCOPE(...)
+#define STRACE(...)
+
+#endif // SSTORY_TRACE
+
+#endif // STrace_h